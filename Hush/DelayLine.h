@@ -0,0 +1,84 @@
+//
+//  DelayLine.h
+//
+//  A fixed length delay for a set of channels. Only resize() allocates, so it
+//  belongs in Reset(); process() and advance() are safe on the audio thread.
+//
+
+#ifndef __DELAYLINE__
+#define __DELAYLINE__
+
+#include <string.h>
+#include "heapbuf.h"
+
+class DelayLine {
+private:
+    WDL_TypedBuf<double> buf;   //One line of nLength per channel, back to back
+    int nChannels;
+    int nLength;
+    int nPos;                   //Read/write position, the same for every channel
+
+public:
+    DelayLine() : nChannels(0), nLength(0), nPos(0) {}
+
+    void resize(int channels, int length)
+    {
+        nChannels = channels;
+        nLength = length;
+        buf.Resize(channels * length);
+        clear();
+    }
+
+    void clear()
+    {
+        memset(buf.Get(), 0, nChannels * nLength * sizeof(double));
+        nPos = 0;
+    }
+
+    int getLength() const { return nLength; }
+
+    // Delays nFrames of one channel, pIn and pOut may be the same buffer.
+    // Every channel starts from the same position until advance() is called.
+    template <class SAMPLETYPE>
+    void process(int channel, const SAMPLETYPE* pIn, SAMPLETYPE* pOut, int nFrames)
+    {
+        if(!nLength)
+        {
+            if(pIn != pOut)
+                memcpy(pOut, pIn, nFrames * sizeof(SAMPLETYPE));
+            return;
+        }
+
+        double* pLine = buf.Get() + channel * nLength;
+        int pos = nPos;
+        while (nFrames > 0)
+        {
+            //Up to the end of the line, then wrap
+            int n = nLength - pos;
+            if(n > nFrames)
+                n = nFrames;
+            double* p = pLine + pos;
+            for (int i = 0; i < n; ++i)
+            {
+                double x = pIn[i];
+                pOut[i] = (SAMPLETYPE) p[i];
+                p[i] = x;
+            }
+            pIn += n;
+            pOut += n;
+            nFrames -= n;
+            pos += n;
+            if(pos == nLength)
+                pos = 0;
+        }
+    }
+
+    // Moves past a block once every channel has been through process().
+    void advance(int nFrames)
+    {
+        if(nLength)
+            nPos = (nPos + nFrames) % nLength;
+    }
+};
+
+#endif
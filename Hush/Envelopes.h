@@ -9,6 +9,9 @@
 #ifndef __ENVELOPES__
 #define __ENVELOPES__
 
+#include <string.h>
+#include <math.h>
+
 enum EnvelopeState {
     ENVS_IDLE = 0,
     ENVS_ATTACK,
@@ -17,10 +20,27 @@ enum EnvelopeState {
     ENVS_RELEASE
 };
 
+// Stage shapes. The curved ones are RC charges toward a target overshooting the
+// stage's end level, the ratio sets how far past it and so how curved they are.
+enum EnvelopeCurve {
+    ENVC_LINEAR = 0,
+    ENVC_ANALOG,
+    ENVC_EXPONENTIAL,
+    ENVC_MAX
+};
+
+static const double envCurveRatio[ENVC_MAX] = { 0.0, 0.3, 0.001 };
+
 static const char* envID = "IADSR";
 
 static const double ONE_SECOND = 1000.0f;
 
+// A gate change at a sample offset within the block being rendered.
+struct GateEvent {
+    int  mOffset;
+    bool mGate;
+};
+
 class EnvADSR {
 private:
     double fSampleRate;
@@ -30,6 +50,14 @@ private:
     double fRelease;
     double fCurrentValue;
     
+    EnvelopeCurve eAttackCurve;
+    EnvelopeCurve eDecayCurve;
+    EnvelopeCurve eReleaseCurve;
+    
+    // Every stage is value = value * mul + add per sample, recomputed whenever a parameter changes.
+    double fAttackMul, fAttackAdd;
+    double fDecayMul, fDecayAdd;
+    double fReleaseMul, fReleaseAdd;
     
     EnvelopeState state;
     bool          bGate;
@@ -44,11 +72,14 @@ public:
         fSustain(sustain),
         fRelease(release),
         fCurrentValue(0.0f),
+        eAttackCurve(ENVC_LINEAR),
+        eDecayCurve(ENVC_LINEAR),
+        eReleaseCurve(ENVC_LINEAR),
         state(ENVS_IDLE),
         bGate(false)
         
     {
-        
+        updateCoefficients();
     }
     
     void setGate(bool gateValue)
@@ -60,11 +91,15 @@ public:
         }
     }
     
-    void setSampleRate(double sampleRate) { fSampleRate = sampleRate; }
-    void setAttack(double attack) { fAttack = attack; }
-    void setDecay(double decay) { fDecay = decay; }
-    void setSustain(double sustain) { fSustain = sustain; }
-    void setRelease(double release) { fRelease = release; }
+    void setSampleRate(double sampleRate) { fSampleRate = sampleRate; updateCoefficients(); }
+    void setAttack(double attack) { fAttack = attack; updateCoefficients(); }
+    void setDecay(double decay) { fDecay = decay; updateCoefficients(); }
+    void setSustain(double sustain) { fSustain = sustain; updateCoefficients(); }
+    void setRelease(double release) { fRelease = release; updateCoefficients(); }
+    
+    void setAttackCurve(EnvelopeCurve curve) { eAttackCurve = curve; updateCoefficients(); }
+    void setDecayCurve(EnvelopeCurve curve) { eDecayCurve = curve; updateCoefficients(); }
+    void setReleaseCurve(EnvelopeCurve curve) { eReleaseCurve = curve; updateCoefficients(); }
     
     void setADSR(double attack, double decay, double sustain, double release)
     {
@@ -72,6 +107,7 @@ public:
         fDecay = decay;
         fSustain = sustain;
         fRelease = release;
+        updateCoefficients();
     }
     
     double getSampleRate() { return fSampleRate; }
@@ -80,9 +116,25 @@ public:
     double getSustain() { return fSustain; }
     double getRelease() { return fRelease; }
     
+    EnvelopeCurve getAttackCurve() { return eAttackCurve; }
+    EnvelopeCurve getDecayCurve() { return eDecayCurve; }
+    EnvelopeCurve getReleaseCurve() { return eReleaseCurve; }
+    
     double getCurrentValue() { return fCurrentValue; }
     
     EnvelopeState getState() { return state; }
+    bool getGate() { return bGate; }
+    
+    // Idle and sustain hold a flat value until the gate changes.
+    bool isHolding() { return state == ENVS_IDLE || state == ENVS_SUSTAIN; }
+    
+    // Back to idle with the gate off, settings are kept.
+    void reset()
+    {
+        fCurrentValue = 0.0;
+        state = ENVS_IDLE;
+        bGate = false;
+    }
     
     double update()
     {
@@ -90,7 +142,7 @@ public:
         {
             case ENVS_ATTACK:
             {
-                fCurrentValue += ONE_SECOND / fSampleRate / fAttack;
+                fCurrentValue = fCurrentValue * fAttackMul + fAttackAdd;
                 
                 if(fCurrentValue >= 1.0)
                 {
@@ -102,7 +154,7 @@ public:
             
             case ENVS_DECAY:
             {
-                fCurrentValue -= ONE_SECOND / fSampleRate / fDecay * fSustain;
+                fCurrentValue = fCurrentValue * fDecayMul + fDecayAdd;
                 
                 if(fCurrentValue <= fSustain)
                 {
@@ -121,7 +173,7 @@ public:
                 
             case ENVS_RELEASE:
             {
-                fCurrentValue -= ONE_SECOND / fSampleRate / fRelease;
+                fCurrentValue = fCurrentValue * fReleaseMul + fReleaseAdd;
                 if(fCurrentValue <= 0.0f)
                 {
                     fCurrentValue = 0.0f;
@@ -136,6 +188,144 @@ public:
         
         return fCurrentValue;
     }
+    
+    // Renders nFrames of envelope output into gainOut. Events must be sorted by
+    // offset, each one is applied before the sample at its offset. The output is
+    // identical to calling setGate()/update() once per sample.
+    void render(double* gainOut, int nFrames, const GateEvent* events = 0, int nEvents = 0)
+    {
+        int pos = 0;
+        for (int i = 0; i < nEvents; ++i)
+        {
+            int offset = events[i].mOffset;
+            if (offset > nFrames) offset = nFrames;
+            
+            if (offset > pos)
+            {
+                renderSegment(gainOut + pos, offset - pos);
+                pos = offset;
+            }
+            setGate(events[i].mGate);
+        }
+        
+        if (nFrames > pos)
+            renderSegment(gainOut + pos, nFrames - pos);
+    }
+    
+private:
+    void updateCoefficients()
+    {
+        // Times are for a full scale move (release from 1.0, like the linear ramp), decay only ever goes 1.0 to sustain.
+        stageCoefficients(fAttack, 0.0, 1.0, eAttackCurve, &fAttackMul, &fAttackAdd);
+        stageCoefficients(fDecay, 1.0, fSustain, eDecayCurve, &fDecayMul, &fDecayAdd);
+        stageCoefficients(fRelease, 1.0, 0.0, eReleaseCurve, &fReleaseMul, &fReleaseAdd);
+    }
+    
+    // Coefficients to go from start to end in time ms. Linear is a plain ramp (mul is 1.0,
+    // so it's the same arithmetic as adding an increment). The curves go as
+    // v = target + (v - target) * mul, which lands on end after time ms for a target past end.
+    void stageCoefficients(double time, double start, double end, EnvelopeCurve curve, double* pMul, double* pAdd)
+    {
+        if (time <= 0.0)
+        {
+            // Straight to the end on the next sample.
+            *pMul = 0.0;
+            *pAdd = end;
+        }
+        else if (curve == ENVC_LINEAR)
+        {
+            *pMul = 1.0;
+            *pAdd = (end - start) * (ONE_SECOND / fSampleRate / time);
+        }
+        else
+        {
+            double ratio = envCurveRatio[curve];
+            double target = end + (end - start) * ratio;
+            *pMul = exp(log(ratio / (1.0 + ratio)) / (time * fSampleRate / ONE_SECOND));
+            *pAdd = target * (1.0 - *pMul);
+        }
+    }
+    
+    // Renders n samples with no gate changes, one ramp or flat fill per stage.
+    void renderSegment(double* out, int n)
+    {
+        while (n > 0)
+        {
+            int i = 0;
+            double v = fCurrentValue;
+            
+            switch (state) 
+            {
+                case ENVS_ATTACK:
+                {
+                    while (i < n)
+                    {
+                        v = v * fAttackMul + fAttackAdd;
+                        if(v >= 1.0)
+                        {
+                            out[i++] = v = 1.0f;
+                            state = ENVS_DECAY;
+                            break;
+                        }
+                        out[i++] = v;
+                    }
+                    break;
+                }
+                
+                case ENVS_DECAY:
+                {
+                    while (i < n)
+                    {
+                        v = v * fDecayMul + fDecayAdd;
+                        if(v <= fSustain)
+                        {
+                            out[i++] = v = fSustain;
+                            state = ENVS_SUSTAIN;
+                            break;
+                        }
+                        out[i++] = v;
+                    }
+                    break;
+                }
+                
+                case ENVS_SUSTAIN:
+                {
+                    v = fSustain;
+                    for (; i < n; ++i)
+                        out[i] = v;
+                    break;
+                }
+                    
+                case ENVS_RELEASE:
+                {
+                    while (i < n)
+                    {
+                        v = v * fReleaseMul + fReleaseAdd;
+                        if(v <= 0.0f)
+                        {
+                            out[i++] = v = 0.0f;
+                            state = ENVS_IDLE;
+                            break;
+                        }
+                        out[i++] = v;
+                    }
+                    break;
+                }
+                    
+                default:
+                {
+                    // Idle is only ever reached from the initial state or the end of a release, both +0.0.
+                    memset(out, 0, n * sizeof(double));
+                    i = n;
+                    break;
+                }
+            }
+            
+            fCurrentValue = v;
+            out += i;
+            n -= i;
+        }
+    }
 };
 
 
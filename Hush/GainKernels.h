@@ -0,0 +1,264 @@
+//
+//  GainKernels.h
+//
+//  Multiplies channel buffers by a rendered gain curve or a constant gain.
+//  The SIMD paths are picked at runtime, everything else falls back to
+//  plain C.
+//
+
+#ifndef __GAINKERNELS__
+#define __GAINKERNELS__
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define GAIN_KERNELS_X86
+    #include <immintrin.h>
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+        #define GAIN_KERNELS_TARGET_AVX
+    #else
+        #define GAIN_KERNELS_TARGET_AVX __attribute__((target("avx")))
+    #endif
+#endif
+
+typedef void (*GainMulProc)(const double* pIn, double* pOut, const double* pGain, int n);
+typedef void (*GainScaleProc)(const double* pIn, double* pOut, double gain, int n);
+
+// Float buffers are multiplied in double and rounded once, exactly what
+// converting to double, processing and converting back used to produce.
+typedef void (*GainMulFloatProc)(const float* pIn, float* pOut, const double* pGain, int n);
+typedef void (*GainScaleFloatProc)(const float* pIn, float* pOut, double gain, int n);
+
+static void GainMulScalar(const double* pIn, double* pOut, const double* pGain, int n)
+{
+    for (int i = 0; i < n; ++i)
+        pOut[i] = pIn[i] * pGain[i];
+}
+
+static void GainScaleScalar(const double* pIn, double* pOut, double gain, int n)
+{
+    for (int i = 0; i < n; ++i)
+        pOut[i] = pIn[i] * gain;
+}
+
+static void GainMulFloatScalar(const float* pIn, float* pOut, const double* pGain, int n)
+{
+    for (int i = 0; i < n; ++i)
+        pOut[i] = (float) ((double) pIn[i] * pGain[i]);
+}
+
+static void GainScaleFloatScalar(const float* pIn, float* pOut, double gain, int n)
+{
+    for (int i = 0; i < n; ++i)
+        pOut[i] = (float) ((double) pIn[i] * gain);
+}
+
+#ifdef GAIN_KERNELS_X86
+
+// Unaligned loads everywhere, hosts make no promises about buffer alignment.
+// Every chunk is loaded before it is stored so in place processing is fine.
+
+static void GainMulSSE2(const double* pIn, double* pOut, const double* pGain, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128d a = _mm_mul_pd(_mm_loadu_pd(pIn + i), _mm_loadu_pd(pGain + i));
+        __m128d b = _mm_mul_pd(_mm_loadu_pd(pIn + i + 2), _mm_loadu_pd(pGain + i + 2));
+        _mm_storeu_pd(pOut + i, a);
+        _mm_storeu_pd(pOut + i + 2, b);
+    }
+    GainMulScalar(pIn + i, pOut + i, pGain + i, n - i);
+}
+
+static void GainScaleSSE2(const double* pIn, double* pOut, double gain, int n)
+{
+    __m128d g = _mm_set1_pd(gain);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128d a = _mm_mul_pd(_mm_loadu_pd(pIn + i), g);
+        __m128d b = _mm_mul_pd(_mm_loadu_pd(pIn + i + 2), g);
+        _mm_storeu_pd(pOut + i, a);
+        _mm_storeu_pd(pOut + i + 2, b);
+    }
+    GainScaleScalar(pIn + i, pOut + i, gain, n - i);
+}
+
+static void GainMulFloatSSE2(const float* pIn, float* pOut, const double* pGain, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 in = _mm_loadu_ps(pIn + i);
+        __m128d lo = _mm_mul_pd(_mm_cvtps_pd(in), _mm_loadu_pd(pGain + i));
+        __m128d hi = _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(in, in)), _mm_loadu_pd(pGain + i + 2));
+        _mm_storeu_ps(pOut + i, _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi)));
+    }
+    GainMulFloatScalar(pIn + i, pOut + i, pGain + i, n - i);
+}
+
+static void GainScaleFloatSSE2(const float* pIn, float* pOut, double gain, int n)
+{
+    __m128d g = _mm_set1_pd(gain);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 in = _mm_loadu_ps(pIn + i);
+        __m128d lo = _mm_mul_pd(_mm_cvtps_pd(in), g);
+        __m128d hi = _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(in, in)), g);
+        _mm_storeu_ps(pOut + i, _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi)));
+    }
+    GainScaleFloatScalar(pIn + i, pOut + i, gain, n - i);
+}
+
+GAIN_KERNELS_TARGET_AVX static void GainMulAVX(const double* pIn, double* pOut, const double* pGain, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256d a = _mm256_mul_pd(_mm256_loadu_pd(pIn + i), _mm256_loadu_pd(pGain + i));
+        __m256d b = _mm256_mul_pd(_mm256_loadu_pd(pIn + i + 4), _mm256_loadu_pd(pGain + i + 4));
+        _mm256_storeu_pd(pOut + i, a);
+        _mm256_storeu_pd(pOut + i + 4, b);
+    }
+    _mm256_zeroupper();
+    GainMulSSE2(pIn + i, pOut + i, pGain + i, n - i);
+}
+
+GAIN_KERNELS_TARGET_AVX static void GainScaleAVX(const double* pIn, double* pOut, double gain, int n)
+{
+    __m256d g = _mm256_set1_pd(gain);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256d a = _mm256_mul_pd(_mm256_loadu_pd(pIn + i), g);
+        __m256d b = _mm256_mul_pd(_mm256_loadu_pd(pIn + i + 4), g);
+        _mm256_storeu_pd(pOut + i, a);
+        _mm256_storeu_pd(pOut + i + 4, b);
+    }
+    _mm256_zeroupper();
+    GainScaleSSE2(pIn + i, pOut + i, gain, n - i);
+}
+
+GAIN_KERNELS_TARGET_AVX static void GainMulFloatAVX(const float* pIn, float* pOut, const double* pGain, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256d a = _mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(pIn + i)), _mm256_loadu_pd(pGain + i));
+        __m256d b = _mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(pIn + i + 4)), _mm256_loadu_pd(pGain + i + 4));
+        _mm_storeu_ps(pOut + i, _mm256_cvtpd_ps(a));
+        _mm_storeu_ps(pOut + i + 4, _mm256_cvtpd_ps(b));
+    }
+    _mm256_zeroupper();
+    GainMulFloatSSE2(pIn + i, pOut + i, pGain + i, n - i);
+}
+
+GAIN_KERNELS_TARGET_AVX static void GainScaleFloatAVX(const float* pIn, float* pOut, double gain, int n)
+{
+    __m256d g = _mm256_set1_pd(gain);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256d a = _mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(pIn + i)), g);
+        __m256d b = _mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(pIn + i + 4)), g);
+        _mm_storeu_ps(pOut + i, _mm256_cvtpd_ps(a));
+        _mm_storeu_ps(pOut + i + 4, _mm256_cvtpd_ps(b));
+    }
+    _mm256_zeroupper();
+    GainScaleFloatSSE2(pIn + i, pOut + i, gain, n - i);
+}
+
+// AVX needs both the CPU flag and the OS saving the upper ymm halves.
+static bool CpuHasAVX()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    return osxsave && avx && (_xgetbv(0) & 6) == 6;
+#else
+    return __builtin_cpu_supports("avx");
+#endif
+}
+
+#endif // GAIN_KERNELS_X86
+
+struct GainKernels
+{
+    GainMulProc mMul;
+    GainScaleProc mScale;
+    GainMulFloatProc mMulFloat;
+    GainScaleFloatProc mScaleFloat;
+
+    GainKernels() 
+    :   mMul(GainMulScalar), mScale(GainScaleScalar), 
+        mMulFloat(GainMulFloatScalar), mScaleFloat(GainScaleFloatScalar)
+    {
+    #ifdef GAIN_KERNELS_X86
+        mMul = GainMulSSE2;
+        mScale = GainScaleSSE2;
+        mMulFloat = GainMulFloatSSE2;
+        mScaleFloat = GainScaleFloatSSE2;
+        if (CpuHasAVX())
+        {
+            mMul = GainMulAVX;
+            mScale = GainScaleAVX;
+            mMulFloat = GainMulFloatAVX;
+            mScaleFloat = GainScaleFloatAVX;
+        }
+    #endif
+    }
+};
+
+// The CPU doesn't change under us, so this is only worked out once.
+inline const GainKernels& GetGainKernels()
+{
+    static GainKernels sKernels;
+    return sKernels;
+}
+
+// pOut[s] = pIn[s] * pGain[s], pIn and pOut may be the same buffer.
+inline void ApplyGain(const double* pIn, double* pOut, const double* pGain, int nFrames)
+{
+    GetGainKernels().mMul(pIn, pOut, pGain, nFrames);
+}
+
+inline void ApplyGain(const float* pIn, float* pOut, const double* pGain, int nFrames)
+{
+    GetGainKernels().mMulFloat(pIn, pOut, pGain, nFrames);
+}
+
+inline void ScaleGain(const double* pIn, double* pOut, double gain, int nFrames)
+{
+    GetGainKernels().mScale(pIn, pOut, gain, nFrames);
+}
+
+inline void ScaleGain(const float* pIn, float* pOut, double gain, int nFrames)
+{
+    GetGainKernels().mScaleFloat(pIn, pOut, gain, nFrames);
+}
+
+// pOut[s] = pIn[s] * gain. Fully open is a copy, fully closed is a clear.
+template <class SAMPLETYPE>
+inline void ApplyConstantGain(const SAMPLETYPE* pIn, SAMPLETYPE* pOut, double gain, int nFrames)
+{
+    if (gain == 1.0)
+    {
+        if (pOut != pIn)
+            memcpy(pOut, pIn, nFrames * sizeof(SAMPLETYPE));
+    }
+    else if (gain == 0.0)
+    {
+        memset(pOut, 0, nFrames * sizeof(SAMPLETYPE));
+    }
+    else
+    {
+        ScaleGain(pIn, pOut, gain, nFrames);
+    }
+}
+
+#endif
@@ -1,6 +1,9 @@
 #include "IPlugHush.h"
 #include "IPlug/IPlug_include_in_plug_src.h"
+#ifndef NO_IGRAPHICS
 #include "IPlug/IPopupControl.h"
+#include "MeterControl.h"
+#endif
 
 #include "resource.h"
 #include <math.h>
@@ -15,7 +18,19 @@ enum EParams
     kDecay,
     kSustain,
     kRelease,
-	kNumParams
+    kAttackCurve,
+    kDecayCurve,
+    kReleaseCurve,
+    kMidiKeyHigh,
+    kTrigger,
+    kThreshold,
+    kHysteresis,
+    kDetector,
+    kLookahead,
+    kSteps,
+    kSwing,
+    kStepDepth,     //MAX_STEPS of these, one per step
+	kNumParams = kStepDepth + MAX_STEPS
 };
 
 enum EHushCommand 
@@ -31,6 +46,44 @@ enum EGateType {
 	EGT_Max
 };
 
+enum ETrigger {
+    ETR_Midi = 0,
+    ETR_Sidechain,
+    ETR_Both,
+    ETR_Steps,
+    ETR_Max
+};
+
+enum EStepLength {
+    ESL_16 = 0,
+    ESL_32,
+    ESL_64,
+    ESL_Max
+};
+
+enum EDetector {
+    EDT_Peak = 0,
+    EDT_Rms,
+    EDT_Max
+};
+
+//Audio thread state shown in the GUI, see OnPublishedValue
+enum EPublished {
+    EPB_Gain = 0,
+    EPB_ListenKeys,
+    EPB_Meters      //One slot per EMeter, linear
+};
+
+//Meter bars show this much below full scale, and the API never goes below its negative
+static const double METER_RANGE_DB = 60.0;
+static const double METER_FLOOR_DB = -120.0;
+
+//Sidechain levels are measured per window, so triggers land on window boundaries
+static const int SIDECHAIN_WINDOW = 32;
+
+//Samples for a step's depth to move full scale, so tied steps of different depth dont click
+static const int STEP_DEPTH_RAMP = 64;
+
 enum EChannelSwitch 
 {
 	kDefault = 0,
@@ -70,6 +123,8 @@ void GetKeyName(char* pBuff, int keyIndex)
     }
 }
 
+#ifndef NO_IGRAPHICS
+
 class ICommandControl : public IControl
 {
 public:
@@ -115,11 +170,13 @@ protected:
     int m_nCommand;
 };
 
+#endif // NO_IGRAPHICS
+
 
 
 
 PlugHush::PlugHush(IPlugInstanceInfo instanceInfo)
-:	IPLUG_CTOR(kNumParams, 1, instanceInfo), prevL(0.0), prevR(0.0), m_nGainPct(1.0), m_nNote(-1), m_bMidiLearnEnabled(false), m_ADSR( GetSampleRate() )
+:	IPLUG_CTOR(kNumParams, 1, instanceInfo), m_nGateType(EGT_Up), m_nKeyLow(-1), m_nKeyHigh(-1), m_bLatched(false), m_nTrigger(ETR_Midi), m_nDetector(EDT_Peak), m_fThreshold(-30.0), m_fHysteresis(6.0), m_bKeyOpen(false), m_nKeyWindows(0), m_nNextKeyWindow(0), m_nSteps(16), m_fSwing(0.5), m_bStepOpen(false), m_fDepth(1.0), m_fDepthTarget(1.0), m_nStepEdges(0), m_nNextStepEdge(0), m_nGainPct(1.0), m_oParamQueue(PARAM_CHANGES_PER_BLOCK), m_bMidiLearnEnabled(false), m_ADSR( GetSampleRate() )
 {
   TRACE;
 
@@ -130,12 +187,15 @@ PlugHush::PlugHush(IPlugInstanceInfo instanceInfo)
 
 	//GetParam(kMidiKey)->InitInt("Key", -1, -1, 128, "");
     GetParam(kMidiKey)->InitEnum("Key", 0, 121);
+    //Anything above Key listens to the whole range, a drum map for example
+    GetParam(kMidiKeyHigh)->InitEnum("Key high", 0, 121);
     
     for(int i=0; i < 122; i++)
     {
         char buff[16];
         GetKeyName(buff, i-1);
         GetParam(kMidiKey)->SetDisplayText(i, buff);
+        GetParam(kMidiKeyHigh)->SetDisplayText(i, i ? buff : "-");
     }
     
     m_ADSR.setADSR(30.0, 0.0, 1.0, 30.0);
@@ -149,10 +209,60 @@ PlugHush::PlugHush(IPlugInstanceInfo instanceInfo)
     GetParam(kDecay)->InitDouble("Decay", m_ADSR.getDecay(), 0.0f, 1000.0f, 0.1f, "ms");
     GetParam(kSustain)->InitDouble("Sustain", m_ADSR.getSustain(), 0.0f, 1.0f, 0.01f, "%");
     GetParam(kRelease)->InitDouble("Release", m_ADSR.getRelease(), 0.0f, 1000.0f, 0.1f, "ms");
+    
+    //Stage shapes, no knobs for these yet so they're host automation only
+    GetParam(kAttackCurve)->InitEnum("Attack curve", m_ADSR.getAttackCurve(), ENVC_MAX);
+    GetParam(kDecayCurve)->InitEnum("Decay curve", m_ADSR.getDecayCurve(), ENVC_MAX);
+    GetParam(kReleaseCurve)->InitEnum("Release curve", m_ADSR.getReleaseCurve(), ENVC_MAX);
+    
+    for(int i = kAttackCurve; i <= kReleaseCurve; i++)
+    {
+        GetParam(i)->SetDisplayText(ENVC_LINEAR, "linear");
+        GetParam(i)->SetDisplayText(ENVC_ANALOG, "analog");
+        GetParam(i)->SetDisplayText(ENVC_EXPONENTIAL, "exp");
+    }
 
     
-    MakeDefaultPreset("Default");
+    //Sidechain trigger, the key is any inputs past the main channels (3-1, 4-2)
+    GetParam(kTrigger)->InitEnum("Trigger", ETR_Midi, ETR_Max);
+    GetParam(kTrigger)->SetDisplayText(ETR_Midi, "midi");
+    GetParam(kTrigger)->SetDisplayText(ETR_Sidechain, "sidechain");
+    GetParam(kTrigger)->SetDisplayText(ETR_Both, "both");
+    GetParam(kTrigger)->SetDisplayText(ETR_Steps, "steps");
+    GetParam(kThreshold)->InitDouble("Threshold", m_fThreshold, -60.0, 0.0, 0.1, "dB");
+    GetParam(kHysteresis)->InitDouble("Hysteresis", m_fHysteresis, 0.0, 24.0, 0.1, "dB");
+    GetParam(kDetector)->InitEnum("Detector", EDT_Peak, EDT_Max);
+    GetParam(kDetector)->SetDisplayText(EDT_Peak, "peak");
+    GetParam(kDetector)->SetDisplayText(EDT_Rms, "rms");
+    UpdateDetector();
+    
+    //Delays the audio so the gate is already opening when a hit gets there, reported as latency
+    GetParam(kLookahead)->InitDouble("Lookahead", 0.0, 0.0, 20.0, 0.1, "ms");
+    
+    //Step sequencer, sixteenth note steps following the host transport. Every other step to start with
+    GetParam(kSteps)->InitEnum("Steps", ESL_16, ESL_Max);
+    GetParam(kSteps)->SetDisplayText(ESL_16, "16");
+    GetParam(kSteps)->SetDisplayText(ESL_32, "32");
+    GetParam(kSteps)->SetDisplayText(ESL_64, "64");
+    GetParam(kSwing)->InitDouble("Swing", 50.0, 50.0, 75.0, 0.1, "%");
+    
+    for(int i = 0; i < MAX_STEPS; i++)
+    {
+        char name[16];
+        sprintf(name, "Step %d", i + 1);
+        m_StepDepth[i] = (i % 2) ? 0.0 : 1.0;
+        GetParam(kStepDepth + i)->InitDouble(name, m_StepDepth[i], 0.0, 1.0, 0.01, "%");
+    }
+    
+    if (!MakePresetsFromLibrary(PRESETS_FN))
+        MakeDefaultPreset("Default");
+    
+    m_PiecePtrs.Resize(NInChannels() + NOutChannels());
+    
+    //Float hosts get their buffers gated directly, no conversion to double and back
+    SetDoesSingleReplacing(true);
 
+#ifndef NO_IGRAPHICS
 	// Instantiate a graphics engine.
 
     IBitmap bitmap;
@@ -182,6 +292,13 @@ PlugHush::PlugHush(IPlugInstanceInfo instanceInfo)
     bitmap = pGraphics->LoadIBitmap(IMG_LED_ID, IMG_LED_FN, 20);
 	m_nLEDIdx = pGraphics->AttachControl(new ISwitchControl(this, 6, 24, -1, &bitmap));
     
+    //Meters, gate in and out with the gain reduction hanging down beside them
+    const IColor meterColor(160, 255, 255, 255);
+    IRECT inMeter(136, 22, 140, 98), outMeter(141, 22, 145, 98), reductionMeter(146, 22, 150, 98);
+    m_nInMeterIdx = pGraphics->AttachControl(new MeterControl(this, &inMeter, &meterColor));
+    m_nOutMeterIdx = pGraphics->AttachControl(new MeterControl(this, &outMeter, &meterColor));
+    m_nReductionMeterIdx = pGraphics->AttachControl(new MeterControl(this, &reductionMeter, &COLOR_RED, true));
+    
     //Gate type knob
     bitmap = pGraphics->LoadIBitmap(IMG_KNOB1_ID, IMG_KNOB1_FN, 3);
     pGraphics->AttachControl(new IKnobMultiControl(this, 36, 28, kGateType, &bitmap, kVertical, 1));
@@ -220,12 +337,14 @@ PlugHush::PlugHush(IPlugInstanceInfo instanceInfo)
     //m_nTextIdx = pGraphics->AttachControl(pTestCtrl);
 
 	AttachGraphics(pGraphics);
+#endif
 
 	// No cleanup necessary, the graphics engine manages all of its resources and cleans up when closed.
 }
 
-void PlugHush::SetMidiAreaText(char* pText, const IColor* color)
+void PlugHush::SetMidiAreaText(const char* pText, const IColor* color)
 {
+#ifndef NO_IGRAPHICS
     if( GetGUI() )
     {
         ITextControl* pTextCtrl = (ITextControl*)(GetGUI()->GetControl(m_nMidiTextIdx));
@@ -236,49 +355,314 @@ void PlugHush::SetMidiAreaText(char* pText, const IColor* color)
         pTextCtrl->GetITTextRef().mColor.G = color->G;
         pTextCtrl->GetITTextRef().mColor.B = color->B;
     }
+#endif
 
 }
 
-void PlugHush::SetMidiAreaKey(int index, const IColor* color)
+void PlugHush::SetMidiAreaKeys(int lowKey, int highKey, const IColor* color)
 {
-    char buff[16];
-    GetKeyName(buff, index);
+    char buff[32];
+    if(lowKey >= 0 && highKey > lowKey)
+    {
+        //No spaces so a range still fits, C1-B2
+        sprintf(buff, "%s%d-%s%d", g_KeyNames[lowKey % 12], (lowKey / 12) - 2, g_KeyNames[highKey % 12], (highKey / 12) - 2);
+    }
+    else
+    {
+        GetKeyName(buff, lowKey);
+    }
     
     SetMidiAreaText(buff, color);
 }
 
 void PlugHush::Reset()
 {
-    int listenKey = GetParam(kMidiKey)->Int() - 1;
-    SetMidiAreaKey( listenKey , &COLOR_WHITE);
-    
+    //Start closed with nothing pending, the host may have moved anywhere
+    m_nKeyLow = GetParam(kMidiKey)->Int() - 1;
+    m_nKeyHigh = GetParam(kMidiKeyHigh)->Int() - 1;
+    UpdateListenKeys();
+    m_oMidiQueue.Clear();
+    m_oParamQueue.Clear();
+    m_ADSR.reset();
+    m_InMeter.reset();
+    m_OutMeter.reset();
+    m_ReductionMeter.reset();
     m_ADSR.setSampleRate( GetSampleRate() );
     
+    m_GateEvents.Resize(GetBlockSize() + 1);
+    m_GainBuf.Resize(GetBlockSize());
+    m_KeyLevels.Resize(GetBlockSize() / SIDECHAIN_WINDOW + 1);
+    m_nKeyWindows = 0;
+    
+    //The only place the lookahead changes, the delay line allocates and hosts only pick up latency here
+    int nLookahead = int(GetParam(kLookahead)->Value() * 0.001 * GetSampleRate() + 0.5);
+    m_Delay.resize(NOutChannels(), nLookahead);
+    if(nLookahead != GetLatency())
+        SetLatency(nLookahead);
+    
+    m_nTrigger = GetParam(kTrigger)->Int();
+    m_nDetector = GetParam(kDetector)->Int();
+    m_fThreshold = GetParam(kThreshold)->Value();
+    m_fHysteresis = GetParam(kHysteresis)->Value();
+    m_bKeyOpen = false;
+    UpdateDetector();
+    
+    m_StepEdges.Resize(GetBlockSize() + 1);
+    m_nStepEdges = 0;
+    m_nSteps = 16 << GetParam(kSteps)->Int();
+    m_fSwing = GetParam(kSwing)->Value() / 100.0;
+    for(int i = 0; i < MAX_STEPS; i++)
+        m_StepDepth[i] = GetParam(kStepDepth + i)->Value();
+    m_bStepOpen = false;
+    m_fDepth = m_fDepthTarget = 1.0;
+    
+    m_nGateType = GetParam(kGateType)->Int();
+    
     double fAttack = GetParam(kAttack)->Value();
     double fDecay = GetParam(kDecay)->Value();
     double fSustain = GetParam(kSustain)->Value();
     double fRelease = GetParam(kRelease)->Value();
     
     m_ADSR.setADSR(fAttack, fDecay, fSustain, fRelease);
+    
+    m_ADSR.setAttackCurve( (EnvelopeCurve)GetParam(kAttackCurve)->Int() );
+    m_ADSR.setDecayCurve( (EnvelopeCurve)GetParam(kDecayCurve)->Int() );
+    m_ADSR.setReleaseCurve( (EnvelopeCurve)GetParam(kReleaseCurve)->Int() );
 }
 
 void PlugHush::OnParamChange(int paramIdx)
 {
-    if(paramIdx == kMidiKey || paramIdx == kGateType)
+    ApplyParam(paramIdx, GetParam(paramIdx)->Value());
+}
+
+void PlugHush::ProcessParamChange(IParamChange* pChange)
+{
+    //Held until RenderGain reaches its offset
+    m_oParamQueue.Add(pChange);
+}
+
+void PlugHush::ApplyParam(int paramIdx, double value)
+{
+    switch (paramIdx)
+    {
+        case kGateType:
+            m_nGateType = int(value);
+            UpdateListenKeys();
+            break;
+        case kMidiKey:
+            m_nKeyLow = int(value) - 1;
+            UpdateListenKeys();
+            break;
+        case kMidiKeyHigh:
+            m_nKeyHigh = int(value) - 1;
+            UpdateListenKeys();
+            break;
+        case kTrigger:
+            m_nTrigger = int(value);
+            m_bKeyOpen = false;
+            m_bStepOpen = false;
+            m_fDepth = m_fDepthTarget = 1.0;
+            break;
+        case kThreshold:
+            m_fThreshold = value;
+            UpdateDetector();
+            break;
+        case kHysteresis:
+            m_fHysteresis = value;
+            UpdateDetector();
+            break;
+        case kDetector:
+            m_nDetector = int(value);
+            break;
+        case kLookahead:
+            //Picked up by the next Reset
+            break;
+        case kSteps:
+            m_nSteps = 16 << int(value);
+            break;
+        case kSwing:
+            m_fSwing = value / 100.0;
+            break;
+        case kAttack:
+            m_ADSR.setAttack(value);
+            break;
+        case kDecay:
+            m_ADSR.setDecay(value);
+            break;
+        case kSustain:
+            m_ADSR.setSustain(value);
+            break;
+        case kRelease:
+            m_ADSR.setRelease(value);
+            break;
+        case kAttackCurve:
+            m_ADSR.setAttackCurve( (EnvelopeCurve)int(value) );
+            break;
+        case kDecayCurve:
+            m_ADSR.setDecayCurve( (EnvelopeCurve)int(value) );
+            break;
+        case kReleaseCurve:
+            m_ADSR.setReleaseCurve( (EnvelopeCurve)int(value) );
+            break;
+        default:
+            if(paramIdx >= kStepDepth && paramIdx < kStepDepth + MAX_STEPS)
+                m_StepDepth[paramIdx - kStepDepth] = value;
+            break;
+    }
+}
+
+void PlugHush::UpdateListenKeys()
+{
+    m_ListenKeys.clear();
+    if(m_nKeyLow == -1)
+        m_ListenKeys.addRange(0, NUM_MIDI_NOTES - 1);
+    else
+        m_ListenKeys.addRange(m_nKeyLow, MAX(m_nKeyLow, m_nKeyHigh));
+    
+    //Same as changing the key used to, start over with nothing held
+    m_HeldNotes.clear();
+    m_bLatched = false;
+    
+    //Both keys in one value so the GUI never sees half a change, -1 becomes 0
+    PublishValue(EPB_ListenKeys, (m_nKeyLow + 1) * 256 + (m_nKeyHigh + 1));
+}
+
+void PlugHush::UpdateDetector()
+{
+    m_fOpenLevel = pow(10.0, m_fThreshold / 20.0);
+    m_fCloseLevel = pow(10.0, (m_fThreshold - m_fHysteresis) / 20.0);
+}
+
+template <class SAMPLETYPE>
+void PlugHush::DetectKeyLevels(SAMPLETYPE** inputs, int nFrames)
+{
+    m_nKeyWindows = 0;
+    m_nNextKeyWindow = 0;
+    
+    //The key is whatever is connected past the main channels, which match the outputs
+    int nMain = 0;
+    for (int c = 0; c < NOutChannels(); ++c)
+    {
+        if(IsOutChannelConnected(c))
+            nMain = c + 1;
+    }
+    
+    int nWindows = (nFrames + SIDECHAIN_WINDOW - 1) / SIDECHAIN_WINDOW;
+    double* pLevels = m_KeyLevels.Get();
+    
+    int nKey = 0;
+    for (int c = nMain; c < NInChannels(); ++c)
     {
-        m_nNote = -1;
+        if(!IsInChannelConnected(c))
+            continue;
+        
+        if(!nKey)
+            memset(pLevels, 0, nWindows * sizeof(double));
+        ++nKey;
         
-        int listenKey = GetParam(kMidiKey)->Int() - 1;
-        SetMidiAreaKey( listenKey , &COLOR_WHITE);
+        for (int w = 0; w < nWindows; ++w)
+        {
+            int offset = w * SIDECHAIN_WINDOW;
+            int n = MIN(SIDECHAIN_WINDOW, nFrames - offset);
+            
+            //Loudest channel for peak, mean over every channel for rms
+            if(m_nDetector == EDT_Peak)
+                pLevels[w] = MAX(pLevels[w], PeakLevel(inputs[c] + offset, n));
+            else
+                pLevels[w] += SumSquares(inputs[c] + offset, n) / n;
+        }
+    }
+    
+    if(!nKey)
+        return;
+    
+    if(m_nDetector == EDT_Rms)
+    {
+        for (int w = 0; w < nWindows; ++w)
+            pLevels[w] = sqrt(pLevels[w] / nKey);
+    }
+    
+    m_nKeyWindows = nWindows;
+}
+
+void PlugHush::UpdateKey(double level, int gateType)
+{
+    if(!m_bKeyOpen && level >= m_fOpenLevel)
+    {
+        m_bKeyOpen = true;
+        
+        //A hit is a press as far as toggle is concerned
+        if(gateType == EGT_Toggle)
+            m_bLatched = !m_bLatched;
+    }
+    else if(m_bKeyOpen && level < m_fCloseLevel)
+    {
+        m_bKeyOpen = false;
     }
-    else if(paramIdx >= kAttack && paramIdx <= kRelease)
+}
+
+void PlugHush::PrepareSteps(int offset, int nFrames)
+{
+    m_nStepEdges = 0;
+    m_nNextStepEdge = 0;
+    
+    if(m_nTrigger != ETR_Steps)
+        return;
+    
+    //Once per block, without a tempo the sequencer just holds where it is
+    m_StepClock.set(GetSamplesPerBeat() / 4.0, m_fSwing);
+    m_nStepEdges = m_StepClock.edges(GetSamplePos() + offset, nFrames, m_StepEdges.Get(), m_StepEdges.GetSize());
+}
+
+void PlugHush::UpdateStep(long long step, int gateType)
+{
+    bool open = (m_StepDepth[step % m_nSteps] > 0.0);
+    
+    //Steps tie, only a rest to step edge is a press as far as toggle is concerned
+    if(open && !m_bStepOpen && gateType == EGT_Toggle)
+        m_bLatched = !m_bLatched;
+    
+    m_bStepOpen = open;
+}
+
+void PlugHush::ApplyDepth(double* pEnv, int start, int nFrames, const StepEdge* pEdges, int nEdges)
+{
+    int pos = 0;
+    int edge = 0;
+    while (pos < nFrames)
     {
-        double fAttack = GetParam(kAttack)->Value();
-        double fDecay = GetParam(kDecay)->Value();
-        double fSustain = GetParam(kSustain)->Value();
-        double fRelease = GetParam(kRelease)->Value();
+        //Up to the next step, which may move the target
+        int end = nFrames;
+        for (; edge < nEdges; ++edge)
+        {
+            int offset = pEdges[edge].mOffset - start;
+            if(offset > pos)
+            {
+                end = MIN(offset, nFrames);
+                break;
+            }
+            //Rests keep the last depth so the release isnt cut short
+            double depth = m_StepDepth[pEdges[edge].mStep % m_nSteps];
+            if(depth > 0.0)
+                m_fDepthTarget = depth;
+        }
+        
+        for (; pos < end && m_fDepth != m_fDepthTarget; ++pos)
+        {
+            const double step = 1.0 / STEP_DEPTH_RAMP;
+            if(m_fDepth < m_fDepthTarget)
+                m_fDepth = MIN(m_fDepth + step, m_fDepthTarget);
+            else
+                m_fDepth = MAX(m_fDepth - step, m_fDepthTarget);
+            pEnv[pos] *= m_fDepth;
+        }
         
-        m_ADSR.setADSR(fAttack, fDecay, fSustain, fRelease);
+        if(m_fDepth != 1.0)
+        {
+            for (; pos < end; ++pos)
+                pEnv[pos] *= m_fDepth;
+        }
+        pos = end;
     }
 }
 
@@ -289,17 +673,18 @@ void PlugHush::OnCustomCommand(int commandID, int nAction)
         {
             if(m_bMidiLearnEnabled) //Midi learn enabled? set back to any key
             {
-                GetParam(kMidiKey)->Set( 0 );
-
-                InformHostOfParamChange(kMidiKey, GetParam(kMidiKey)->GetNormalized());
-                
-                SetMidiAreaKey(-1, &COLOR_WHITE);
-                
                 m_bMidiLearnEnabled = false;
+                
+                //Queued for the audio thread like a knob turn, which publishes the new keys.
+                //Put the current ones back meanwhile, they may already be any key
+                OnPublishedValue(EPB_ListenKeys, GetPublishedValue(EPB_ListenKeys));
+                SetParameterFromGUI(kMidiKey, GetParam(kMidiKey)->GetNormalized(0));
+                SetParameterFromGUI(kMidiKeyHigh, GetParam(kMidiKeyHigh)->GetNormalized(0));
             }
             else
             {
                 SetMidiAreaText("----", &COLOR_RED);
+                ForgetPublishedValue(EPB_ListenKeys);
                 m_bMidiLearnEnabled = true;
             }
             
@@ -310,13 +695,53 @@ void PlugHush::OnCustomCommand(int commandID, int nAction)
     }
 }
 
+void PlugHush::OnPublishedValue(int slot, double value)
+{
+#ifndef NO_IGRAPHICS
+    if( !GetGUI() )
+        return;
+    
+    switch (slot)
+    {
+        case EPB_Gain:
+            GetGUI()->SetControlFromPlug(m_nLEDIdx, value);
+            break;
+        case EPB_Meters + EMT_InPeak:
+        case EPB_Meters + EMT_OutPeak:
+        {
+            double db = value > 0.0 ? AmpToDB(value) : -METER_RANGE_DB;
+            int idx = (slot == EPB_Meters + EMT_InPeak) ? m_nInMeterIdx : m_nOutMeterIdx;
+            GetGUI()->SetControlFromPlug(idx, 1.0 + db / METER_RANGE_DB);
+            break;
+        }
+        case EPB_Meters + EMT_Reduction:
+        {
+            double db = value < 1.0 ? -AmpToDB(1.0 - value) : METER_RANGE_DB;
+            GetGUI()->SetControlFromPlug(m_nReductionMeterIdx, db / METER_RANGE_DB);
+            break;
+        }
+        case EPB_ListenKeys:
+        {
+            //Learning keeps showing ---- until a note arrives, which may be the key shown before
+            if(m_bMidiLearnEnabled)
+            {
+                ForgetPublishedValue(EPB_ListenKeys);
+                break;
+            }
+            int keys = int(value);
+            SetMidiAreaKeys(keys / 256 - 1, keys % 256 - 1, &COLOR_WHITE);
+            break;
+        }
+        default:
+            break;
+    }
+#endif
+}
+
 void PlugHush::ProcessMidiMsg(IMidiMsg* pMsg)
 {
     int status = pMsg->StatusMsg();
     
-    int listenKey = GetParam(kMidiKey)->Int() - 1;
-    
-    
     switch (status)
     {
         case IMidiMsg::kNoteOn:
@@ -324,19 +749,22 @@ void PlugHush::ProcessMidiMsg(IMidiMsg* pMsg)
             
             if(m_bMidiLearnEnabled)
             {
+                //Learns a single key
                 GetParam(kMidiKey)->Set( double( pMsg->NoteNumber()+1 ) );
+                GetParam(kMidiKeyHigh)->Set( 0 );
                 m_bMidiLearnEnabled = false;
                 
                 InformHostOfParamChange(kMidiKey, GetParam(kMidiKey)->GetNormalized());
+                InformHostOfParamChange(kMidiKeyHigh, GetParam(kMidiKeyHigh)->GetNormalized());
                 
-                SetMidiAreaKey( pMsg->NoteNumber() , &COLOR_WHITE);
+                m_nKeyLow = pMsg->NoteNumber();
+                m_nKeyHigh = -1;
+                UpdateListenKeys();
                 
                 return;
             }
             
-            if(listenKey != -1 && pMsg->NoteNumber() != listenKey)
-                return; //Dont add to queue if were not listening for you!
-            
+            //Keys we arent listening for are dropped when they come due, the keys may change before then
             break;
         // Discard all other MIDI messages.
 		default:
@@ -359,32 +787,109 @@ void PlugHush::ProcessMidiMsg(IMidiMsg* pMsg)
     }*/
 }
 
-void PlugHush::ProcessDoubleReplacing(double** inputs, double** outputs, int nFrames)
+void PlugHush::ProcessMidiMsgs(const IMidiMsg* pMsgs, int n)
 {
-  // Mutex is already locked for us.
+    //Learning takes the first note and changes what the ones after it mean
+    if(m_bMidiLearnEnabled)
+    {
+        IPlugBase::ProcessMidiMsgs(pMsgs, n);
+        return;
+    }
+    
+    //Same split as ProcessMidiMsg: note on/off (0x80-0x9F) is queued, the rest passes through
+    for (int i = 0; i < n; ++i)
+    {
+        if((pMsgs[i].mStatus & 0xE0) == 0x80)
+        {
+            m_oMidiQueue.Add(pMsgs + i);
+        }
+        else
+        {
+            IMidiMsg msg = pMsgs[i];
+            SendMidiMsg(&msg);
+        }
+    }
+}
 
-    double* in1 = inputs[0];
-    double* in2 = inputs[1];
-    double* out1 = outputs[0];
-    double* out2 = outputs[1];
+bool PlugHush::RenderGain(int nFrames)
+{
+    double* pGain = m_GainBuf.Get();
+    bool bGainCurve = false;
+    int start = 0;
+    
+    //Parameter changes split the block, each piece renders with the settings due at its start
+    for (;;)
+    {
+        while (!m_oParamQueue.Empty() && m_oParamQueue.Peek()->mOffset <= start)
+        {
+            IParamChange* pChange = m_oParamQueue.Peek();
+            ApplyParam(pChange->mIdx, GetParam(pChange->mIdx)->GetNonNormalized(pChange->mValue));
+            m_oParamQueue.Remove();
+        }
+        
+        int end = nFrames;
+        if(!m_oParamQueue.Empty() && m_oParamQueue.Peek()->mOffset < nFrames)
+            end = m_oParamQueue.Peek()->mOffset;
+        
+        if(RenderGainSegment(start, end))
+        {
+            bGainCurve = true;
+        }
+        else if(start > 0 || end < nFrames) //Only part of the block is constant
+        {
+            for (int s = start; s < end; ++s)
+                pGain[s] = m_nGainPct;
+            bGainCurve = true;
+        }
+        
+        if(end >= nFrames)
+            break;
+        
+        start = end;
+    }
+    
+    m_oParamQueue.Flush(nFrames);
+    
+    return bGainCurve;
+}
 
+bool PlugHush::RenderGainSegment(int start, int end)
+{
+    EGateType gateType = (EGateType)m_nGateType;
     
-    //double peakL = 0.0, peakR = 0.0;
+    GateEvent* pEvents = m_GateEvents.Get();
+    int nEvents = 0;
     
+    bool gate = m_ADSR.getGate();
+    int offset = start;
     
-    static int tLastMidiNote = -1;
+    bool useKey = (m_nTrigger == ETR_Sidechain || m_nTrigger == ETR_Both);
+    bool useMidi = (m_nTrigger == ETR_Midi || m_nTrigger == ETR_Both);
     
-    EGateType gateType = (EGateType)GetParam(kGateType)->Int();
+    const StepEdge* pStepEdges = m_StepEdges.Get();
+    int firstStepEdge = m_nNextStepEdge;
     
-    double peakMidiGate = 0.0f;
-
-    for (int s = 0; s < nFrames; ++s, ++in1, ++in2, ++out1, ++out2) 
+    for (;;) 
     {
+        while (m_nNextStepEdge < m_nStepEdges && pStepEdges[m_nNextStepEdge].mOffset <= offset)
+        {
+            UpdateStep(pStepEdges[m_nNextStepEdge].mStep, gateType);
+            ++m_nNextStepEdge;
+        }
+        
+        //Sidechain windows starting here go first, then MIDI, both land in the same gate events
+        while (m_nNextKeyWindow < m_nKeyWindows && m_nNextKeyWindow * SIDECHAIN_WINDOW <= offset)
+        {
+            if(useKey)
+                UpdateKey(m_KeyLevels.Get()[m_nNextKeyWindow], gateType);
+            ++m_nNextKeyWindow;
+        }
+        
+        //Handle every message due at this offset before looking at the gate
         while (!m_oMidiQueue.Empty())
 		{
 			IMidiMsg* pMsg = m_oMidiQueue.Peek();
-			// Stop when we've reached the current sample frame (offset).
-			if (pMsg->mOffset > s)
+			if (pMsg->mOffset > offset)
 				break;
             
             // Handle the MIDI message.
@@ -395,23 +900,23 @@ void PlugHush::ProcessDoubleReplacing(double** inputs, double** outputs, int nFr
 				case IMidiMsg::kNoteOff:
 				{
 					int velocity = pMsg->Velocity();
+                    int note = pMsg->NoteNumber();
                     
-                    tLastMidiNote = pMsg->NoteNumber();
-                    
+                    if(!useMidi || !m_ListenKeys.contains(note))
+                        break;
 
 					if (status == IMidiMsg::kNoteOn && velocity)
 					{
-                        if(gateType == EGT_Toggle && m_nNote != -1) //Were in toggle and note is set, turn it off
-                            m_nNote = -1;
-                        else
-                            m_nNote = pMsg->NoteNumber(); //All other cases we turn note on
+                        m_HeldNotes.add(note);
                         
+                        //Every press flips toggle, pads often never send note offs
+                        if(gateType == EGT_Toggle)
+                            m_bLatched = !m_bLatched;
 					}
 					// Note Off
 					else
 					{
-						if (pMsg->NoteNumber() == m_nNote && gateType != EGT_Toggle) //If were in toggle mode, dont reset
-							m_nNote = -1;
+                        m_HeldNotes.remove(note);
 					}
 					break;
 				}
@@ -421,49 +926,216 @@ void PlugHush::ProcessDoubleReplacing(double** inputs, double** outputs, int nFr
 			m_oMidiQueue.Remove();
         }
         
-        if(m_nNote != -1)
-        {
-            //m_nGainPct = 0;
-            m_ADSR.setGate(true);
-        }
-        else
+        //Up and down follow the keys, open while any of them is held
+        bool noteOn = (gateType == EGT_Toggle) ? m_bLatched : (m_HeldNotes.any() || m_bKeyOpen || m_bStepOpen);
+        if(noteOn != gate)
         {
-            m_ADSR.setGate(false);
+            pEvents[nEvents].mOffset = offset - start;
+            pEvents[nEvents].mGate = noteOn;
+            ++nEvents;
+            
+            gate = noteOn;
         }
         
+        int next = end;
+        if(!m_oMidiQueue.Empty() && m_oMidiQueue.Peek()->mOffset < next)
+            next = m_oMidiQueue.Peek()->mOffset;
+        if(m_nNextKeyWindow < m_nKeyWindows && m_nNextKeyWindow * SIDECHAIN_WINDOW < next)
+            next = m_nNextKeyWindow * SIDECHAIN_WINDOW;
+        if(m_nNextStepEdge < m_nStepEdges && pStepEdges[m_nNextStepEdge].mOffset < next)
+            next = pStepEdges[m_nNextStepEdge].mOffset;
         
-        if(gateType == EGT_Down) 
-            m_nGainPct = m_ADSR.update(); //No need to negate it
-        else
-            m_nGainPct = 1.0 - m_ADSR.update();
+        if(next >= end)
+            break;
+        
+        offset = next;
+    }
+    
+    //Step depth is flat unless a step moves it or it's still ramping
+    const StepEdge* pSegmentEdges = pStepEdges + firstStepEdge;
+    int nSegmentEdges = m_nNextStepEdge - firstStepEdge;
+    bool depthSteady = (m_fDepth == m_fDepthTarget);
+    for (int e = 0; e < nSegmentEdges && depthSteady; ++e)
+    {
+        double depth = m_StepDepth[pSegmentEdges[e].mStep % m_nSteps];
+        depthSteady = (depth == 0.0 || depth == m_fDepthTarget);
+    }
+    
+    if(nEvents == 0 && m_ADSR.isHolding() && depthSteady)
+    {
+        //Fully open or fully closed blocks dont need a gain curve
+        double env = m_ADSR.update() * m_fDepth;
+        m_nGainPct = (gateType == EGT_Down) ? env : 1.0 - env;
+        
+        return false;
+    }
+    
+    //Render the envelope for the segment, then turn it into gain
+    int nFrames = end - start;
+    double* pGain = m_GainBuf.Get() + start;
+    m_ADSR.render(pGain, nFrames, pEvents, nEvents);
+    if(nSegmentEdges || !depthSteady || m_fDepth != 1.0)
+        ApplyDepth(pGain, start, nFrames, pSegmentEdges, nSegmentEdges);
+    
+    if(gateType != EGT_Down) //Down doesnt need to be negated
+    {
+        for (int s = 0; s < nFrames; ++s)
+            pGain[s] = 1.0 - pGain[s];
+    }
+    
+    if(nFrames > 0)
+        m_nGainPct = pGain[nFrames - 1];
+    
+    return true;
+}
 
-        *out1 = *in1 * m_nGainPct;
-        *out2 = *in2 * m_nGainPct;
+void PlugHush::UpdateMeters(const BlockLevels& levels, bool bGainCurve, int nFrames)
+{
+    m_MeterBallistics.set(nFrames, GetSampleRate());
+    
+    double scale = levels.nSamples ? 1.0 / levels.nSamples : 0.0;
+    m_InMeter.update(levels.fInPeak, levels.fInSum * scale, m_MeterBallistics);
+    m_OutMeter.update(levels.fOutPeak, levels.fOutSum * scale, m_MeterBallistics);
+    
+    //Deepest the gain went this block
+    double minGain = m_nGainPct;
+    if(bGainCurve)
+    {
+        const double* pGain = m_GainBuf.Get();
+        minGain = 1.0;
+        for (int s = 0; s < nFrames; ++s)
+            minGain = pGain[s] < minGain ? pGain[s] : minGain;
+    }
+    double reduction = 1.0 - minGain;
+    m_ReductionMeter.update(reduction, reduction * reduction, m_MeterBallistics);
+    
+    PublishValue(EPB_Meters + EMT_InPeak, m_InMeter.peak());
+    PublishValue(EPB_Meters + EMT_InRms, m_InMeter.rms());
+    PublishValue(EPB_Meters + EMT_OutPeak, m_OutMeter.peak());
+    PublishValue(EPB_Meters + EMT_OutRms, m_OutMeter.rms());
+    PublishValue(EPB_Meters + EMT_Reduction, m_ReductionMeter.peak());
+}
 
+double PlugHush::GetMeter(int meter)
+{
+    if(meter < 0 || meter >= EMT_Max)
+        return 0.0;
+    
+    double value = ReadPublishedValue(EPB_Meters + meter);
+    double db;
+    if(meter == EMT_Reduction)
+        db = value > 0.0 ? -AmpToDB(1.0 - value) : 0.0;
+    else
+        db = AmpToDB(value);
+    
+    //Silence and a closed gate are infinite
+    if(db < METER_FLOOR_DB)
+        return METER_FLOOR_DB;
+    if(db > -METER_FLOOR_DB)
+        return -METER_FLOOR_DB;
+    return db;
+}
 
-        //peakL = MAX(peakL, fabs(*out1));
-        //peakR = MAX(peakR, fabs(*out2));
+template <class SAMPLETYPE>
+void PlugHush::ProcessGate(SAMPLETYPE** inputs, SAMPLETYPE** outputs, int nFrames)
+{
+    //Hosts should never exceed the block size, but dont trust them
+    int nMax = m_GainBuf.GetSize();
+    if(nFrames <= nMax)
+    {
+        ProcessGateBlock(inputs, outputs, nFrames, 0);
+        return;
+    }
+    
+    //Not reset yet, nothing to gate with
+    if(nMax < 1)
+    {
+        for (int c = 0; c < NOutChannels(); ++c)
+        {
+            if(IsOutChannelConnected(c))
+                memset(outputs[c], 0, nFrames * sizeof(SAMPLETYPE));
+        }
+        return;
+    }
+    
+    SAMPLETYPE** pInputs = (SAMPLETYPE**) m_PiecePtrs.Get();
+    SAMPLETYPE** pOutputs = pInputs + NInChannels();
+    for (int offset = 0; offset < nFrames; offset += nMax)
+    {
+        for (int c = 0; c < NInChannels(); ++c)
+            pInputs[c] = inputs[c] ? inputs[c] + offset : 0;
+        for (int c = 0; c < NOutChannels(); ++c)
+            pOutputs[c] = outputs[c] ? outputs[c] + offset : 0;
         
-        //peakMidiGate = MAX(peakMidiGate, m_nGainPct);
+        //Queued MIDI and parameter changes move on a piece at a time
+        ProcessGateBlock(pInputs, pOutputs, MIN(nMax, nFrames - offset), offset);
     }
+}
 
-    //const double METER_ATTACK = 0.6, METER_DECAY = 0.1;
-    //double xL = (peakL < prevL ? METER_DECAY : METER_ATTACK);
-    //double xR = (peakR < prevR ? METER_DECAY : METER_ATTACK);
-
-    //peakL = peakL * xL + prevL * (1.0 - xL);
-    //peakR = peakR * xR + prevR * (1.0 - xR);
-
-    //prevL = peakL;
-	//prevR = peakR;
+template <class SAMPLETYPE>
+void PlugHush::ProcessGateBlock(SAMPLETYPE** inputs, SAMPLETYPE** outputs, int nFrames, int offset)
+{
+    BlockLevels levels = { 0.0, 0.0, 0.0, 0.0, 0 };
+    
+    DetectKeyLevels(inputs, nFrames);
+    PrepareSteps(offset, nFrames);
+    bool bGainCurve = RenderGain(nFrames);
+    
+    //Only gate channels the host actually connected, anything with no input is just silence
+    for (int c = 0; c < NOutChannels(); ++c) 
+    {
+        if(!IsOutChannelConnected(c))
+            continue;
+        
+        if(!IsInChannelConnected(c))
+        {
+            memset(outputs[c], 0, nFrames * sizeof(SAMPLETYPE));
+            continue;
+        }
+        
+        //Metered before the delay, which may be working in place
+        double peak = PeakLevel(inputs[c], nFrames);
+        levels.fInPeak = peak > levels.fInPeak ? peak : levels.fInPeak;
+        levels.fInSum += SumSquares(inputs[c], nFrames);
+        
+        //With lookahead the gain applies to the delayed audio, in place in the output
+        SAMPLETYPE* pIn = inputs[c];
+        if(m_Delay.getLength())
+        {
+            m_Delay.process(c, inputs[c], outputs[c], nFrames);
+            pIn = outputs[c];
+        }
+        
+        if(bGainCurve)
+            ApplyGain(pIn, outputs[c], m_GainBuf.Get(), nFrames);
+        else
+            ApplyConstantGain(pIn, outputs[c], m_nGainPct, nFrames);
+        
+        peak = PeakLevel(outputs[c], nFrames);
+        levels.fOutPeak = peak > levels.fOutPeak ? peak : levels.fOutPeak;
+        levels.fOutSum += SumSquares(outputs[c], nFrames);
+        levels.nSamples += nFrames;
+    }
+    m_Delay.advance(nFrames);
+    
+    //Ballistics once per block, not per sample
+    UpdateMeters(levels, bGainCurve, nFrames);
     
     // Update the offsets of any MIDI messages still in the queue.
 	m_oMidiQueue.Flush(nFrames);
     
-    if( GetGUI() )
-    {        
-        GetGUI()->SetControlFromPlug(m_nLEDIdx, m_nGainPct);
-    }
+    //The GUI picks this up on its next redraw, only the latest matters
+    PublishValue(EPB_Gain, m_nGainPct);
+}
+
+void PlugHush::ProcessDoubleReplacing(double** inputs, double** outputs, int nFrames)
+{
+    ProcessGate(inputs, outputs, nFrames);
+}
+
+void PlugHush::ProcessSingleReplacing(float** inputs, float** outputs, int nFrames)
+{
+    ProcessGate(inputs, outputs, nFrames);
 }
 
 
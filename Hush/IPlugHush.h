@@ -4,7 +4,23 @@
 // In the project settings, define either VST_API or AU_API.
 #include "IPlug/IPlug_include_in_plug_hdr.h"
 #include "IMidiQueue.h"
+#include "IParamQueue.h"
 #include "Envelopes.h"
+#include "NoteSet.h"
+#include "GainKernels.h"
+#include "LevelKernels.h"
+#include "DelayLine.h"
+#include "StepClock.h"
+#include "LevelMeter.h"
+
+enum EMeter {
+    EMT_InPeak = 0,
+    EMT_InRms,
+    EMT_OutPeak,
+    EMT_OutRms,
+    EMT_Reduction,      //Gain reduction, positive
+    EMT_Max
+};
 
 class PlugHush : public IPlug
 {
@@ -17,22 +33,104 @@ public:
 	// when params change or when audio processing stops/starts.
 	void Reset();
 	void OnParamChange(int paramIdx);
+    void ProcessParamChange(IParamChange* pChange);
 
     void ProcessMidiMsg(IMidiMsg* pMsg);
+    void ProcessMidiMsgs(const IMidiMsg* pMsgs, int n);
 	void ProcessDoubleReplacing(double** inputs, double** outputs, int nFrames);
+	void ProcessSingleReplacing(float** inputs, float** outputs, int nFrames);
     
     void OnCustomCommand(int commandID, int nAction);
+    void OnPublishedValue(int slot, double value);
 
-    void SetMidiAreaText(char* pText, const IColor* color);
-    void SetMidiAreaKey(int index, const IColor* color);
+    void SetMidiAreaText(const char* pText, const IColor* color);
+    void SetMidiAreaKeys(int lowKey, int highKey, const IColor* color);
+    
+    // Latest meter reading in dB, safe from any thread. Clamped to +-120dB.
+    double GetMeter(int meter);
 private:
+    
+    // One block's levels over every gated channel, for the meters.
+    struct BlockLevels {
+        double fInPeak, fInSum;
+        double fOutPeak, fOutSum;
+        int nSamples;
+    };
 
+    // Renders this block's gain into m_GainBuf, or returns false if the
+    // whole block is the constant m_nGainPct.
+    bool RenderGain(int nFrames);
+    // The same for frames start to end, with no parameter changes in between.
+    bool RenderGainSegment(int start, int end);
+    
+    // Applies a parameter to the audio side (envelope, gate type).
+    void ApplyParam(int paramIdx, double value);
+    
+    // Rebuilds m_ListenKeys from m_nKeyLow/m_nKeyHigh and lets go of every note.
+    void UpdateListenKeys();
+    
+    // Open and close levels from the threshold and hysteresis.
+    void UpdateDetector();
+    
+    // Measures the sidechain inputs, one level per SIDECHAIN_WINDOW frames, into m_KeyLevels.
+    template <class SAMPLETYPE>
+    void DetectKeyLevels(SAMPLETYPE** inputs, int nFrames);
+    // Runs the detector on one window's level.
+    void UpdateKey(double level, int gateType);
+    
+    // Finds the step boundaries from the host transport for nFrames starting offset
+    // frames into the host's block, into m_StepEdges.
+    void PrepareSteps(int offset, int nFrames);
+    // Moves the sequencer onto a step.
+    void UpdateStep(long long step, int gateType);
+    // Scales nFrames of envelope by the step depth, edges are the ones this segment started.
+    void ApplyDepth(double* pEnv, int start, int nFrames, const StepEdge* pEdges, int nEdges);
     
+    // Gates a host block in pieces no longer than the buffers sized in Reset, so
+    // nothing has to grow on the audio thread if the host passes more than it said.
+    template <class SAMPLETYPE>
+    void ProcessGate(SAMPLETYPE** inputs, SAMPLETYPE** outputs, int nFrames);
+    template <class SAMPLETYPE>
+    void ProcessGateBlock(SAMPLETYPE** inputs, SAMPLETYPE** outputs, int nFrames, int offset);
+    // Applies a block's levels and gain to the meters and publishes them.
+    void UpdateMeters(const BlockLevels& levels, bool bGainCurve, int nFrames);
     
-    int m_nNote;
     
-	int mMeterIdx_L, mMeterIdx_R;
-	double prevL, prevR;
+    int m_nGateType;
+    int m_nKeyLow, m_nKeyHigh;   //-1 low is any key, high below low is just the one key
+    
+    NoteSet m_ListenKeys;
+    NoteSet m_HeldNotes;         //Listened to keys that are down
+    bool m_bLatched;             //Toggle mode's gate, flipped by every press
+    
+    int m_nTrigger;
+    int m_nDetector;
+    double m_fThreshold, m_fHysteresis;     //dB
+    double m_fOpenLevel, m_fCloseLevel;     //Linear
+    bool m_bKeyOpen;                        //Sidechain is above threshold, counts like a held note
+    
+    WDL_TypedBuf<double> m_KeyLevels;
+    int m_nKeyWindows;           //Measured this block, 0 without a sidechain
+    int m_nNextKeyWindow;
+    
+    //Lookahead, the audio runs this far behind the gate. Sized in Reset.
+    DelayLine m_Delay;
+    
+    //Step sequencer
+    int m_nSteps;                           //Pattern length
+    double m_fSwing;
+    double m_StepDepth[MAX_STEPS];          //0 is a rest
+    bool m_bStepOpen;                       //Current step isn't a rest, counts like a held note
+    double m_fDepth, m_fDepthTarget;        //Envelope scale, ramps to the target over STEP_DEPTH_RAMP
+    
+    StepClock m_StepClock;
+    WDL_TypedBuf<StepEdge> m_StepEdges;
+    int m_nStepEdges;
+    int m_nNextStepEdge;
+    
+    LevelMeter m_InMeter, m_OutMeter;
+    LevelMeter m_ReductionMeter;     //Peak of 1 - gain
+    MeterBallistics m_MeterBallistics;
     
     double m_nGainPct;
     
@@ -40,13 +138,19 @@ private:
     int m_nMidiTextIdx;
     
     int m_nLEDIdx;
+    int m_nInMeterIdx, m_nOutMeterIdx, m_nReductionMeterIdx;
     
     IMidiQueue m_oMidiQueue;
+    IParamQueue m_oParamQueue;
     
     bool m_bMidiLearnEnabled;
     
     EnvADSR m_ADSR;
     
+    WDL_TypedBuf<GateEvent> m_GateEvents;
+    WDL_TypedBuf<double> m_GainBuf;
+    
+    WDL_TypedBuf<void*> m_PiecePtrs;    //Channel pointers into a piece of an oversized block, sized in the constructor
 };
 
 ////////////////////////////////////////
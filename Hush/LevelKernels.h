@@ -0,0 +1,252 @@
+//
+//  LevelKernels.h
+//
+//  Peak and sum of squares over a buffer, for level detection. Like the
+//  gain kernels the SIMD paths are picked at runtime, everything else falls
+//  back to plain C.
+//
+
+#ifndef __LEVELKERNELS__
+#define __LEVELKERNELS__
+
+#include <math.h>
+#include "GainKernels.h"
+
+typedef double (*LevelProc)(const double* pIn, int n);
+typedef double (*LevelFloatProc)(const float* pIn, int n);
+
+static double PeakScalar(const double* pIn, int n)
+{
+    double peak = 0.0;
+    for (int i = 0; i < n; ++i)
+    {
+        double a = fabs(pIn[i]);
+        if (a > peak)
+            peak = a;
+    }
+    return peak;
+}
+
+static double PeakFloatScalar(const float* pIn, int n)
+{
+    float peak = 0.0f;
+    for (int i = 0; i < n; ++i)
+    {
+        float a = fabsf(pIn[i]);
+        if (a > peak)
+            peak = a;
+    }
+    return peak;
+}
+
+static double SumSquaresScalar(const double* pIn, int n)
+{
+    double sum = 0.0;
+    for (int i = 0; i < n; ++i)
+        sum += pIn[i] * pIn[i];
+    return sum;
+}
+
+static double SumSquaresFloatScalar(const float* pIn, int n)
+{
+    double sum = 0.0;
+    for (int i = 0; i < n; ++i)
+        sum += (double) pIn[i] * pIn[i];
+    return sum;
+}
+
+#ifdef GAIN_KERNELS_X86
+
+// maxps/maxpd return their second operand if either is NaN, so samples go
+// first and NaNs lose, like the scalar compare. A bad sample can't hold a gate open.
+
+static double HorizontalMax(__m128d v)
+{
+    return _mm_cvtsd_f64(_mm_max_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+static double HorizontalSum(__m128d v)
+{
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+static double PeakSSE2(const double* pIn, int n)
+{
+    const __m128d absMask = _mm_castsi128_pd(_mm_set1_epi64x(0x7FFFFFFFFFFFFFFFLL));
+    __m128d a = _mm_setzero_pd(), b = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        a = _mm_max_pd(_mm_and_pd(_mm_loadu_pd(pIn + i), absMask), a);
+        b = _mm_max_pd(_mm_and_pd(_mm_loadu_pd(pIn + i + 2), absMask), b);
+    }
+    double peak = HorizontalMax(_mm_max_pd(a, b));
+    double tail = PeakScalar(pIn + i, n - i);
+    return tail > peak ? tail : peak;
+}
+
+static double PeakFloatSSE2(const float* pIn, int n)
+{
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    __m128 a = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+        a = _mm_max_ps(_mm_and_ps(_mm_loadu_ps(pIn + i), absMask), a);
+    a = _mm_max_ps(a, _mm_movehl_ps(a, a));
+    a = _mm_max_ss(a, _mm_shuffle_ps(a, a, 1));
+    double peak = _mm_cvtss_f32(a);
+    double tail = PeakFloatScalar(pIn + i, n - i);
+    return tail > peak ? tail : peak;
+}
+
+static double SumSquaresSSE2(const double* pIn, int n)
+{
+    __m128d a = _mm_setzero_pd(), b = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128d x = _mm_loadu_pd(pIn + i), y = _mm_loadu_pd(pIn + i + 2);
+        a = _mm_add_pd(a, _mm_mul_pd(x, x));
+        b = _mm_add_pd(b, _mm_mul_pd(y, y));
+    }
+    return HorizontalSum(_mm_add_pd(a, b)) + SumSquaresScalar(pIn + i, n - i);
+}
+
+static double SumSquaresFloatSSE2(const float* pIn, int n)
+{
+    __m128d a = _mm_setzero_pd(), b = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 in = _mm_loadu_ps(pIn + i);
+        __m128d x = _mm_cvtps_pd(in), y = _mm_cvtps_pd(_mm_movehl_ps(in, in));
+        a = _mm_add_pd(a, _mm_mul_pd(x, x));
+        b = _mm_add_pd(b, _mm_mul_pd(y, y));
+    }
+    return HorizontalSum(_mm_add_pd(a, b)) + SumSquaresFloatScalar(pIn + i, n - i);
+}
+
+GAIN_KERNELS_TARGET_AVX static double PeakAVX(const double* pIn, int n)
+{
+    const __m256d absMask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7FFFFFFFFFFFFFFFLL));
+    __m256d a = _mm256_setzero_pd(), b = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        a = _mm256_max_pd(_mm256_and_pd(_mm256_loadu_pd(pIn + i), absMask), a);
+        b = _mm256_max_pd(_mm256_and_pd(_mm256_loadu_pd(pIn + i + 4), absMask), b);
+    }
+    a = _mm256_max_pd(a, b);
+    __m128d v = _mm_max_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+    _mm256_zeroupper();
+    double peak = HorizontalMax(v);
+    double tail = PeakSSE2(pIn + i, n - i);
+    return tail > peak ? tail : peak;
+}
+
+GAIN_KERNELS_TARGET_AVX static double PeakFloatAVX(const float* pIn, int n)
+{
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+    __m256 a = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+        a = _mm256_max_ps(_mm256_and_ps(_mm256_loadu_ps(pIn + i), absMask), a);
+    __m128 v = _mm_max_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+    _mm256_zeroupper();
+    v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_max_ss(v, _mm_shuffle_ps(v, v, 1));
+    double peak = _mm_cvtss_f32(v);
+    double tail = PeakFloatSSE2(pIn + i, n - i);
+    return tail > peak ? tail : peak;
+}
+
+GAIN_KERNELS_TARGET_AVX static double SumSquaresAVX(const double* pIn, int n)
+{
+    __m256d a = _mm256_setzero_pd(), b = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256d x = _mm256_loadu_pd(pIn + i), y = _mm256_loadu_pd(pIn + i + 4);
+        a = _mm256_add_pd(a, _mm256_mul_pd(x, x));
+        b = _mm256_add_pd(b, _mm256_mul_pd(y, y));
+    }
+    a = _mm256_add_pd(a, b);
+    __m128d v = _mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+    _mm256_zeroupper();
+    return HorizontalSum(v) + SumSquaresSSE2(pIn + i, n - i);
+}
+
+GAIN_KERNELS_TARGET_AVX static double SumSquaresFloatAVX(const float* pIn, int n)
+{
+    __m256d a = _mm256_setzero_pd(), b = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256d x = _mm256_cvtps_pd(_mm_loadu_ps(pIn + i)), y = _mm256_cvtps_pd(_mm_loadu_ps(pIn + i + 4));
+        a = _mm256_add_pd(a, _mm256_mul_pd(x, x));
+        b = _mm256_add_pd(b, _mm256_mul_pd(y, y));
+    }
+    a = _mm256_add_pd(a, b);
+    __m128d v = _mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+    _mm256_zeroupper();
+    return HorizontalSum(v) + SumSquaresFloatSSE2(pIn + i, n - i);
+}
+
+#endif // GAIN_KERNELS_X86
+
+struct LevelKernels
+{
+    LevelProc mPeak;
+    LevelProc mSumSquares;
+    LevelFloatProc mPeakFloat;
+    LevelFloatProc mSumSquaresFloat;
+
+    LevelKernels()
+    :   mPeak(PeakScalar), mSumSquares(SumSquaresScalar),
+        mPeakFloat(PeakFloatScalar), mSumSquaresFloat(SumSquaresFloatScalar)
+    {
+    #ifdef GAIN_KERNELS_X86
+        mPeak = PeakSSE2;
+        mSumSquares = SumSquaresSSE2;
+        mPeakFloat = PeakFloatSSE2;
+        mSumSquaresFloat = SumSquaresFloatSSE2;
+        if (CpuHasAVX())
+        {
+            mPeak = PeakAVX;
+            mSumSquares = SumSquaresAVX;
+            mPeakFloat = PeakFloatAVX;
+            mSumSquaresFloat = SumSquaresFloatAVX;
+        }
+    #endif
+    }
+};
+
+inline const LevelKernels& GetLevelKernels()
+{
+    static LevelKernels sKernels;
+    return sKernels;
+}
+
+// Largest absolute sample.
+inline double PeakLevel(const double* pIn, int nFrames)
+{
+    return GetLevelKernels().mPeak(pIn, nFrames);
+}
+
+inline double PeakLevel(const float* pIn, int nFrames)
+{
+    return GetLevelKernels().mPeakFloat(pIn, nFrames);
+}
+
+// Sum of the squared samples, divide by nFrames for the mean square.
+inline double SumSquares(const double* pIn, int nFrames)
+{
+    return GetLevelKernels().mSumSquares(pIn, nFrames);
+}
+
+inline double SumSquares(const float* pIn, int nFrames)
+{
+    return GetLevelKernels().mSumSquaresFloat(pIn, nFrames);
+}
+
+#endif
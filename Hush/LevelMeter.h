@@ -0,0 +1,65 @@
+//
+//  LevelMeter.h
+//
+//  Peak and RMS meter ballistics, applied once per block to levels measured
+//  with the LevelKernels. The per block coefficients only depend on the block
+//  length, so they're worked out again only when that changes.
+//
+
+#ifndef __LEVELMETER__
+#define __LEVELMETER__
+
+#include <math.h>
+
+static const double METER_PEAK_RELEASE = 0.75;  //Seconds for a held peak to fall 8.7dB (1/e)
+static const double METER_RMS_TIME = 0.065;     //Seconds, time constant of the mean square, a VU's 300ms rise
+
+class MeterBallistics {
+private:
+    int nFrames;
+    double fSampleRate;
+
+public:
+    double fPeakFall;   //Multiplier for the held peak after a block
+    double fRmsCoef;    //How far the mean square moves toward a block's in one block
+
+    MeterBallistics() : nFrames(0), fSampleRate(0.0), fPeakFall(0.0), fRmsCoef(1.0) {}
+
+    void set(int frames, double sampleRate)
+    {
+        if(frames == nFrames && sampleRate == fSampleRate)
+            return;
+        nFrames = frames;
+        fSampleRate = sampleRate;
+        fPeakFall = exp(-frames / (METER_PEAK_RELEASE * sampleRate));
+        fRmsCoef = 1.0 - exp(-frames / (METER_RMS_TIME * sampleRate));
+    }
+};
+
+class LevelMeter {
+private:
+    double fPeak;
+    double fMeanSquare;
+
+public:
+    LevelMeter() : fPeak(0.0), fMeanSquare(0.0) {}
+
+    void reset()
+    {
+        fPeak = 0.0;
+        fMeanSquare = 0.0;
+    }
+
+    // One block's peak and mean square, over every channel metered.
+    void update(double peak, double meanSquare, const MeterBallistics& b)
+    {
+        double held = fPeak * b.fPeakFall;
+        fPeak = peak > held ? peak : held;
+        fMeanSquare += (meanSquare - fMeanSquare) * b.fRmsCoef;
+    }
+
+    double peak() const { return fPeak; }
+    double rms() const { return sqrt(fMeanSquare); }
+};
+
+#endif
@@ -0,0 +1,57 @@
+//
+//  MeterControl.h
+//
+//  A plain bar for a meter, value 0 to 1. Meters change nearly every block but
+//  mostly by less than a pixel, so the control only gets dirty when the bar
+//  actually moves.
+//
+
+#ifndef __METERCONTROL__
+#define __METERCONTROL__
+
+#include "IControl.h"
+
+class MeterControl : public IControl {
+private:
+    IColor color;
+    bool bFromTop;      //Gain reduction hangs down, levels grow up
+
+    int barHeight(double value) const
+    {
+        if(value < 0.0)
+            value = 0.0;
+        else if(value > 1.0)
+            value = 1.0;
+        return int(value * mRECT.H() + 0.5);
+    }
+
+public:
+    MeterControl(IPlugBase* pPlug, IRECT* pR, const IColor* pColor, bool fromTop = false)
+    :   IControl(pPlug, pR), color(*pColor), bFromTop(fromTop) {}
+
+    bool Draw(IGraphics* pGraphics)
+    {
+        int h = barHeight(mValue);
+        if(!h)
+            return true;
+
+        IRECT bar = mRECT;
+        if(bFromTop)
+            bar.B = bar.T + h;
+        else
+            bar.T = bar.B - h;
+        return pGraphics->FillIRect(&color, &bar);
+    }
+
+    void SetValueFromPlug(double value)
+    {
+        if(mDefaultValue >= 0.0 && barHeight(value) == barHeight(mValue))
+        {
+            mValue = value;
+            return;
+        }
+        IControl::SetValueFromPlug(value);
+    }
+};
+
+#endif
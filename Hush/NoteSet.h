@@ -0,0 +1,69 @@
+//
+//  NoteSet.h
+//
+//  A set of MIDI note numbers, as a 128 bit bitset plus a count so every
+//  operation (including "is anything in it") is constant time.
+//
+
+#ifndef __NOTESET__
+#define __NOTESET__
+
+#include <string.h>
+
+static const int NUM_MIDI_NOTES = 128;
+
+class NoteSet {
+private:
+    unsigned int bits[NUM_MIDI_NOTES / 32];
+    int          nCount;
+
+    static bool isValid(int note) { return note >= 0 && note < NUM_MIDI_NOTES; }
+
+public:
+    NoteSet() { clear(); }
+
+    void clear()
+    {
+        memset(bits, 0, sizeof(bits));
+        nCount = 0;
+    }
+
+    // Returns false if the note was already in the set.
+    bool add(int note)
+    {
+        if(!isValid(note) || contains(note))
+            return false;
+
+        bits[note >> 5] |= 1u << (note & 31);
+        ++nCount;
+        return true;
+    }
+
+    // Returns false if the note wasn't in the set.
+    bool remove(int note)
+    {
+        if(!isValid(note) || !contains(note))
+            return false;
+
+        bits[note >> 5] &= ~(1u << (note & 31));
+        --nCount;
+        return true;
+    }
+
+    // Adds low to high inclusive, clipped to valid notes.
+    void addRange(int low, int high)
+    {
+        for(int note = (low < 0 ? 0 : low); note <= high && note < NUM_MIDI_NOTES; ++note)
+            add(note);
+    }
+
+    bool contains(int note) const
+    {
+        return isValid(note) && (bits[note >> 5] & (1u << (note & 31))) != 0;
+    }
+
+    bool any() const { return nCount > 0; }
+    int count() const { return nCount; }
+};
+
+#endif
@@ -0,0 +1,76 @@
+//
+//  StepClock.h
+//
+//  Where sixteenth note steps fall in samples, with swing. Everything is
+//  worked out from the block's start position, so a block costs one divide
+//  plus one add per step boundary in it, however long the block is.
+//
+
+#ifndef __STEPCLOCK__
+#define __STEPCLOCK__
+
+#include <math.h>
+
+static const int MAX_STEPS = 64;
+
+// A step starting at a sample offset within the block being rendered.
+struct StepEdge {
+    int       mOffset;
+    long long mStep;        //Steps since the start of the project
+};
+
+class StepClock {
+private:
+    double fPairLength;     //Two steps, swing moves the boundary in the middle
+    double fSwingPoint;     //Offset of the second step in a pair
+
+public:
+    StepClock() : fPairLength(0.0), fSwingPoint(0.0) {}
+
+    // swing is the fraction of a pair the first step gets, 0.5 is straight.
+    void set(double samplesPerStep, double swing)
+    {
+        fPairLength = 2.0 * samplesPerStep;
+        fSwingPoint = fPairLength * swing;
+    }
+
+    bool isRunning() const { return fPairLength > 0.0; }
+
+    long long stepAt(double pos) const
+    {
+        double pair = floor(pos / fPairLength);
+        return (long long) pair * 2 + (pos - pair * fPairLength >= fSwingPoint ? 1 : 0);
+    }
+
+    double stepStart(long long step) const
+    {
+        return (double)(step >> 1) * fPairLength + ((step & 1) ? fSwingPoint : 0.0);
+    }
+
+    // The step playing at pos goes at offset 0, then every step starting
+    // before nFrames. Returns how many edges were written.
+    int edges(double pos, int nFrames, StepEdge* pEdges, int maxEdges) const
+    {
+        if (!isRunning() || maxEdges < 1)
+            return 0;
+
+        long long step = stepAt(pos);
+        pEdges[0].mOffset = 0;
+        pEdges[0].mStep = step;
+        int n = 1;
+
+        while (n < maxEdges)
+        {
+            int offset = (int) ceil(stepStart(++step) - pos);
+            if (offset >= nFrames)
+                break;
+
+            pEdges[n].mOffset = offset > 0 ? offset : 0;
+            pEdges[n].mStep = step;
+            ++n;
+        }
+        return n;
+    }
+};
+
+#endif
@@ -0,0 +1,264 @@
+//
+//  HushAudit.cpp
+//
+//  Plays a host making a random (but legal) sequence of calls into Hush:
+//  reactivating with new sample rates, block sizes and channel layouts,
+//  processing short, full and oversized blocks in double and float, MIDI
+//  bursts, automation (and automation bursts bigger than a plugin's own
+//  queues), transport jumps and state reloads while running.  With IPlug
+//  built for auditing (make CONFIGURATION=Audit) it fails if anything on the
+//  audio thread allocated, and prints where.
+//
+//  hushaudit [-n calls] [-r seed]
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "heapbuf.h"
+#include "IPlug/IPlugOffline.h"
+
+#define AUDIT_MAX_BLOCK 4096
+#define AUDIT_MAX_CHANNELS 16
+#define AUDIT_MAX_MIDI 600      // More than IMidiQueue holds, so overflow is covered too.
+
+static const double kSampleRates[] = { 22050.0, 44100.0, 48000.0, 96000.0, 192000.0 };
+static const int kBlockSizes[] = { 1, 16, 64, 100, 256, 512, 1024, 4096 };
+static const int kChannelIO[][2] = { { 1, 1 }, { 2, 2 }, { 3, 1 }, { 4, 2 }, { 6, 6 }, { 8, 8 }, { 16, 16 } };
+
+#define AUDIT_COUNT(a) (int)(sizeof(a) / sizeof(a[0]))
+
+static unsigned int sSeed = 1;
+
+static unsigned int Random()
+{
+    sSeed = sSeed * 1664525 + 1013904223;
+    return sSeed >> 8;
+}
+
+static int RandomInt(int n)     // 0 to n - 1.
+{
+    return n > 0 ? (int)(Random() % (unsigned int)n) : 0;
+}
+
+static double RandomDouble()    // 0 to 1.
+{
+    return (double)Random() / (double)(1 << 24);
+}
+
+struct AuditHost
+{
+    IPlugOffline* mPlug;
+    int mBlockSize, mNIn, mNOut;
+    bool mActive;
+
+    WDL_TypedBuf<double> mAudio;
+    WDL_TypedBuf<float> mFAudio;
+    WDL_TypedBuf<IMidiMsg> mMidi;
+    ByteChunk mState;
+    int mNCalls[8];
+};
+
+enum EAuditCall
+{
+    kCallActivate = 0,
+    kCallProcess,
+    kCallProcessFloat,
+    kCallMidi,
+    kCallParam,
+    kCallTransport,
+    kCallLoadState,
+    kNumAuditCalls
+};
+
+static const char* kCallNames[kNumAuditCalls] = { "activate", "process", "process float", "midi", "param", "transport", "load state" };
+
+// Noise with the odd loud burst, so sidechain triggers fire as well.
+static void FillAudio(AuditHost* pHost, int nFrames)
+{
+    double* pAudio = pHost->mAudio.Get();
+    float* pFAudio = pHost->mFAudio.Get();
+    double level = RandomInt(4) ? 0.01 : 0.8;
+    for (int i = 0; i < pHost->mNIn * nFrames; ++i)
+    {
+        pAudio[i] = (RandomDouble() - 0.5) * level;
+        pFAudio[i] = (float) pAudio[i];
+    }
+}
+
+static void Activate(AuditHost* pHost)
+{
+    const int* pIO = kChannelIO[RandomInt(AUDIT_COUNT(kChannelIO))];
+    pHost->mBlockSize = kBlockSizes[RandomInt(AUDIT_COUNT(kBlockSizes))];
+    pHost->mNIn = pIO[0];
+    pHost->mNOut = pIO[1];
+    pHost->mActive = pHost->mPlug->Activate(kSampleRates[RandomInt(AUDIT_COUNT(kSampleRates))],
+        pHost->mBlockSize, pHost->mNIn, pHost->mNOut);
+    pHost->mPlug->SetTempo(60.0 + RandomDouble() * 140.0);
+
+    // Something to reload later that differs from what's running.
+    int nParams = pHost->mPlug->NParams();
+    for (int i = 0; i < nParams; ++i)
+        pHost->mPlug->SetParameter(i, RandomDouble());
+    pHost->mState.Clear();
+    pHost->mPlug->SerializeState(&pHost->mState);
+}
+
+static void Process(AuditHost* pHost, bool singlePrecision)
+{
+    // Full blocks mostly, but hosts send short ones (and empty ones) too, and the
+    // odd one longer than they said they would.
+    int nFrames = RandomInt(3) ? pHost->mBlockSize : RandomInt(pHost->mBlockSize + 1);
+    if (!RandomInt(20))
+        nFrames = MIN(pHost->mBlockSize * (2 + RandomInt(3)) + RandomInt(pHost->mBlockSize), AUDIT_MAX_BLOCK);
+    FillAudio(pHost, nFrames);
+
+    if (singlePrecision)
+    {
+        float* inputs[AUDIT_MAX_CHANNELS], * outputs[AUDIT_MAX_CHANNELS];
+        for (int c = 0; c < AUDIT_MAX_CHANNELS; ++c)
+        {
+            inputs[c] = pHost->mFAudio.Get() + c * AUDIT_MAX_BLOCK;
+            outputs[c] = pHost->mFAudio.Get() + (AUDIT_MAX_CHANNELS + c) * AUDIT_MAX_BLOCK;
+        }
+        pHost->mPlug->Process(inputs, outputs, nFrames);
+    }
+    else
+    {
+        double* inputs[AUDIT_MAX_CHANNELS], * outputs[AUDIT_MAX_CHANNELS];
+        for (int c = 0; c < AUDIT_MAX_CHANNELS; ++c)
+        {
+            inputs[c] = pHost->mAudio.Get() + c * AUDIT_MAX_BLOCK;
+            outputs[c] = pHost->mAudio.Get() + (AUDIT_MAX_CHANNELS + c) * AUDIT_MAX_BLOCK;
+        }
+        pHost->mPlug->Process(inputs, outputs, nFrames);
+    }
+}
+
+static void SendMidi(AuditHost* pHost)
+{
+    int n = RandomInt(8) ? RandomInt(32) : AUDIT_MAX_MIDI;
+    IMidiMsg* pMsgs = pHost->mMidi.Get();
+    for (int i = 0; i < n; ++i)
+    {
+        int offset = RandomInt(pHost->mBlockSize);
+        int note = RandomInt(128);
+        switch (RandomInt(4))
+        {
+            case 0: pMsgs[i].MakeNoteOffMsg(note, offset); break;
+            case 1: pMsgs[i] = IMidiMsg(offset, 0xB0, RandomInt(128), RandomInt(128)); break;
+            default: pMsgs[i].MakeNoteOnMsg(note, 1 + RandomInt(127), offset); break;
+        }
+    }
+
+    if (RandomInt(2))
+    {
+        pHost->mPlug->SendMidi(pMsgs, n);
+    }
+    else
+    {
+        for (int i = 0; i < n; ++i)
+            pHost->mPlug->SendMidi(pMsgs + i);
+    }
+}
+
+static void Usage()
+{
+    fprintf(stderr,
+        "usage: hushaudit [options]\n"
+        "\n"
+        "  -n calls      host calls to make (default 200000)\n"
+        "  -r seed       random seed (default 1)\n");
+}
+
+int main(int argc, char** argv)
+{
+    int nCalls = 200000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': nCalls = atoi(optarg); break;
+            case 'r': sSeed = (unsigned int) strtoul(optarg, 0, 10); break;
+            default: Usage(); return 1;
+        }
+    }
+    if (nCalls < 1)
+    {
+        Usage();
+        return 1;
+    }
+    unsigned int seed = sSeed;
+
+    if (!IAllocAuditAvailable())
+        fprintf(stderr, "IPlug wasn't built with IPLUG_AUDIT_ALLOC, allocations can't be seen (make CONFIGURATION=Audit)\n");
+
+    AuditHost host;
+    memset(host.mNCalls, 0, sizeof(host.mNCalls));
+    host.mPlug = MakePlug();
+    host.mAudio.Resize(AUDIT_MAX_BLOCK * AUDIT_MAX_CHANNELS * 2);
+    host.mFAudio.Resize(AUDIT_MAX_BLOCK * AUDIT_MAX_CHANNELS * 2);
+    host.mMidi.Resize(AUDIT_MAX_MIDI);
+    memset(host.mAudio.Get(), 0, host.mAudio.GetSize() * sizeof(double));
+    memset(host.mFAudio.Get(), 0, host.mFAudio.GetSize() * sizeof(float));
+    int nParams = host.mPlug->NParams();
+
+    IAllocAuditClear();
+    Activate(&host);
+
+    for (int i = 0; i < nCalls; ++i)
+    {
+        // Weighted towards processing, like a real host.
+        int r = RandomInt(100);
+        int call = r < 1 ? kCallActivate : r < 2 ? kCallLoadState : r < 5 ? kCallTransport :
+            r < 15 ? kCallParam : r < 30 ? kCallMidi : r < 45 ? kCallProcessFloat : kCallProcess;
+        if (!host.mActive)
+            call = kCallActivate;
+
+        switch (call)
+        {
+            case kCallActivate:
+                Activate(&host);
+                break;
+            case kCallProcess:
+                Process(&host, false);
+                break;
+            case kCallProcessFloat:
+                Process(&host, true);
+                break;
+            case kCallMidi:
+                SendMidi(&host);
+                break;
+            case kCallParam:
+            {
+                // Now and then a burst, dense automation over every parameter in one block.
+                int n = RandomInt(20) ? 1 + RandomInt(4) : 257 + RandomInt(PARAM_CHANGE_QUEUE_SIZE);
+                for (; n > 0; --n)
+                    host.mPlug->SetParameter(RandomInt(nParams), RandomDouble(), RandomInt(host.mBlockSize));
+                break;
+            }
+            case kCallTransport:
+                host.mPlug->SetTempo(20.0 + RandomDouble() * 280.0, 1 + RandomInt(12), 4 << RandomInt(2));
+                host.mPlug->SetSamplePos(RandomInt(1 << 24));
+                break;
+            case kCallLoadState:
+                // Takes effect on the audio thread, in the next Process.
+                host.mPlug->UnserializeState(&host.mState, 0);
+                break;
+        }
+        ++host.mNCalls[call];
+    }
+    host.mPlug->Deactivate();
+
+    printf("seed %u:", seed);
+    for (int c = 0; c < kNumAuditCalls; ++c)
+        printf(" %d %s%s", host.mNCalls[c], kCallNames[c], c + 1 < kNumAuditCalls ? "," : "\n");
+
+    int nAllocs = IAllocAuditReport(stdout);
+    delete host.mPlug;
+    return nAllocs ? 1 : 0;
+}
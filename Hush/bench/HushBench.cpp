@@ -0,0 +1,351 @@
+//
+//  HushBench.cpp
+//
+//  Times Hush's ProcessDoubleReplacing, with IPlugOffline standing in for the
+//  host, over a sweep of block sizes, channel counts, gate types and MIDI
+//  densities.  Prints a table and optionally writes JSON for tracking
+//  regressions between builds.
+//
+//  hushbench [options]
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#if defined __i386__ || defined __x86_64__
+  #include <x86intrin.h>
+  #define BENCH_HAS_TSC 1
+#endif
+
+#include "heapbuf.h"
+#include "IPlug/IPlugOffline.h"
+
+#define BENCH_SAMPLE_RATE 44100.0
+#define BENCH_MIN_BATCH 4096    // Frames timed together, so small blocks aren't all timer overhead.
+#define BENCH_MIDI_KEY 60
+#define MAX_BENCH_LIST 16
+
+static double GetSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static unsigned long long GetCycles()
+{
+#ifdef BENCH_HAS_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+struct BenchList
+{
+    int mValues[MAX_BENCH_LIST];
+    int mN;
+};
+
+struct BenchCase
+{
+    int mBlockSize;
+    int mNChannels;
+    int mGateType;       // Value of the Type param.
+    int mMidiSpacing;    // A note (on, then off halfway) every this many frames, 0 for no MIDI.
+};
+
+struct BenchResult
+{
+    double mMeanNs, mP99Ns;    // Per sample frame.
+    double mCycles;            // TSC cycles per sample frame, < 0 if there's no TSC.
+};
+
+static int CompareDoubles(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : (x > y);
+}
+
+static int FindParam(IPlugOffline* pPlug, const char* name)
+{
+    for (int i = 0; i < pPlug->NParams(); ++i)
+    {
+        if (!strcmp(pPlug->GetParam(i)->GetNameForHost(), name))
+            return i;
+    }
+    return -1;
+}
+
+// Sends the note ons and offs that land in [pos, pos + nFrames).
+static void SendBenchMidi(IPlugOffline* pPlug, int spacing, long long pos, int nFrames)
+{
+    if (!spacing)
+        return;
+
+    int half = spacing / 2;
+    long long end = pos + nFrames;
+    long long note = pos / spacing;
+    for (long long t = note * spacing; t < end; t += spacing)
+    {
+        if (t >= pos)
+        {
+            IMidiMsg msg;
+            msg.MakeNoteOnMsg(BENCH_MIDI_KEY, 100, (int)(t - pos));
+            pPlug->SendMidi(&msg);
+        }
+        if (half && t + half >= pos && t + half < end)
+        {
+            IMidiMsg msg;
+            msg.MakeNoteOffMsg(BENCH_MIDI_KEY, (int)(t + half - pos));
+            pPlug->SendMidi(&msg);
+        }
+    }
+}
+
+static bool RunCase(IPlugOffline* pPlug, int typeIdx, const BenchCase* pCase, double seconds, BenchResult* pResult)
+{
+    int blockSize = pCase->mBlockSize, nChannels = pCase->mNChannels;
+
+    pPlug->SetParameter(typeIdx, pPlug->GetParam(typeIdx)->GetNormalized(pCase->mGateType));
+    if (!pPlug->Activate(BENCH_SAMPLE_RATE, blockSize, nChannels, nChannels))
+        return false;
+
+    // Low level noise, the same every block.
+    WDL_TypedBuf<double> audio;
+    audio.Resize(blockSize * nChannels * 2);
+    double* pAudio = audio.Get();
+    unsigned int seed = 1;
+    for (int i = 0; i < blockSize * nChannels; ++i)
+    {
+        seed = seed * 1664525 + 1013904223;
+        pAudio[i] = ((double)(seed >> 8) / (double)(1 << 24) - 0.5) * 0.1;
+    }
+
+    WDL_TypedBuf<double*> ptrs;
+    ptrs.Resize(nChannels * 2);
+    double** inputs = ptrs.Get();
+    double** outputs = inputs + nChannels;
+    for (int c = 0; c < nChannels; ++c)
+    {
+        inputs[c] = pAudio + c * blockSize;
+        outputs[c] = pAudio + (nChannels + c) * blockSize;
+    }
+
+    int blocksPerBatch = MAX(1, BENCH_MIN_BATCH / blockSize);
+    int batchFrames = blocksPerBatch * blockSize;
+    int nBatches = MAX(1, (int)(seconds * BENCH_SAMPLE_RATE / batchFrames));
+
+    WDL_TypedBuf<double> batchNs;
+    batchNs.Resize(nBatches);
+
+    long long pos = 0;
+    for (int b = 0; b < blocksPerBatch; ++b, pos += blockSize)    // Warm up.
+    {
+        SendBenchMidi(pPlug, pCase->mMidiSpacing, pos, blockSize);
+        pPlug->Process(inputs, outputs, blockSize);
+    }
+
+    double totalSecs = 0.0;
+    unsigned long long totalCycles = 0;
+    for (int i = 0; i < nBatches; ++i)
+    {
+        double t0 = GetSeconds();
+        unsigned long long c0 = GetCycles();
+        for (int b = 0; b < blocksPerBatch; ++b, pos += blockSize)
+        {
+            SendBenchMidi(pPlug, pCase->mMidiSpacing, pos, blockSize);
+            pPlug->Process(inputs, outputs, blockSize);
+        }
+        totalCycles += GetCycles() - c0;
+        double secs = GetSeconds() - t0;
+        totalSecs += secs;
+        batchNs.Get()[i] = secs * 1e9 / batchFrames;
+    }
+
+    pPlug->Deactivate();
+
+    qsort(batchNs.Get(), nBatches, sizeof(double), CompareDoubles);
+    double frames = (double)nBatches * batchFrames;
+    pResult->mMeanNs = totalSecs * 1e9 / frames;
+    pResult->mP99Ns = batchNs.Get()[MIN(nBatches - 1, (int)(0.99 * nBatches))];
+#ifdef BENCH_HAS_TSC
+    pResult->mCycles = (double)totalCycles / frames;
+#else
+    pResult->mCycles = -1.0;
+#endif
+    return true;
+}
+
+////////////////////////////////////////
+
+static void Usage()
+{
+    fprintf(stderr,
+        "usage: hushbench [options]\n"
+        "\n"
+        "  -b sizes      block sizes (default 16,32,64,128,256,512,1024,2048,4096)\n"
+        "  -c channels   channel counts (default 1,2,6,8,16)\n"
+        "  -g types      gate types (default up,toggle,down)\n"
+        "  -m spacings   frames between notes, 0 for no MIDI (default 0,4096,512,64,8)\n"
+        "  -s seconds    audio timed per case (default 2)\n"
+        "  -o file       write JSON results to file (- for stdout)\n"
+        "  -q            don't print the table\n");
+}
+
+// Comma separated numbers, or display texts of pParam.
+static bool ParseList(const char* str, BenchList* pList, IParam* pParam = 0)
+{
+    pList->mN = 0;
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", str);
+    for (char* pTok = strtok(buf, ","); pTok; pTok = strtok(0, ","))
+    {
+        if (pList->mN >= MAX_BENCH_LIST)
+            return false;
+
+        int v;
+        if (pParam)
+        {
+            if (!pParam->MapDisplayText(pTok, &v))
+                return false;
+        }
+        else
+        {
+            char* pEnd;
+            v = (int)strtol(pTok, &pEnd, 10);
+            if (pEnd == pTok || *pEnd || v < 0)
+                return false;
+        }
+        pList->mValues[pList->mN++] = v;
+    }
+    return pList->mN > 0;
+}
+
+static void WriteJSON(FILE* fp, IPlugOffline* pPlug, IParam* pType, const BenchCase* pCases, const BenchResult* pResults, int nCases)
+{
+    fprintf(fp, "{\n  \"plugin\": \"%s\",\n  \"sampleRate\": %.0f,\n  \"precision\": \"double\",\n  \"results\": [\n",
+        pPlug->GetEffectName(), BENCH_SAMPLE_RATE);
+    for (int i = 0; i < nCases; ++i)
+    {
+        const BenchCase* pCase = pCases + i;
+        const BenchResult* pResult = pResults + i;
+        fprintf(fp, "    {\"blockSize\": %d, \"channels\": %d, \"gateType\": \"%s\", \"midiSpacing\": %d, "
+            "\"meanNsPerSample\": %.3f, \"p99NsPerSample\": %.3f, ",
+            pCase->mBlockSize, pCase->mNChannels, pType->GetDisplayText(pCase->mGateType), pCase->mMidiSpacing,
+            pResult->mMeanNs, pResult->mP99Ns);
+        if (pResult->mCycles < 0.0)
+            fprintf(fp, "\"cyclesPerSample\": null}");
+        else
+            fprintf(fp, "\"cyclesPerSample\": %.2f}", pResult->mCycles);
+        fprintf(fp, "%s\n", i + 1 < nCases ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+}
+
+int main(int argc, char** argv)
+{
+    BenchList blockSizes = { { 16, 32, 64, 128, 256, 512, 1024, 2048, 4096 }, 9 };
+    BenchList channels = { { 1, 2, 6, 8, 16 }, 5 };
+    BenchList gateTypes = { { 0 }, 0 };
+    BenchList spacings = { { 0, 4096, 512, 64, 8 }, 5 };
+    double seconds = 2.0;
+    const char* jsonFn = 0;
+    bool printTable = true;
+
+    IPlugOffline* pPlug = MakePlug();
+    int typeIdx = FindParam(pPlug, "Type");
+    if (typeIdx < 0)
+    {
+        fprintf(stderr, "%s has no Type parameter\n", pPlug->GetEffectName());
+        return 1;
+    }
+    IParam* pType = pPlug->GetParam(typeIdx);
+    for (int i = 0; i < pType->GetNDisplayTexts() && i < MAX_BENCH_LIST; ++i)
+        gateTypes.mValues[gateTypes.mN++] = i;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:c:g:m:s:o:qh")) != -1)
+    {
+        bool ok = true;
+        switch (opt)
+        {
+            case 'b': ok = ParseList(optarg, &blockSizes); break;
+            case 'c': ok = ParseList(optarg, &channels); break;
+            case 'g': ok = ParseList(optarg, &gateTypes, pType); break;
+            case 'm': ok = ParseList(optarg, &spacings); break;
+            case 's': seconds = atof(optarg); ok = seconds > 0.0; break;
+            case 'o': jsonFn = optarg; break;
+            case 'q': printTable = false; break;
+            default: ok = false; break;
+        }
+        if (!ok)
+        {
+            Usage();
+            return 1;
+        }
+    }
+    for (int i = 0; i < blockSizes.mN; ++i)
+    {
+        if (blockSizes.mValues[i] < 1)
+        {
+            Usage();
+            return 1;
+        }
+    }
+
+    int nCases = blockSizes.mN * channels.mN * gateTypes.mN * spacings.mN;
+    WDL_TypedBuf<BenchCase> cases;
+    WDL_TypedBuf<BenchResult> results;
+    cases.Resize(nCases);
+    results.Resize(nCases);
+
+    FILE* table = (jsonFn && !strcmp(jsonFn, "-")) ? stderr : stdout;
+    if (printTable)
+        fprintf(table, "%6s %4s %-8s %6s %12s %12s %12s\n", "block", "ch", "gate", "midi", "mean ns/smp", "p99 ns/smp", "cycles/smp");
+
+    int n = 0;
+    for (int b = 0; b < blockSizes.mN; ++b)
+    for (int c = 0; c < channels.mN; ++c)
+    for (int g = 0; g < gateTypes.mN; ++g)
+    for (int m = 0; m < spacings.mN; ++m)
+    {
+        BenchCase* pCase = cases.Get() + n;
+        pCase->mBlockSize = blockSizes.mValues[b];
+        pCase->mNChannels = channels.mValues[c];
+        pCase->mGateType = gateTypes.mValues[g];
+        pCase->mMidiSpacing = spacings.mValues[m];
+
+        BenchResult* pResult = results.Get() + n;
+        if (!RunCase(pPlug, typeIdx, pCase, seconds, pResult))
+        {
+            fprintf(stderr, "%d channels not supported, skipped\n", pCase->mNChannels);
+            continue;
+        }
+        if (printTable)
+        {
+            fprintf(table, "%6d %4d %-8s %6d %12.3f %12.3f %12.2f\n", pCase->mBlockSize, pCase->mNChannels,
+                pType->GetDisplayText(pCase->mGateType), pCase->mMidiSpacing, pResult->mMeanNs, pResult->mP99Ns, pResult->mCycles);
+            fflush(table);
+        }
+        ++n;
+    }
+
+    if (jsonFn)
+    {
+        FILE* fp = strcmp(jsonFn, "-") ? fopen(jsonFn, "w") : stdout;
+        if (!fp)
+        {
+            fprintf(stderr, "can't write %s\n", jsonFn);
+            return 1;
+        }
+        WriteJSON(fp, pPlug, pType, cases.Get(), results.Get(), n);
+        if (fp != stdout)
+            fclose(fp);
+    }
+
+    delete pPlug;
+    return 0;
+}
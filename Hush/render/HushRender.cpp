@@ -0,0 +1,828 @@
+//
+//  HushRender.cpp
+//
+//  Runs Hush over WAV files without a DAW.  Each input is gated by the notes
+//  in a Standard MIDI File with the same name (song.wav + song.mid), exactly
+//  as if a host had played them into the plugin.
+//
+//  hushrender [options] in.wav out.wav
+//  hushrender [options] jobdir outdir     (every .wav in jobdir, in parallel)
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "fileread.h"
+#include "wavwrite.h"
+#include "dirscan.h"
+#include "wdlstring.h"
+#include "mutex.h"
+#include "IPlug/IPlugOffline.h"
+
+#define DEFAULT_RENDER_BLOCK 4096
+#define MAX_RENDER_PARAMS 128
+
+static double GetSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int GetLE(const unsigned char* p, int nBytes)
+{
+    int v = 0;
+    for (int i = nBytes - 1; i >= 0; --i)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static int GetBE(const unsigned char* p, int nBytes)
+{
+    int v = 0;
+    for (int i = 0; i < nBytes; ++i)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static bool IsDirectory(const char* path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Swaps the extension of fn (or appends one).
+static void SetExtension(WDL_String* pStr, const char* fn, const char* ext)
+{
+    pStr->Set(fn);
+    char* pDot = strrchr(pStr->Get(), '.');
+    char* pSlash = strrchr(pStr->Get(), '/');
+    if (pDot && (!pSlash || pDot > pSlash))
+        pStr->SetLen((int)(pDot - pStr->Get()));
+    pStr->Append(ext);
+}
+
+////////////////////////////////////////
+// WAV input
+
+enum EWaveFormat
+{
+    kWavePCM = 1,
+    kWaveFloat = 3,
+    kWaveExtensible = 0xFFFE
+};
+
+// Reads PCM (8/16/24/32 bit) and float (32/64 bit) WAV files, deinterleaved into doubles.
+class WavReader
+{
+public:
+    WavReader(const char* fn)
+    :   m_file(fn, 2, 65536, 4), m_nChannels(0), m_nSampleRate(0), m_nBits(0), m_nFormat(0), m_nFrames(0), m_nFramesLeft(0)
+    {
+    }
+
+    bool Open()
+    {
+        unsigned char hdr[12];
+        if (!m_file.IsOpen() || m_file.Read(hdr, 12) != 12 || memcmp(hdr, "RIFF", 4) || memcmp(hdr + 8, "WAVE", 4))
+            return false;
+
+        bool gotFormat = false;
+        for (;;)
+        {
+            unsigned char chunk[8];
+            if (m_file.Read(chunk, 8) != 8)
+                return false;
+
+            int size = GetLE(chunk + 4, 4);
+            WDL_FILEREAD_POSTYPE next = m_file.GetPosition() + (WDL_FILEREAD_POSTYPE)(unsigned int)size + (size & 1);
+
+            if (!memcmp(chunk, "fmt ", 4))
+            {
+                unsigned char fmt[40];
+                int n = size < 40 ? size : 40;
+                if (n < 16 || m_file.Read(fmt, n) != n)
+                    return false;
+
+                m_nFormat = GetLE(fmt, 2);
+                m_nChannels = GetLE(fmt + 2, 2);
+                m_nSampleRate = GetLE(fmt + 4, 4);
+                m_nBits = GetLE(fmt + 14, 2);
+                if (m_nFormat == kWaveExtensible && n >= 26)
+                    m_nFormat = GetLE(fmt + 24, 2);
+
+                gotFormat = true;
+            }
+            else if (!memcmp(chunk, "data", 4))
+            {
+                if (!gotFormat || !IsSupported())
+                    return false;
+
+                // Streams that never patched the header up have a 0 (or bogus) size.
+                WDL_FILEREAD_POSTYPE avail = m_file.GetSize() - m_file.GetPosition();
+                WDL_FILEREAD_POSTYPE bytes = (WDL_FILEREAD_POSTYPE)(unsigned int)size;
+                if (!bytes || bytes > avail)
+                    bytes = avail;
+
+                m_nFrames = (int)(bytes / FrameBytes());
+                m_nFramesLeft = m_nFrames;
+                return true;
+            }
+
+            if (m_file.SetPosition(next))
+                return false;
+        }
+    }
+
+    int NChannels() const { return m_nChannels; }
+    int SampleRate() const { return m_nSampleRate; }
+    int Bits() const { return m_nBits; }
+    int NFrames() const { return m_nFrames; }
+
+    // Returns the number of frames read.
+    int Read(double** ppOut, int nFrames)
+    {
+        if (nFrames > m_nFramesLeft)
+            nFrames = m_nFramesLeft;
+
+        int frameBytes = FrameBytes();
+        m_raw.Resize(nFrames * frameBytes);
+        unsigned char* pRaw = m_raw.Get();
+        nFrames = m_file.Read(pRaw, nFrames * frameBytes) / frameBytes;
+        m_nFramesLeft -= nFrames;
+
+        int sampleBytes = m_nBits / 8;
+        for (int c = 0; c < m_nChannels; ++c)
+        {
+            unsigned char* pSrc = pRaw + c * sampleBytes;
+            double* pDest = ppOut[c];
+
+            if (m_nFormat == kWaveFloat && m_nBits == 32)
+            {
+                for (int s = 0; s < nFrames; ++s, pSrc += frameBytes)
+                {
+                    float f;
+                    memcpy(&f, pSrc, 4);
+                    pDest[s] = f;
+                }
+            }
+            else if (m_nFormat == kWaveFloat)
+            {
+                for (int s = 0; s < nFrames; ++s, pSrc += frameBytes)
+                    memcpy(pDest + s, pSrc, 8);
+            }
+            else if (m_nBits == 8)
+            {
+                for (int s = 0; s < nFrames; ++s, pSrc += frameBytes)
+                    pDest[s] = ((int)*pSrc - 128) / 128.0;
+            }
+            else
+            {
+                pcmToDoubles(pSrc, nFrames, m_nBits, m_nChannels, pDest, 1);
+            }
+        }
+        return nFrames;
+    }
+
+private:
+    bool IsSupported() const
+    {
+        if (m_nChannels < 1 || m_nSampleRate < 1)
+            return false;
+        if (m_nFormat == kWavePCM)
+            return m_nBits == 8 || m_nBits == 16 || m_nBits == 24 || m_nBits == 32;
+        if (m_nFormat == kWaveFloat)
+            return m_nBits == 32 || m_nBits == 64;
+        return false;
+    }
+
+    int FrameBytes() const { return m_nChannels * (m_nBits / 8); }
+
+    WDL_FileRead m_file;
+    WDL_TypedBuf<unsigned char> m_raw;
+    int m_nChannels, m_nSampleRate, m_nBits, m_nFormat;
+    int m_nFrames, m_nFramesLeft;
+};
+
+////////////////////////////////////////
+// Standard MIDI File input
+
+struct TimedMidiMsg
+{
+    int mPos;         // Sample position from the start of the file.
+    int mTick;
+    int mOrder;       // Keeps events at the same tick in file order.
+    int mTempo;       // Microseconds per quarter note for tempo events, else -1.
+    unsigned char mStatus, mData1, mData2;
+};
+
+static int CompareTimedMidiMsgs(const void* a, const void* b)
+{
+    const TimedMidiMsg* pA = (const TimedMidiMsg*)a;
+    const TimedMidiMsg* pB = (const TimedMidiMsg*)b;
+    if (pA->mTick != pB->mTick)
+        return pA->mTick < pB->mTick ? -1 : 1;
+    return pA->mOrder < pB->mOrder ? -1 : (pA->mOrder > pB->mOrder);
+}
+
+static bool ReadVarLen(const unsigned char** ppData, const unsigned char* pEnd, int* pValue)
+{
+    int v = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        if (*ppData >= pEnd)
+            return false;
+        unsigned char b = *(*ppData)++;
+        v = (v << 7) | (b & 0x7F);
+        if (!(b & 0x80))
+        {
+            *pValue = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Reads the channel messages of every track (format 0 or 1), merged and timed
+// by the file's tempo map.  Returns false if the file can't be read.
+static bool ReadMidiFile(const char* fn, double sampleRate, WDL_TypedBuf<TimedMidiMsg>* pMsgs)
+{
+    pMsgs->Resize(0);
+
+    WDL_FileRead file(fn, 0);
+    if (!file.IsOpen())
+        return false;
+
+    WDL_TypedBuf<unsigned char> buf;
+    buf.Resize((int)file.GetSize());
+    if (file.Read(buf.Get(), buf.GetSize()) != buf.GetSize() || buf.GetSize() < 14)
+        return false;
+
+    const unsigned char* pData = buf.Get();
+    const unsigned char* pFileEnd = pData + buf.GetSize();
+    if (memcmp(pData, "MThd", 4))
+        return false;
+
+    int hdrLen = GetBE(pData + 4, 4);
+    int nTracks = GetBE(pData + 10, 2);
+    int division = GetBE(pData + 12, 2);
+    pData += 8 + hdrLen;
+
+    // Tick lengths for SMPTE time are fixed, otherwise they follow the tempo.
+    double smpteTickSecs = 0.0;
+    if (division & 0x8000)
+    {
+        int fps = -(signed char)(division >> 8);
+        double rate = (fps == 29) ? 29.97 : (double)fps;
+        smpteTickSecs = 1.0 / (rate * (division & 0xFF));
+    }
+    else if (!division)
+    {
+        return false;
+    }
+
+    int order = 0;
+    for (int t = 0; t < nTracks && pData + 8 <= pFileEnd; ++t)
+    {
+        int trackLen = GetBE(pData + 4, 4);
+        bool isTrack = !memcmp(pData, "MTrk", 4);
+        pData += 8;
+        const unsigned char* pEnd = (trackLen > pFileEnd - pData) ? pFileEnd : pData + trackLen;
+        const unsigned char* pNext = pEnd;
+        if (!isTrack)
+        {
+            pData = pNext;
+            continue;
+        }
+
+        int tick = 0;
+        unsigned char runningStatus = 0;
+        while (pData < pEnd)
+        {
+            int delta;
+            if (!ReadVarLen(&pData, pEnd, &delta) || pData >= pEnd)
+                break;
+            tick += delta;
+
+            unsigned char status = *pData;
+            if (status & 0x80)
+                ++pData;
+            else if (runningStatus)
+                status = runningStatus;
+            else
+                break;
+
+            if (status == 0xFF)
+            {
+                if (pData >= pEnd)
+                    break;
+                unsigned char type = *pData++;
+                int len;
+                if (!ReadVarLen(&pData, pEnd, &len) || len > pEnd - pData)
+                    break;
+                if (type == 0x51 && len == 3)
+                {
+                    TimedMidiMsg msg = { 0, tick, order++, GetBE(pData, 3), 0, 0, 0 };
+                    pMsgs->Add(msg);
+                }
+                pData += len;
+                if (type == 0x2F)
+                    break;
+            }
+            else if (status == 0xF0 || status == 0xF7)
+            {
+                int len;
+                if (!ReadVarLen(&pData, pEnd, &len) || len > pEnd - pData)
+                    break;
+                pData += len;
+            }
+            else if (status < 0xF0)
+            {
+                runningStatus = status;
+                int nData = ((status & 0xF0) == 0xC0 || (status & 0xF0) == 0xD0) ? 1 : 2;
+                if (nData > pEnd - pData)
+                    break;
+                TimedMidiMsg msg = { 0, tick, order++, -1, status, pData[0], (unsigned char)(nData > 1 ? pData[1] : 0) };
+                pMsgs->Add(msg);
+                pData += nData;
+            }
+            else
+            {
+                break;   // System common messages don't belong in a file.
+            }
+        }
+        pData = pNext;
+    }
+
+    TimedMidiMsg* pMsg = pMsgs->Get();
+    int n = pMsgs->GetSize();
+    qsort(pMsg, n, sizeof(TimedMidiMsg), CompareTimedMidiMsgs);
+
+    // Walk the tempo map, then drop the tempo events.
+    double secs = 0.0, usPerQN = 500000.0;
+    int lastTick = 0, nOut = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        int ticks = pMsg[i].mTick - lastTick;
+        secs += smpteTickSecs ? ticks * smpteTickSecs : ticks * usPerQN / (1000000.0 * division);
+        lastTick = pMsg[i].mTick;
+
+        if (pMsg[i].mTempo >= 0)
+        {
+            if (pMsg[i].mTempo > 0)
+                usPerQN = pMsg[i].mTempo;
+            continue;
+        }
+        pMsg[nOut] = pMsg[i];
+        pMsg[nOut].mPos = (int)(secs * sampleRate + 0.5);
+        ++nOut;
+    }
+    pMsgs->Resize(nOut);
+    return true;
+}
+
+////////////////////////////////////////
+// Jobs
+
+struct RenderJob
+{
+    WDL_String mIn, mMidi, mOut;
+    bool mOK;
+    int mFrames, mSampleRate;
+    double mDSPSecs, mTotalSecs;
+    char mError[128];
+};
+
+struct RenderParam
+{
+    int mIdx;
+    double mValue;   // Normalized.
+};
+
+struct RenderContext
+{
+    WDL_PtrList<RenderJob> mJobs;
+    RenderParam mParams[MAX_RENDER_PARAMS];
+    int mNParams;
+    int mBlockSize;
+    int mOutBits;
+    double mTempo;
+    bool mVerbose;
+
+    WDL_Mutex mMutex;
+    int mNextJob;
+
+    // Returns the next job to run, or 0 when they're all taken.
+    RenderJob* NextJob()
+    {
+        WDL_MutexLock lock(&mMutex);
+        return mNextJob < mJobs.GetSize() ? mJobs.Get(mNextJob++) : 0;
+    }
+};
+
+static bool Fail(RenderJob* pJob, const char* error)
+{
+    pJob->mOK = false;
+    snprintf(pJob->mError, sizeof(pJob->mError), "%s", error);
+    return false;
+}
+
+static bool Render(IPlugOffline* pPlug, RenderContext* pCtx, RenderJob* pJob)
+{
+    double startTime = GetSeconds();
+
+    WavReader in(pJob->mIn.Get());
+    if (!in.Open())
+        return Fail(pJob, "can't read WAV (PCM 8/16/24/32 or float 32/64 only)");
+
+    int nChannels = in.NChannels();
+    if (nChannels > 2)
+        return Fail(pJob, "more than 2 channels, WaveWriter only writes mono/stereo");
+
+    WDL_TypedBuf<TimedMidiMsg> midi;
+    if (pJob->mMidi.GetLength() && !ReadMidiFile(pJob->mMidi.Get(), in.SampleRate(), &midi))
+        return Fail(pJob, "can't read MIDI file");
+
+    int blockSize = pCtx->mBlockSize;
+    if (!pPlug->Activate(in.SampleRate(), blockSize, nChannels, nChannels))
+        return Fail(pJob, "channel count not supported by the plugin");
+    pPlug->SetTempo(pCtx->mTempo);
+
+    int outBits = pCtx->mOutBits ? pCtx->mOutBits : (in.Bits() == 16 ? 16 : 24);
+    WaveWriter out(pJob->mOut.Get(), outBits, nChannels, in.SampleRate(), 0);
+    if (!out.Status())
+    {
+        pPlug->Deactivate();
+        return Fail(pJob, "can't write output");
+    }
+
+    WDL_TypedBuf<double> audio, interleaved;
+    audio.Resize(blockSize * nChannels * 2);
+    interleaved.Resize(blockSize * nChannels);
+    double* inputs[2], * outputs[2];
+    for (int c = 0; c < nChannels; ++c)
+    {
+        inputs[c] = audio.Get() + c * blockSize;
+        outputs[c] = audio.Get() + (nChannels + c) * blockSize;
+    }
+
+    const TimedMidiMsg* pMsg = midi.Get();
+    const TimedMidiMsg* pMsgEnd = pMsg + midi.GetSize();
+    // Each block's messages go in together, like a host's event list.
+    WDL_TypedBuf<IMidiMsg> blockMsgs;
+    blockMsgs.Resize(midi.GetSize());
+
+    // Compensate for the plugin's latency like a host would: drop that much
+    // from the start and run silence through to get the end back out.
+    int latency = pPlug->GetLatency();
+    int skip = latency, flush = latency;
+
+    double dspSecs = 0.0;
+    int pos = 0;
+    for (;;)
+    {
+        int n = in.Read(inputs, blockSize);
+        if (n <= 0)
+        {
+            n = flush < blockSize ? flush : blockSize;
+            if (n <= 0)
+                break;
+            for (int c = 0; c < nChannels; ++c)
+                memset(inputs[c], 0, n * sizeof(double));
+            flush -= n;
+        }
+
+        double t0 = GetSeconds();
+        int nMsgs = 0;
+        for (; pMsg < pMsgEnd && pMsg->mPos < pos + n; ++pMsg)
+        {
+            IMidiMsg* pOut = blockMsgs.Get() + nMsgs++;
+            *pOut = IMidiMsg(pMsg->mPos > pos ? pMsg->mPos - pos : 0, pMsg->mStatus, pMsg->mData1, pMsg->mData2);
+        }
+        if (nMsgs)
+            pPlug->SendMidi(blockMsgs.Get(), nMsgs);
+        pPlug->Process(inputs, outputs, n);
+        dspSecs += GetSeconds() - t0;
+
+        int first = skip < n ? skip : n;
+        skip -= first;
+
+        double* pOut = interleaved.Get();
+        for (int s = first; s < n; ++s)
+        {
+            for (int c = 0; c < nChannels; ++c)
+                *pOut++ = outputs[c][s];
+        }
+        out.WriteDoubles(interleaved.Get(), (n - first) * nChannels);
+        pos += n;
+    }
+
+    pPlug->Deactivate();
+
+    pJob->mOK = true;
+    pJob->mFrames = pos - latency;
+    pJob->mSampleRate = in.SampleRate();
+    pJob->mDSPSecs = dspSecs;
+    pJob->mTotalSecs = GetSeconds() - startTime;
+    return true;
+}
+
+static double RealtimeMultiple(double audioSecs, double secs)
+{
+    return secs > 0.0 ? audioSecs / secs : 0.0;
+}
+
+static void* RenderThreadProc(void* pArg)
+{
+    RenderContext* pCtx = (RenderContext*)pArg;
+
+    // One plugin instance per thread, reused for every job it picks up.
+    IPlugOffline* pPlug = MakePlug();
+    for (int i = 0; i < pCtx->mNParams; ++i)
+        pPlug->SetParameter(pCtx->mParams[i].mIdx, pCtx->mParams[i].mValue);
+
+    RenderJob* pJob;
+    while ((pJob = pCtx->NextJob()))
+    {
+        Render(pPlug, pCtx, pJob);
+
+        if (pCtx->mVerbose)
+        {
+            if (pJob->mOK)
+            {
+                double audioSecs = (double)pJob->mFrames / pJob->mSampleRate;
+                printf("%s: %.1f s, %.0fx realtime (%.0fx with I/O)\n", pJob->mOut.Get(), audioSecs,
+                    RealtimeMultiple(audioSecs, pJob->mDSPSecs), RealtimeMultiple(audioSecs, pJob->mTotalSecs));
+            }
+            else
+            {
+                fprintf(stderr, "%s: %s\n", pJob->mIn.Get(), pJob->mError);
+            }
+        }
+    }
+
+    delete pPlug;
+    return 0;
+}
+
+////////////////////////////////////////
+
+static void Usage()
+{
+    fprintf(stderr,
+        "usage: hushrender [options] in.wav out.wav\n"
+        "       hushrender [options] jobdir outdir\n"
+        "\n"
+        "Gates each WAV with the notes in the .mid file of the same name.\n"
+        "\n"
+        "  -m file.mid   trigger file for a single input (default: in.mid)\n"
+        "  -p name=val   set a parameter, by name and readable value (e.g. -p Type=down)\n"
+        "  -j threads    worker threads (default: one per core)\n"
+        "  -b frames     block size (default %d)\n"
+        "  -t bpm        transport tempo for the step sequencer (default 120)\n"
+        "  -d bits       output bit depth, 16 or 24 (default: 16 if the input is, else 24)\n"
+        "  -l            list the parameters and exit\n"
+        "  -P file       write the factory presets as a preset library and exit\n"
+        "  -q            only print the summary\n", DEFAULT_RENDER_BLOCK);
+}
+
+static void ListParams(IPlugOffline* pPlug)
+{
+    for (int i = 0; i < pPlug->NParams(); ++i)
+    {
+        IParam* pParam = pPlug->GetParam(i);
+        char display[128];
+        pParam->GetDisplayForHost(display);
+        printf("%-10s %s%s%s\n", pParam->GetNameForHost(), display, *pParam->GetLabelForHost() ? " " : "", pParam->GetLabelForHost());
+    }
+}
+
+// name=value, value as shown to the user: a number or one of the display texts (case matters).
+static bool ParseParam(IPlugOffline* pPlug, const char* str, RenderParam* pParam)
+{
+    const char* pEq = strchr(str, '=');
+    if (!pEq)
+        return false;
+
+    int nameLen = (int)(pEq - str);
+    for (int i = 0; i < pPlug->NParams(); ++i)
+    {
+        IParam* p = pPlug->GetParam(i);
+        const char* name = p->GetNameForHost();
+        if ((int)strlen(name) != nameLen || strncasecmp(name, str, nameLen))
+            continue;
+
+        char value[128];
+        snprintf(value, sizeof(value), "%s", pEq + 1);
+        int mapped;
+        double v;
+        if (p->MapDisplayText(value, &mapped))
+        {
+            v = mapped;
+        }
+        else
+        {
+            char* pEnd;
+            v = strtod(value, &pEnd);
+            if (pEnd == value || *pEnd)
+                return false;
+        }
+
+        pParam->mIdx = i;
+        pParam->mValue = p->GetNormalized(v);
+        return true;
+    }
+    return false;
+}
+
+static void AddJob(RenderContext* pCtx, const char* in, const char* midi, const char* out)
+{
+    RenderJob* pJob = new RenderJob;
+    memset(pJob->mError, 0, sizeof(pJob->mError));
+    pJob->mOK = false;
+    pJob->mFrames = pJob->mSampleRate = 0;
+    pJob->mDSPSecs = pJob->mTotalSecs = 0.0;
+    pJob->mIn.Set(in);
+    pJob->mOut.Set(out);
+
+    // No trigger file just means the gate never opens (or never closes).
+    if (midi)
+    {
+        pJob->mMidi.Set(midi);
+    }
+    else
+    {
+        SetExtension(&pJob->mMidi, in, ".mid");
+        if (access(pJob->mMidi.Get(), R_OK))
+            pJob->mMidi.Set("");
+    }
+    pCtx->mJobs.Add(pJob);
+}
+
+static void AddJobDir(RenderContext* pCtx, const char* jobDir, const char* outDir)
+{
+    WDL_DirScan dir;
+    if (dir.First(jobDir))
+        return;
+    do
+    {
+        const char* fn = dir.GetCurrentFN();
+        int len = (int)strlen(fn);
+        if (dir.GetCurrentIsDirectory() || len < 5 || strcasecmp(fn + len - 4, ".wav"))
+            continue;
+
+        WDL_String in, out;
+        dir.GetCurrentFullFN(&in);
+        out.Set(outDir);
+        out.Append("/");
+        out.Append(fn);
+        AddJob(pCtx, in.Get(), 0, out.Get());
+    }
+    while (!dir.Next());
+}
+
+int main(int argc, char** argv)
+{
+    RenderContext ctx;
+    ctx.mNParams = 0;
+    ctx.mBlockSize = DEFAULT_RENDER_BLOCK;
+    ctx.mOutBits = 0;
+    ctx.mTempo = 120.0;
+    ctx.mVerbose = true;
+    ctx.mNextJob = 0;
+
+    int nThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    const char* midiFn = 0;
+
+    // Only used to look up parameters, the workers make their own.
+    IPlugOffline* pProbe = MakePlug();
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:p:j:b:t:d:lP:qh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'm':
+                midiFn = optarg;
+                break;
+            case 'p':
+                if (ctx.mNParams >= MAX_RENDER_PARAMS || !ParseParam(pProbe, optarg, &ctx.mParams[ctx.mNParams]))
+                {
+                    fprintf(stderr, "bad parameter: %s (-l lists them)\n", optarg);
+                    return 1;
+                }
+                ++ctx.mNParams;
+                break;
+            case 'j':
+                nThreads = atoi(optarg);
+                break;
+            case 'b':
+                ctx.mBlockSize = atoi(optarg);
+                break;
+            case 't':
+                ctx.mTempo = atof(optarg);
+                break;
+            case 'd':
+                ctx.mOutBits = atoi(optarg);
+                break;
+            case 'l':
+                ListParams(pProbe);
+                return 0;
+            case 'P':
+            {
+                // From the presets made in code, not whatever library is there now.
+                IPresetLibrary::SetEnabled(false);
+                IPlugOffline* pPlug = MakePlug();
+                bool written = pPlug->DumpPresetLibrary(optarg);
+                delete pPlug;
+                if (!written)
+                {
+                    fprintf(stderr, "can't write %s\n", optarg);
+                    return 1;
+                }
+                return 0;
+            }
+            case 'q':
+                ctx.mVerbose = false;
+                break;
+            default:
+                Usage();
+                return 1;
+        }
+    }
+    delete pProbe;
+
+    if (argc - optind != 2 || ctx.mBlockSize < 1 || ctx.mTempo <= 0.0 || (ctx.mOutBits && ctx.mOutBits != 16 && ctx.mOutBits != 24))
+    {
+        Usage();
+        return 1;
+    }
+
+    const char* in = argv[optind];
+    const char* out = argv[optind + 1];
+    if (IsDirectory(in))
+    {
+        if (!IsDirectory(out) && mkdir(out, 0777))
+        {
+            fprintf(stderr, "can't create %s\n", out);
+            return 1;
+        }
+        AddJobDir(&ctx, in, out);
+    }
+    else
+    {
+        AddJob(&ctx, in, midiFn, out);
+    }
+
+    int nJobs = ctx.mJobs.GetSize();
+    if (!nJobs)
+    {
+        fprintf(stderr, "nothing to render in %s\n", in);
+        return 1;
+    }
+    if (nThreads < 1)
+        nThreads = 1;
+    if (nThreads > nJobs)
+        nThreads = nJobs;
+
+    double startTime = GetSeconds();
+
+    WDL_TypedBuf<pthread_t> threads;
+    threads.Resize(nThreads);
+    for (int i = 0; i < nThreads; ++i)
+        pthread_create(threads.Get() + i, 0, RenderThreadProc, &ctx);
+    for (int i = 0; i < nThreads; ++i)
+        pthread_join(threads.Get()[i], 0);
+
+    double wallSecs = GetSeconds() - startTime;
+
+    double audioSecs = 0.0, dspSecs = 0.0;
+    int nFailed = 0;
+    for (int i = 0; i < nJobs; ++i)
+    {
+        RenderJob* pJob = ctx.mJobs.Get(i);
+        if (pJob->mOK)
+        {
+            audioSecs += (double)pJob->mFrames / pJob->mSampleRate;
+            dspSecs += pJob->mDSPSecs;
+        }
+        else
+        {
+            ++nFailed;
+            if (!ctx.mVerbose)
+                fprintf(stderr, "%s: %s\n", pJob->mIn.Get(), pJob->mError);
+        }
+    }
+
+    printf("%d file(s), %d failed, %.1f s of audio in %.2f s on %d thread(s)\n", nJobs, nFailed, audioSecs, wallSecs, nThreads);
+    printf("throughput: %.0fx realtime overall, %.0fx realtime per thread in the plugin\n",
+        RealtimeMultiple(audioSecs, wallSecs), RealtimeMultiple(audioSecs, dspSecs));
+
+    ctx.mJobs.Empty(true);
+    return nFailed ? 1 : 0;
+}
@@ -49,7 +49,8 @@
 #define PLUG_UNIQUE_ID 'Hush'
 #define PLUG_MFR_ID 'ltPW'
 
-#define PLUG_CHANNEL_IO "1-1 2-2"
+// 3-1 and 4-2 are mono and stereo with a stereo sidechain (key) pair after the main inputs.
+#define PLUG_CHANNEL_IO "1-1 2-2 3-1 4-2 6-6 8-8 16-16"
 
 #define PLUG_LATENCY 0
 #define PLUG_IS_INST 0
@@ -77,3 +78,6 @@
 #define IMG_KNOB2_FN     "img/knob_type2_shadow_stack.png"
 #define IMG_HELPICON_FN  "img/help-icon.png"
 #define IMG_HELPDESC_FN  "img/help-desc.png"
+
+// Factory preset library, next to the plugin binary (hushrender -P writes one).
+#define PRESETS_FN       "Hush.presets"
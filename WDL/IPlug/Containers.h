@@ -59,210 +59,264 @@ template <class T> inline void SWAP(T& a, T& b)
 }
 
 typedef unsigned char BYTE;
-class ByteChunk
+
+// Read-only access to serialized data that lives somewhere else, like a
+// buffer the host passes in.  Nothing is copied, so the data has to outlive
+// the view.  ByteChunk is one of these too, so anything that only reads
+// (UnserializeState and friends) takes a ByteChunkView* and works on either.
+class ByteChunkView
 {
 public:
 
-	ByteChunk() {}
-	~ByteChunk() {}
-
-	inline int PutBytes(const void* pBuf, int size)
-	{
-		int n = mBytes.GetSize();
-		mBytes.Resize(n + size);
-		memcpy(mBytes.Get() + n, pBuf, size);
-		return mBytes.GetSize();
-	}
-
-	inline int GetBytes(void* pBuf, int size, int startPos)
-	{
-		int endPos = startPos + size;
-    if (startPos >= 0 && endPos <= mBytes.GetSize()) {
-		memcpy(pBuf, mBytes.Get() + startPos, size);
+  ByteChunkView() : mData(0), mSize(0) {}
+  ByteChunkView(const void* pData, int size) : mData((const BYTE*) pData), mSize(pData ? size : 0) {}
+
+  inline int GetBytes(void* pBuf, int size, int startPos) const
+  {
+    int endPos = startPos + size;
+    if (startPos >= 0 && endPos <= mSize) {
+      memcpy(pBuf, mData + startPos, size);
       return endPos;
     }
     return -1;
-	}
+  }
 
-	template <class T> inline int Put(const T* pVal) 
+  template <class T> inline int Get(T* pVal, int startPos) const
   {
-		return PutBytes(pVal, sizeof(T));
-	}
+    return GetBytes(pVal, sizeof(T), startPos);
+  }
+
+// Data is always stored in little endian format, see ByteChunk.
 
-	template <class T> inline int Get(T* pVal, int startPos) 
+#ifdef WDL_BIG_ENDIAN
+
+  inline int Get(unsigned short* pVal, int startPos) const
   {
-		return GetBytes(pVal, sizeof(T), startPos);
-	}
+    startPos = GetBytes(pVal, 2, startPos);
+    WDL_BSWAP16_IF_BE(*pVal);
+    return startPos;
+  }
 
-// Handle endian conversion for integer and floating point data types.
-// Data is always stored in the chunk in little endian format, so nothing needs
-//  changing on Intel x86 platforms.
+  inline int Get(unsigned int* pVal, int startPos) const
+  {
+    startPos = GetBytes(pVal, 4, startPos);
+    WDL_BSWAP32_IF_BE(*pVal);
+    return startPos;
+  }
 
-#ifdef WDL_BIG_ENDIAN
+  inline int Get(WDL_UINT64* pVal, int startPos) const
+  {
+    startPos = GetBytes(pVal, 8, startPos);
+    WDL_BSWAP64_IF_BE(*pVal);
+    return startPos;
+  }
 
-	inline int Put(const unsigned short* pVal)
-	{
-		unsigned short i = WDL_bswap16_if_be(*pVal);
-		return PutBytes(&i, 2);
-	}
-
-	inline int Get(unsigned short* pVal, int startPos)
-	{
-		startPos = GetBytes(pVal, 2, startPos);
-		WDL_BSWAP16_IF_BE(*pVal);
-		return startPos;
-	}
-
-	inline int Put(const unsigned int* pVal)
-	{
-		unsigned int i = WDL_bswap32_if_be(*pVal);
-		return PutBytes(&i, 4);
-	}
-
-	inline int Get(unsigned int* pVal, int startPos)
-	{
-		startPos = GetBytes(pVal, 4, startPos);
-		WDL_BSWAP32_IF_BE(*pVal);
-		return startPos;
-	}
-
-	inline int Put(const WDL_UINT64* pVal)
-	{
-		WDL_UINT64 i = WDL_bswap64_if_be(*pVal);
-		return PutBytes(&i, 8);
-	}
-
-	inline int Get(WDL_UINT64* pVal, int startPos)
-	{
-		startPos = GetBytes(pVal, 8, startPos);
-		WDL_BSWAP64_IF_BE(*pVal);
-		return startPos;
-	}
-
-	// Signed
-
-	inline int Put(const short*     pVal) { return Put((const unsigned short*) pVal); }
-	inline int Put(const int*       pVal) { return Put((const unsigned int*)   pVal); }
-	inline int Put(const WDL_INT64* pVal) { return Put((const WDL_UINT64*)     pVal); }
-
-	inline int Get(short*     pVal, int startPos) { return Get((unsigned short*) pVal, startPos); }
-	inline int Get(int*       pVal, int startPos) { return Get((unsigned int*)   pVal, startPos); }
-	inline int Get(WDL_INT64* pVal, int startPos) { return Get((WDL_UINT64*)     pVal, startPos); }
-
-	// Floats
-
-	inline int Put(const float* pVal)
-	{
-		unsigned int i = WDL_bswapf_if_be(*pVal);
-		return PutBytes(&i, 4);
-	}
-
-	inline int Get(float* pVal, int startPos)
-	{
-		unsigned int i;
-		startPos = GetBytes(&i, 4, startPos);
-		*pVal = WDL_bswapf_if_be(i);
-		return startPos;
-	}
-
-	inline int Put(const double* pVal)
-	{
-		WDL_UINT64 i = WDL_bswapf_if_be(*pVal);
-		return PutBytes(&i, 8);
-	}
-
-	inline int Get(double* pVal, int startPos)
-	{
-		WDL_UINT64 i;
-		startPos = GetBytes(&i, 8, startPos);
-		*pVal = WDL_bswapf_if_be(i);
-		return startPos;
-	}
+  inline int Get(short*     pVal, int startPos) const { return Get((unsigned short*) pVal, startPos); }
+  inline int Get(int*       pVal, int startPos) const { return Get((unsigned int*)   pVal, startPos); }
+  inline int Get(WDL_INT64* pVal, int startPos) const { return Get((WDL_UINT64*)     pVal, startPos); }
 
-#endif // WDL_BIG_ENDIAN
+  inline int Get(float* pVal, int startPos) const
+  {
+    unsigned int i;
+    startPos = GetBytes(&i, 4, startPos);
+    *pVal = WDL_bswapf_if_be(i);
+    return startPos;
+  }
 
-	inline int PutStr(const char* str) 
+  inline int Get(double* pVal, int startPos) const
   {
-    int slen = strlen(str);
-        #ifdef WDL_BIG_ENDIAN
-        { const unsigned int i = WDL_bswap32_if_be(slen); Put(&i); }
-        #else
-		Put(&slen);
-		#endif
-		return PutBytes(str, slen);
-	}
-
-	inline int GetStr(WDL_String* pStr, int startPos)
+    WDL_UINT64 i;
+    startPos = GetBytes(&i, 8, startPos);
+    *pVal = WDL_bswapf_if_be(i);
+    return startPos;
+  }
+
+#endif // WDL_BIG_ENDIAN
+
+  inline int GetStr(WDL_String* pStr, int startPos) const
   {
-		int len;
+    int len;
     int strStartPos = Get(&len, startPos);
     if (strStartPos >= 0) {
       WDL_BSWAP32_IF_BE(len);
       int strEndPos = strStartPos + len;
-      if (strEndPos <= mBytes.GetSize() && len > 0) {
-        pStr->Set((char*) (mBytes.Get() + strStartPos), len);
+      if (strEndPos <= mSize && len > 0) {
+        pStr->Set((const char*) (mData + strStartPos), len);
       }
       return strEndPos;
     }
     return -1;
-	}
-
-  inline int PutBool(bool b)
-  {
-    int n = mBytes.GetSize();
-    mBytes.Resize(n + 1);
-    *(mBytes.Get() + n) = (BYTE) (b ? 1 : 0);
-    return mBytes.GetSize();
   }
 
-  inline int GetBool(bool* pB, int startPos)
+  inline int GetBool(bool* pB, int startPos) const
   {
     int endPos = startPos + 1;
-    if (startPos >= 0 && endPos <= mBytes.GetSize()) {
-      BYTE byt = *(mBytes.Get() + startPos);
+    if (startPos >= 0 && endPos <= mSize) {
+      BYTE byt = *(mData + startPos);
       *pB = (byt);
       return endPos;
     }
     return -1;
   }
 
-  inline int PutChunk(ByteChunk* pRHS)
+  inline int Size() const
   {
-    return PutBytes(pRHS->GetBytes(), pRHS->Size());
+    return mSize;
   }
 
-  inline void Clear() 
+  inline const BYTE* GetBytes() const
   {
-    mBytes.Resize(0);
+    return mData;
   }
 
-  inline int Size() 
+  inline bool IsEqual(const ByteChunkView* pRHS) const
   {
-    return mBytes.GetSize();
+    return (pRHS && pRHS->Size() == Size() && !memcmp(pRHS->GetBytes(), GetBytes(), Size()));
+  }
+
+protected:
+
+  const BYTE* mData;
+  int mSize;
+};
+
+class ByteChunk : public ByteChunkView
+{
+public:
+
+  ByteChunk() {}
+  ~ByteChunk() {}
+
+  // Makes room for size bytes in all without changing what's there, so a
+  // caller that knows (or can estimate) how big the result will be doesn't
+  // grow the buffer again and again as it's written.
+  inline void Reserve(int size)
+  {
+    int n = mBytes.GetSize();
+    if (size > n) {
+      mBytes.Resize(size, false);
+      mBytes.Resize(n, false);
+      Sync();
+    }
+  }
+
+  inline int PutBytes(const void* pBuf, int size)
+  {
+    int n = mBytes.GetSize();
+    mBytes.Resize(n + size, false);
+    Sync();
+    memcpy(mBytes.Get() + n, pBuf, size);
+    return mSize;
+  }
+
+  template <class T> inline int Put(const T* pVal) 
+  {
+    return PutBytes(pVal, sizeof(T));
+  }
+
+// Handle endian conversion for integer and floating point data types.
+// Data is always stored in the chunk in little endian format, so nothing needs
+//  changing on Intel x86 platforms.
+
+#ifdef WDL_BIG_ENDIAN
+
+  inline int Put(const unsigned short* pVal)
+  {
+    unsigned short i = WDL_bswap16_if_be(*pVal);
+    return PutBytes(&i, 2);
+  }
+
+  inline int Put(const unsigned int* pVal)
+  {
+    unsigned int i = WDL_bswap32_if_be(*pVal);
+    return PutBytes(&i, 4);
+  }
+
+  inline int Put(const WDL_UINT64* pVal)
+  {
+    WDL_UINT64 i = WDL_bswap64_if_be(*pVal);
+    return PutBytes(&i, 8);
+  }
+
+  // Signed
+
+  inline int Put(const short*     pVal) { return Put((const unsigned short*) pVal); }
+  inline int Put(const int*       pVal) { return Put((const unsigned int*)   pVal); }
+  inline int Put(const WDL_INT64* pVal) { return Put((const WDL_UINT64*)     pVal); }
+
+  // Floats
+
+  inline int Put(const float* pVal)
+  {
+    unsigned int i = WDL_bswapf_if_be(*pVal);
+    return PutBytes(&i, 4);
+  }
+
+  inline int Put(const double* pVal)
+  {
+    WDL_UINT64 i = WDL_bswapf_if_be(*pVal);
+    return PutBytes(&i, 8);
+  }
+
+#endif // WDL_BIG_ENDIAN
+
+  inline int PutStr(const char* str) 
+  {
+    int slen = strlen(str);
+    #ifdef WDL_BIG_ENDIAN
+    { const unsigned int i = WDL_bswap32_if_be(slen); Put(&i); }
+    #else
+    Put(&slen);
+    #endif
+    return PutBytes(str, slen);
+  }
+
+  inline int PutBool(bool b)
+  {
+    BYTE byt = (BYTE) (b ? 1 : 0);
+    return PutBytes(&byt, 1);
+  }
+
+  inline int PutChunk(const ByteChunkView* pRHS)
+  {
+    return PutBytes(pRHS->GetBytes(), pRHS->Size());
+  }
+
+  // Keeps the memory, a chunk that's cleared and written again (like the
+  // VST state on every save) only allocates the first time.
+  inline void Clear() 
+  {
+    mBytes.Resize(0, false);
+    Sync();
   }
 
   inline int Resize(int newSize) 
   {
     int n = mBytes.GetSize();
     mBytes.Resize(newSize);
+    Sync();
     if (newSize > n) {
       memset(mBytes.Get() + n, 0, (newSize - n));
     }
     return n;
   }
 
+  using ByteChunkView::GetBytes;
+
   inline BYTE* GetBytes()
   {
     return mBytes.Get();
   }
 
-  inline bool IsEqual(ByteChunk* pRHS)
+private:
+
+  // The view side reads straight from the buffer, which moves when it grows.
+  inline void Sync()
   {
-    return (pRHS && pRHS->Size() == Size() && !memcmp(pRHS->GetBytes(), GetBytes(), Size()));
+    mData = mBytes.Get();
+    mSize = mBytes.GetSize();
   }
 
-private:
-
   WDL_TypedBuf<unsigned char> mBytes;
 };
 
@@ -32,6 +32,10 @@ void IControl::SetDirty(bool pushParamToPlug)
 {
 	mValue = BOUNDED(mValue, mClampLo, mClampHi);
   mDirty = true;
+  IGraphics* pGraphics = (mPlug ? mPlug->GetGUI() : 0);
+  if (pGraphics) {
+    pGraphics->MarkControlDirty(mControlIdx);
+  }
 	if (pushParamToPlug && mPlug && mParamIdx >= 0) {
 		mPlug->SetParameterFromGUI(mParamIdx, mValue);
 	}
@@ -338,7 +342,7 @@ bool IBitmapOverlayControl::Draw(IGraphics* pGraphics)
 	}
 }
 
-void ITextControl::SetTextFromPlug(char* str)
+void ITextControl::SetTextFromPlug(const char* str)
 {
 	if (strcmp(mStr.Get(), str)) {
 		SetDirty(false);
@@ -19,8 +19,8 @@ public:
 	// If paramIdx is > -1, this control will be associated with a plugin parameter.
   IControl(IPlugBase* pPlug, IRECT* pR, int paramIdx = -1, IChannelBlend blendMethod = IChannelBlend::kBlendNone)
 	:	mPlug(pPlug), mRECT(*pR), mTargetRECT(*pR), mParamIdx(paramIdx), mValue(0.0), mDefaultValue(-1.0),
-        mBlend(blendMethod), mDirty(true), mHide(false), mGrayed(false), mDisablePrompt(false), mDblAsSingleClick(false), 
-        mClampLo(0.0), mClampHi(1.0) {}
+        mBlend(blendMethod), mDirty(true), mRedraw(false), mHide(false), mGrayed(false), mDisablePrompt(false), mDblAsSingleClick(false), 
+        mClampLo(0.0), mClampHi(1.0), mControlIdx(-1) {}
 
 	virtual ~IControl() {}
 
@@ -88,6 +88,11 @@ protected:
 	double mValue, mDefaultValue, mClampLo, mClampHi;
 	bool mDirty, mHide, mGrayed, mRedraw, mDisablePrompt, mClamped, mDblAsSingleClick;
   IChannelBlend mBlend;
+
+private:
+
+  friend class IGraphics;
+  int mControlIdx;  // Index in the IGraphics, -1 until attached.
 };
 
 enum EDirection { kVertical, kHorizontal };
@@ -327,7 +332,7 @@ public:
 	// GetText returns a pointer to a 0 char if the text has zero length
 	// (see wdlstring.h).
 	const char *GetText() { return mStr.Get(); }
-	void SetTextFromPlug(char* str);
+	void SetTextFromPlug(const char* str);
 	void ClearTextFromPlug() { SetTextFromPlug(""); }
 
 	const IText* GetIText() const { return &mText; }
@@ -1,8 +1,15 @@
 #include "IGraphics.h"
 #include "IControl.h"
+#include "IPlugAtomic.h"
+#include <limits.h>
 
 #define DEFAULT_FPS 24
 
+// More dirty regions than this get merged, drawing a little extra beats many small draws.
+#define MAX_DIRTY_REGIONS 8
+// Side of a spatial index cell, in pixels.
+#define GRID_CELL 32
+
 // If not dirty for this many timer ticks, we call OnGUIIDle.
 // Only looked at if USE_IDLE_CALLS is defined.
 #define IDLE_TICKS 20
@@ -153,7 +160,8 @@ inline int LiceBlendMode(const IChannelBlend* pBlend)
 
 IGraphics::IGraphics(IPlugBase* pPlug, int w, int h, int refreshFPS)
 :	mPlug(pPlug), mWidth(w), mHeight(h), mIdleTicks(0), 
-  mMouseCapture(-1), mMouseOver(-1), mMouseX(0), mMouseY(0), mHandleMouseOver(false), mStrict(true), mDisplayControlValue(false), mDrawBitmap(0), mTmpBitmap(0)
+  mMouseCapture(-1), mMouseOver(-1), mMouseX(0), mMouseY(0), mHandleMouseOver(false), mStrict(true), mDisplayControlValue(false), mDrawBitmap(0), mTmpBitmap(0),
+  mGridNControls(-1), mGridCols(0), mGridRows(0), mQueryStamp(0)
 {
 	mFPS = (refreshFPS > 0 ? refreshFPS : DEFAULT_FPS);
 }
@@ -172,6 +180,10 @@ void IGraphics::Resize(int w, int h)
   mHeight = h;
   ReleaseMouseCapture();
   mControls.Empty(true);
+  memset(mDirtyBits.Get(), 0, mDirtyBits.GetSize() * sizeof(unsigned int));
+  memset(mPendingBits.Get(), 0, mPendingBits.GetSize() * sizeof(unsigned int));
+  mDirtyRegions.Resize(0, false);
+  mGridNControls = -1;
   mPlug->ResizeGraphics(w, h);
 }
 
@@ -205,12 +217,32 @@ void IGraphics::AttachBackground(int ID, const char* name)
   IBitmap bg = LoadIBitmap(ID, name);
   IControl* pBG = new IBitmapControl(mPlug, 0, 0, -1, &bg, IChannelBlend::kBlendClobber);
   mControls.Insert(0, pBG);
+  ControlsAttached(0);
 }
 
 int IGraphics::AttachControl(IControl* pControl)
 {
 	mControls.Add(pControl);
-  return mControls.GetSize() - 1;
+  int idx = mControls.GetSize() - 1;
+  ControlsAttached(idx);
+  return idx;
+}
+
+// Controls from fromIdx on are new or have moved.
+void IGraphics::ControlsAttached(int fromIdx)
+{
+  int i, n = mControls.GetSize();
+  int nWords = (n + 31) / 32, nOldWords = mDirtyBits.GetSize();
+  if (nWords > nOldWords) {
+    mDirtyBits.Resize(nWords);
+    mPendingBits.Resize(nWords);
+    memset(mDirtyBits.Get() + nOldWords, 0, (nWords - nOldWords) * sizeof(unsigned int));
+    memset(mPendingBits.Get() + nOldWords, 0, (nWords - nOldWords) * sizeof(unsigned int));
+  }
+  for (i = fromIdx; i < n; ++i) {
+    mControls.Get(i)->mControlIdx = i;
+    MarkControlDirty(i);
+  }
 }
 
 void IGraphics::HideControl(int paramIdx, bool hide)
@@ -293,6 +325,13 @@ void IGraphics::SetAllControlsDirty()
   }
 }
 
+void IGraphics::MarkControlDirty(int controlIdx)
+{
+  if (controlIdx >= 0 && controlIdx < mDirtyBits.GetSize() * 32) {
+    IPLUG_ATOMIC_OR(mDirtyBits.Get() + controlIdx / 32, 1u << (controlIdx % 32));
+  }
+}
+
 void IGraphics::SetParameterFromGUI(int paramIdx, double normalizedValue)
 {
   int i, n = mControls.GetSize();
@@ -617,18 +656,237 @@ bool IGraphics::DrawRadialLine(const IColor* pColor, float cx, float cy, float a
   return DrawLine(pColor, xLo, yLo, xHi, yHi, pBlend, antiAlias);
 }
 
-bool IGraphics::IsDirty(IRECT* pR)
+// True if the pixels of both overlap, unlike IRECT::Intersects, rectangles that only touch don't.
+static bool Overlaps(IRECT* pA, IRECT* pB)
 {
-  bool dirty = false;
-  int i, n = mControls.GetSize();
-  IControl** ppControl = mControls.GetList();
-	for (i = 0; i < n; ++i, ++ppControl) {
-    IControl* pControl = *ppControl;
-    if (pControl->IsDirty()) {
-      *pR = pR->Union(pControl->GetRECT());
-      dirty = true;
+  return pA->L < pB->R && pB->L < pA->R && pA->T < pB->B && pB->T < pA->B;
+}
+
+static int CompareControlIdx(const void* pA, const void* pB)
+{
+  return *((const int*) pA) - *((const int*) pB);
+}
+
+static void RemoveRegion(WDL_TypedBuf<IRECT>* pRegions, int i)
+{
+  int n = pRegions->GetSize() - 1;
+  pRegions->Get()[i] = pRegions->Get()[n];
+  pRegions->Resize(n, false);
+}
+
+void IGraphics::TakeDirtyControls()
+{
+  int w, nWords = mDirtyBits.GetSize();
+  unsigned int* pDirty = mDirtyBits.Get();
+  unsigned int* pPending = mPendingBits.Get();
+  for (w = 0; w < nWords; ++w) {
+    pPending[w] |= IPLUG_ATOMIC_TAKE(pDirty + w);
+  }
+}
+
+// Control rectangles don't change once attached, so the grid is built once.
+void IGraphics::IndexControls()
+{
+  int i, x, y, pass, n = mControls.GetSize();
+  IRECT window(0, 0, mWidth, mHeight);
+  mGridCols = MAX(1, (mWidth + GRID_CELL - 1) / GRID_CELL);
+  mGridRows = MAX(1, (mHeight + GRID_CELL - 1) / GRID_CELL);
+  int nCells = mGridCols * mGridRows;
+
+  // Count the controls touching each cell, then fill them in.
+  mGridStart.Resize(nCells + 1);
+  int* pStart = mGridStart.Get();
+  memset(pStart, 0, (nCells + 1) * sizeof(int));
+  for (pass = 0; pass < 2; ++pass) {
+    int* pIdx = mGridIdx.Get();
+    for (i = 0; i < n; ++i) {
+      IRECT r = mControls.Get(i)->GetRECT()->Intersect(&window);
+      if (r.W() <= 0 || r.H() <= 0) {
+        continue;
+      }
+      for (y = r.T / GRID_CELL; y <= (r.B - 1) / GRID_CELL; ++y) {
+        for (x = r.L / GRID_CELL; x <= (r.R - 1) / GRID_CELL; ++x) {
+          int cell = y * mGridCols + x;
+          if (pass) {
+            pIdx[pStart[cell]++] = i;
+          }
+          else {
+            ++pStart[cell + 1];
+          }
+        }
+      }
+    }
+    if (pass) {
+      // Filling moved each start on to the next cell's.
+      memmove(pStart + 1, pStart, nCells * sizeof(int));
+      pStart[0] = 0;
+    }
+    else {
+      for (i = 0; i < nCells; ++i) {
+        pStart[i + 1] += pStart[i];
+      }
+      mGridIdx.Resize(pStart[nCells]);
     }
   }
+
+  mQueryMark.Resize(n);
+  memset(mQueryMark.Get(), 0, n * sizeof(int));
+  mQueryIdx.Resize(n);
+  mQueryStamp = 0;
+  mGridNControls = n;
+}
+
+int IGraphics::FindControls(IRECT* pR)
+{
+  if (mGridNControls != mControls.GetSize()) {
+    IndexControls();
+  }
+  IRECT window(0, 0, mWidth, mHeight);
+  IRECT r = pR->Intersect(&window);
+  if (r.W() <= 0 || r.H() <= 0) {
+    return 0;
+  }
+  if (mQueryStamp == INT_MAX) {
+    memset(mQueryMark.Get(), 0, mQueryMark.GetSize() * sizeof(int));
+    mQueryStamp = 0;
+  }
+  ++mQueryStamp;
+
+  // A control spanning several cells is seen once per cell, the stamp keeps it to one.
+  int x, y, k, nFound = 0;
+  int* pStart = mGridStart.Get();
+  int* pIdx = mGridIdx.Get();
+  int* pMark = mQueryMark.Get();
+  int* pFound = mQueryIdx.Get();
+  for (y = r.T / GRID_CELL; y <= (r.B - 1) / GRID_CELL; ++y) {
+    for (x = r.L / GRID_CELL; x <= (r.R - 1) / GRID_CELL; ++x) {
+      int cell = y * mGridCols + x;
+      for (k = pStart[cell]; k < pStart[cell + 1]; ++k) {
+        int i = pIdx[k];
+        if (pMark[i] != mQueryStamp) {
+          pMark[i] = mQueryStamp;
+          if (Overlaps(mControls.Get(i)->GetRECT(), &r)) {
+            pFound[nFound++] = i;
+          }
+        }
+      }
+    }
+  }
+  // Back into attach order, which is drawing order.
+  qsort(pFound, nFound, sizeof(int), CompareControlIdx);
+  return nFound;
+}
+
+void IGraphics::AddDirtyRegion(IRECT r)
+{
+  if (r.W() <= 0 || r.H() <= 0) {
+    return;
+  }
+  // Take in every region this overlaps, so they stay disjoint.
+  int g = 0;
+  while (g < mDirtyRegions.GetSize()) {
+    IRECT* pRegion = mDirtyRegions.Get() + g;
+    if (Overlaps(pRegion, &r)) {
+      r = r.Union(pRegion);
+      RemoveRegion(&mDirtyRegions, g);
+      g = 0;  // Grown, so it may overlap ones already passed.
+    }
+    else {
+      ++g;
+    }
+  }
+  mDirtyRegions.Add(r);
+
+  int n = mDirtyRegions.GetSize();
+  if (n > MAX_DIRTY_REGIONS) {
+    // Merge the pair that adds the least undirty area.
+    IRECT* pRegions = mDirtyRegions.Get();
+    int a, b, bestA = 0, bestB = 1;
+    double bestWaste = -1.0;
+    for (a = 0; a < n; ++a) {
+      for (b = a + 1; b < n; ++b) {
+        IRECT u = pRegions[a].Union(pRegions + b);
+        double waste = (double) u.W() * u.H() - (double) pRegions[a].W() * pRegions[a].H() - (double) pRegions[b].W() * pRegions[b].H();
+        if (bestWaste < 0.0 || waste < bestWaste) {
+          bestWaste = waste;
+          bestA = a;
+          bestB = b;
+        }
+      }
+    }
+    IRECT u = pRegions[bestA].Union(pRegions + bestB);
+    RemoveRegion(&mDirtyRegions, bestB);
+    RemoveRegion(&mDirtyRegions, bestA);
+    AddDirtyRegion(u);
+  }
+}
+
+void IGraphics::FindDirtyRegions()
+{
+  mDirtyRegions.Resize(0, false);
+  IRECT window(0, 0, mWidth, mHeight);
+  int w, b, n = mControls.GetSize(), nWords = mPendingBits.GetSize();
+  unsigned int* pPending = mPendingBits.Get();
+  for (w = 0; w < nWords; ++w) {
+    unsigned int bits = pPending[w];
+    for (b = 0; bits; ++b, bits >>= 1) {
+      if (bits & 1) {
+        int i = w * 32 + b;
+        IRECT r = (i < n ? mControls.Get(i)->GetRECT()->Intersect(&window) : IRECT());
+        if (r.W() > 0 && r.H() > 0) {
+          AddDirtyRegion(r);
+        }
+        else {
+          // Nothing of it to draw.
+          if (i < n) {
+            mControls.Get(i)->SetClean();
+          }
+          pPending[w] &= ~(1u << b);
+        }
+      }
+    }
+  }
+
+  if (mStrict) {
+    // Grow each region until it holds whole every control it overlaps, so none is drawn
+    // twice.  A background filling the window is the exception, it's drawn clipped to each.
+    int g = 0;
+    while (g < mDirtyRegions.GetSize()) {
+      IRECT r = mDirtyRegions.Get()[g];
+      bool grown = false;
+      int k, nFound = FindControls(&r);
+      for (k = 0; k < nFound; ++k) {
+        IControl* pControl = mControls.Get(mQueryIdx.Get()[k]);
+        IRECT cr = pControl->GetRECT()->Intersect(&window);
+        if (!pControl->IsHidden() && !cr.Contains(&window) && !r.Contains(&cr)) {
+          r = r.Union(&cr);
+          grown = true;
+        }
+      }
+      if (grown) {
+        RemoveRegion(&mDirtyRegions, g);
+        AddDirtyRegion(r);
+        g = 0;
+      }
+      else {
+        ++g;
+      }
+    }
+  }
+}
+
+bool IGraphics::IsDirty(IRECT* pR)
+{
+  // Values the audio thread published since the last tick land on their controls first.
+  mPlug->PollPublishedValues();
+
+  TakeDirtyControls();
+  FindDirtyRegions();
+  int g, nRegions = mDirtyRegions.GetSize();
+  for (g = 0; g < nRegions; ++g) {
+    *pR = pR->Union(mDirtyRegions.Get() + g);
+  }
+  bool dirty = (nRegions > 0);
   
 #ifdef USE_IDLE_CALLS
   if (dirty) {
@@ -667,50 +925,45 @@ bool IGraphics::Draw(IRECT* pR)
 //  #pragma REMINDER("Mutex set while drawing")
 //  WDL_MutexLock lock(&mMutex);
   
-  int i, j, n = mControls.GetSize();
+  int i, n = mControls.GetSize();
   if (!n) {
     return true;
   }
 
-  if (mStrict) {
-    mDrawRECT = *pR;
-    int n = mControls.GetSize();
-    IControl** ppControl = mControls.GetList();
-    for (int i = 0; i < n; ++i, ++ppControl) {
-      IControl* pControl = *ppControl;
-      if (!(pControl->IsHidden()) && pR->Intersects(pControl->GetRECT())) {
+  // Anything made dirty since IsDirty was asked gets drawn too, as far as it's within pR.
+  TakeDirtyControls();
+  FindDirtyRegions();
+
+  int g, k, nRegions = mDirtyRegions.GetSize();
+  for (g = 0; g < nRegions; ++g) {
+    mDrawRECT = mDirtyRegions.Get()[g].Intersect(pR);
+    if (mDrawRECT.W() <= 0 || mDrawRECT.H() <= 0) {
+      continue;
+    }
+    int nFound = FindControls(&mDrawRECT);
+    for (k = 0; k < nFound; ++k) {
+      IControl* pControl = mControls.Get(mQueryIdx.Get()[k]);
+      if (!pControl->IsHidden()) {
         pControl->Draw(this);
-//        if (mDisplayControlValue && i == mMouseCapture) {
+//        if (mDisplayControlValue && mQueryIdx.Get()[k] == mMouseCapture) {
 //          DisplayControlValue(pControl);
 //        }        
       }
-      pControl->SetClean();
-    }
-  }
-  else {
-    IControl* pBG = mControls.Get(0);
-    if (pBG->IsDirty()) { // Special case when everything needs to be drawn.
-      mDrawRECT = *(pBG->GetRECT());
-      for (int j = 0; j < n; ++j) {
-        IControl* pControl2 = mControls.Get(j);
-        if (!j || !(pControl2->IsHidden())) {
-          pControl2->Draw(this);
-          pControl2->SetClean();
-        }
-      }
     }
-    else {
-      for (i = 1; i < n; ++i) {
-        IControl* pControl = mControls.Get(i);
-        if (pControl->IsDirty()) {
-          mDrawRECT = *(pControl->GetRECT()); 
-          for (j = 0; j < n; ++j) {
-            IControl* pControl2 = mControls.Get(j);
-            if (!pControl2->IsHidden() && (i == j || pControl2->GetRECT()->Intersects(&mDrawRECT))) {
-              pControl2->Draw(this);
-            }
-          }
-          pControl->SetClean();
+  }
+
+  // Dirty controls wholly within pR are done, unless they asked to be drawn again.
+  // Anything else was drawn at most in part, and stays dirty.
+  IRECT window(0, 0, mWidth, mHeight);
+  unsigned int* pPending = mPendingBits.Get();
+  for (i = 0; i < n; ++i) {
+    if (pPending[i / 32] & (1u << (i % 32))) {
+      IControl* pControl = mControls.Get(i);
+      IRECT r = pControl->GetRECT()->Intersect(&window);
+      if (pR->Contains(&r)) {
+        pControl->SetClean();
+        if (!pControl->IsDirty()) {
+          pPending[i / 32] &= ~(1u << (i % 32));
         }
       }
     }
@@ -70,9 +70,10 @@ public:
   virtual bool OpenURL(const char* url, 
     const char* msgWindowTitle = 0, const char* confirmMsg = 0, const char* errMsgOnFailure = 0) = 0;
   
-  // Strict (default): draw everything within the smallest rectangle that contains everything dirty.
-  // Every control is guaranteed to get no more than one Draw() call per cycle.
-  // Fast: draw only controls that intersect something dirty.
+  // Dirty controls are gathered into a few disjoint regions, and only controls within those are drawn.
+  // Strict (default): each region is grown to take in every control it touches, so
+  // every control is guaranteed to get no more than one Draw() call per cycle.
+  // Fast: regions cover only what's dirty, and controls that intersect them are drawn.
   // If there are overlapping controls, fast drawing can generate multiple Draw() calls per cycle
   // (a control may be asked to draw multiple parts of itself, if it intersects with something dirty.)
   void SetStrictDrawing(bool strict);
@@ -111,6 +112,8 @@ public:
   void SetControlFromPlug(int controlIdx, double normalizedValue);
 
   void SetAllControlsDirty();
+  // Called by IControl::SetDirty, which may be on any thread.  Lock and allocation free.
+  void MarkControlDirty(int controlIdx);
 
   // This is for when the gui needs to change a control value that it can't redraw 
   // for context reasons.  If the gui has redrawn the control, use IPlug::SetParameterFromGUI.
@@ -185,6 +188,23 @@ private:
 	int GetMouseControlIdx(int x, int y);
 	int mMouseCapture, mMouseOver, mMouseX, mMouseY;
   bool mHandleMouseOver, mStrict, mDisplayControlValue;
+
+  // One bit per control.  mDirtyBits is set from any thread and taken by the GUI
+  // thread into mPendingBits, which hold controls until they're drawn and clean.
+  WDL_TypedBuf<unsigned int> mDirtyBits, mPendingBits;
+  // Disjoint rectangles covering the pending controls, what Draw actually redraws.
+  WDL_TypedBuf<IRECT> mDirtyRegions;
+  // Uniform grid over the window: the controls touching each cell, the background
+  // included, are mGridIdx[mGridStart[cell]] up to mGridIdx[mGridStart[cell + 1]].
+  WDL_TypedBuf<int> mGridStart, mGridIdx, mQueryMark, mQueryIdx;
+  int mGridNControls, mGridCols, mGridRows, mQueryStamp;
+
+  void ControlsAttached(int fromIdx);
+  void TakeDirtyControls();
+  void FindDirtyRegions();
+  void AddDirtyRegion(IRECT r);
+  void IndexControls();
+  int FindControls(IRECT* pR);  // Into mQueryIdx, in drawing order.
 };
 
 #endif
\ No newline at end of file
@@ -145,6 +145,7 @@ void* IGraphicsMac::OpenCocoaWindow(void* pParentView)
   }
   // Else we are being called by IGraphicsCocoaFactory, which is being called by a Cocoa AU host, 
   // and the host will take care of attaching the view to the window. 
+  SetAllControlsDirty();
   return mGraphicsCocoa;
 }
 
@@ -157,6 +158,7 @@ void* IGraphicsMac::OpenCarbonWindow(void* pParentWnd, void* pParentControl)
   ControlRef pControl = (ControlRef) pParentControl;
   // On 10.5 or later we could have used HICocoaViewCreate, but for 10.4 we have to support Carbon explicitly.
   mGraphicsCarbon = new IGraphicsCarbon(this, pWnd, pControl);
+  SetAllControlsDirty();
   return mGraphicsCarbon->GetView();
 }
 #endif
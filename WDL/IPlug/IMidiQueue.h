@@ -1,202 +1,313 @@
-#ifndef _IMIDIQUEUE_
-#define _IMIDIQUEUE_
-
-/*
-
-IMidiQueue
-(c) Theo Niessink 2009-2011
-<http://www.taletn.com/>
-
-
-This software is provided 'as-is', without any express or implied
-warranty. In no event will the authors be held liable for any damages
-arising from the use of this software.
-
-Permission is granted to anyone to use this software for any purpose,
-including commercial applications, and to alter it and redistribute it
-freely, subject to the following restrictions:
-
-1. The origin of this software must not be misrepresented; you must not
-   claim that you wrote the original software. If you use this software in a
-   product, an acknowledgment in the product documentation would be
-   appreciated but is not required.
-2. Altered source versions must be plainly marked as such, and must not be
-   misrepresented as being the original software.
-3. This notice may not be removed or altered from any source distribution.
-
-
-IMidiQueue is a fast, lean & mean MIDI queue for IPlug instruments or
-effects. Here are a few code snippets showing how to implement IMidiQueue in
-an IPlug project:
-
-
-MyPlug.h:
-
-#include "WDL/IPlug/IMidiQueue.h"
-
-class MyPlug: public IPlug
-{
-protected:
-	IMidiQueue mMidiQueue;
-}
-
-
-MyPlug.cpp:
-
-void MyPlug::Reset()
-{
-	mMidiQueue.Resize(GetBlockSize());
-}
-
-void MyPlug::ProcessMidiMsg(IMidiMsg* pMsg)
-{
-	mMidiQueue.Add(pMsg);
-}
-
-void MyPlug::ProcessDoubleReplacing(double** inputs, double** outputs, int nFrames)
-{
-	for (int offset = 0; offset < nFrames; ++offset)
-	{
-		while (!mMidiQueue.Empty())
-		{
-			IMidiMsg* pMsg = mMidiQueue.Peek();
-			if (pMsg->mOffset > offset) break;
-
-			// To-do: Handle the MIDI message
-
-			mMidiQueue.Remove();
-		}
-
-		// To-do: Process audio
-
-	}
-	mMidiQueue.Flush(nFrames);
-}
-
-*/
-
-
-class IMidiQueue
-{
-public:
-	IMidiQueue(int size = DEFAULT_BLOCK_SIZE): mBuf(NULL), mSize(0), mGrow(Granulize(size)), mFront(0), mBack(0) { Expand(); }
-	~IMidiQueue() {	free(mBuf); }
-
-	// Adds a MIDI message add the back of the queue. If the queue is full,
-	// it will automatically expand itself.
-	void Add(IMidiMsg* pMsg)
-	{
-		if (mBack >= mSize)
-		{
-			if (mFront > 0)
-				Compact();
-			else
-				if (!Expand()) return;
-		}
-
-		#ifndef DONT_SORT_IMIDIQUEUE
-		// Insert the MIDI message at the right offset.
-		if (mBack > mFront && pMsg->mOffset < mBuf[mBack - 1].mOffset)
-		{
-			int i = mBack - 2;
-			while (i >= mFront && pMsg->mOffset < mBuf[i].mOffset) --i;
-			i++;
-			memmove(&mBuf[i + 1], &mBuf[i], (mBack - i) * sizeof(IMidiMsg));
-			mBuf[i] = *pMsg;
-		}
-		else
-		#endif
-			mBuf[mBack] = *pMsg;
-		++mBack;
-	}
-
-	// Removes a MIDI message from the front of the queue (but does *not*
-	// free up its space until Compact() is called).
-	inline void Remove() { ++mFront; }
-
-	// Returns true if the queue is empty.
-	inline bool Empty() const { return mFront == mBack; }
-
-	// Returns the number of MIDI messages in the queue.
-	inline int ToDo() const { return mBack - mFront; }
-
-	// Returns the number of MIDI messages for which memory has already been
-	// allocated.
-	inline int GetSize() const { return mSize; }
-
-	// Returns the "next" MIDI message (all the way in the front of the
-	// queue), but does *not* remove it from the queue.
-	inline IMidiMsg* Peek() const { return &mBuf[mFront]; }
-
-	// Moves back MIDI messages all the way to the front of the queue, thus
-	// freeing up space at the back, and updates the sample offset of the
-	// remaining MIDI messages by substracting nFrames.
-	inline void Flush(int nFrames)
-	{
-		// Move everything all the way to the front.
-		if (mFront > 0) Compact();
-
-		// Update the sample offset.
-		for (int i = 0; i < mBack; ++i) mBuf[i].mOffset -= nFrames;
-	}
-
-	// Clears the queue.
-	inline void Clear() { mFront = mBack = 0; }
-
-	// Resizes (grows or shrinks) the queue, returns the new size.
-	int Resize(int size)
-	{
-		if (mFront > 0) Compact();
-		mGrow = size = Granulize(size);
-		// Don't shrink below the number of currently queued MIDI messages.
-		if (size < mBack) size = Granulize(mBack);
-		if (size == mSize) return mSize;
-
-		void* buf = realloc(mBuf, size * sizeof(IMidiMsg));
-		if (!buf) return mSize;
-
-		mBuf = (IMidiMsg*)buf;
-		mSize = size;
-		return size;
-	}
-
-protected:
-	// Automatically expands the queue.
-	bool Expand()
-	{
-		if (!mGrow) return false;
-		int size = (mSize / mGrow + 1) * mGrow;
-
-		void* buf = realloc(mBuf, size * sizeof(IMidiMsg));
-		if (!buf) return false;
-
-		mBuf = (IMidiMsg*)buf;
-		mSize = size;
-		return true;
-	}
-
-	// Moves everything all the way to the front.
-	inline void Compact()
-	{
-		mBack -= mFront;
-		if (mBack > 0) memmove(&mBuf[0], &mBuf[mFront], mBack * sizeof(IMidiMsg));
-		mFront = 0;
-	}
-
-	// Rounds the MIDI queue size up to the next 4 kB memory page size.
-	inline int Granulize(int size) const
-	{
-		int bytes = size * sizeof(IMidiMsg);
-		int rest = bytes % 4096;
-		if (rest) size = (bytes - rest + 4096) / sizeof(IMidiMsg);
-		return size;
-	}
-
-	IMidiMsg* mBuf;
-
-	int mSize, mGrow;
-	int mFront, mBack;
-} WDL_FIXALIGN;
-
-
-#endif // _IMIDIQUEUE_
+#ifndef _IMIDIQUEUE_
+#define _IMIDIQUEUE_
+
+/*
+
+IMidiQueue
+(c) Theo Niessink 2009-2011
+<http://www.taletn.com/>
+
+Altered version: messages are kept by absolute sample time in fixed
+storage, see the notes above the class.
+
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software in a
+   product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+
+
+IMidiQueue is a fast, lean & mean MIDI queue for IPlug instruments or
+effects. Here are a few code snippets showing how to implement IMidiQueue in
+an IPlug project:
+
+
+MyPlug.h:
+
+#include "WDL/IPlug/IMidiQueue.h"
+
+class MyPlug: public IPlug
+{
+protected:
+	IMidiQueue mMidiQueue;
+}
+
+
+MyPlug.cpp:
+
+void MyPlug::Reset()
+{
+	mMidiQueue.Resize(GetBlockSize());
+}
+
+void MyPlug::ProcessMidiMsg(IMidiMsg* pMsg)
+{
+	mMidiQueue.Add(pMsg);
+}
+
+void MyPlug::ProcessDoubleReplacing(double** inputs, double** outputs, int nFrames)
+{
+	for (int offset = 0; offset < nFrames; ++offset)
+	{
+		while (!mMidiQueue.Empty())
+		{
+			IMidiMsg* pMsg = mMidiQueue.Peek();
+			if (pMsg->mOffset > offset) break;
+
+			// To-do: Handle the MIDI message
+
+			mMidiQueue.Remove();
+		}
+
+		// To-do: Process audio
+
+	}
+	mMidiQueue.Flush(nFrames);
+}
+
+*/
+
+
+// Messages are stamped with an absolute sample time when they're added, so
+// Flush() only moves the block start instead of touching every message, and
+// Peek() works the offset back out relative to the current block.
+//
+// In order messages (the usual case) are appended to a ring, anything that
+// arrives earlier than the last one goes into a min-heap instead. The front of
+// the queue is whichever of the two is earlier, messages with the same time
+// come out in the order they were added.
+//
+// Storage is fixed, only the constructor and Resize() allocate. When full, Add()
+// follows the overflow policy and counts the drop instead of growing.
+
+class IMidiQueue
+{
+public:
+	enum EOverflow
+	{
+		kDropNewest = 0,	// The message being added is lost.
+		kDropOldest			// The front of the queue is lost to make room.
+	};
+
+	IMidiQueue(int size = DEFAULT_BLOCK_SIZE):
+		mRing(NULL), mHeap(NULL), mSize(0), mRingFront(0), mRingCount(0), mHeapCount(0),
+		mBlockStart(0), mSeq(0), mOverflow(kDropNewest), mNDropped(0), mMaxToDo(0)
+	{
+		Resize(size);
+	}
+	~IMidiQueue() { free(mRing); free(mHeap); }
+
+	// Adds a MIDI message, pMsg->mOffset is relative to the current block.
+	// Returns false if the message was dropped because the queue was full.
+	bool Add(const IMidiMsg* pMsg)
+	{
+		if (!mSize) return false;
+		if (ToDo() >= mSize)
+		{
+			++mNDropped;
+			if (mOverflow == kDropNewest) return false;
+			Remove();
+		}
+
+		Entry e;
+		e.mMsg = *pMsg;
+		e.mTime = mBlockStart + pMsg->mOffset;
+		e.mSeq = mSeq++;
+
+		#ifndef DONT_SORT_IMIDIQUEUE
+		if (mRingCount && e.mTime < RingBack()->mTime)
+			HeapPush(&e);
+		else
+		#endif
+		{
+			int back = mRingFront + mRingCount;
+			if (back >= mSize) back -= mSize;
+			mRing[back] = e;
+			++mRingCount;
+		}
+
+		if (ToDo() > mMaxToDo) mMaxToDo = ToDo();
+		return true;
+	}
+
+	// Removes the MIDI message at the front of the queue.
+	inline void Remove()
+	{
+		if (FrontIsHeap())
+			HeapPop();
+		else if (mRingCount)
+		{
+			if (++mRingFront == mSize) mRingFront = 0;
+			--mRingCount;
+		}
+	}
+
+	// Returns true if the queue is empty.
+	inline bool Empty() const { return !(mRingCount + mHeapCount); }
+
+	// Returns the number of MIDI messages in the queue.
+	inline int ToDo() const { return mRingCount + mHeapCount; }
+
+	// Returns how many MIDI messages fit.
+	inline int GetSize() const { return mSize; }
+
+	// Returns the MIDI message at the front of the queue without removing
+	// it, with mOffset relative to the current block (negative if it was due
+	// in an earlier one). NULL if the queue is empty.
+	inline IMidiMsg* Peek() const
+	{
+		if (Empty()) return NULL;
+		Entry* e = FrontIsHeap() ? mHeap : mRing + mRingFront;
+		e->mMsg.mOffset = (int)(e->mTime - mBlockStart);
+		return &e->mMsg;
+	}
+
+	// Moves on to the next block, whatever is left stays queued at the same
+	// absolute time. Doesn't touch the messages.
+	inline void Flush(int nFrames) { mBlockStart += nFrames; }
+
+	// Clears the queue, the counters are kept.
+	inline void Clear() { mRingFront = mRingCount = mHeapCount = 0; }
+
+	// Resizes (grows or shrinks) the queue, returns the new size. This is
+	// the only place it allocates, so call it from Reset() and not while
+	// processing. Messages past the new size are dropped and counted.
+	int Resize(int size)
+	{
+		size = Granulize(size);
+		if (size == mSize) return mSize;
+
+		Entry* ring = (Entry*)malloc(size * sizeof(Entry));
+		Entry* heap = (Entry*)malloc(size * sizeof(Entry));
+		if (!ring || !heap)
+		{
+			free(ring);
+			free(heap);
+			return mSize;
+		}
+
+		// Everything left goes back into the new ring in order.
+		int n = 0;
+		while (!Empty())
+		{
+			if (n < size)
+			{
+				ring[n] = FrontIsHeap() ? mHeap[0] : mRing[mRingFront];
+				++n;
+			}
+			else
+				++mNDropped;
+			Remove();
+		}
+
+		free(mRing);
+		free(mHeap);
+		mRing = ring;
+		mHeap = heap;
+		mSize = size;
+		mRingFront = 0;
+		mRingCount = n;
+		mHeapCount = 0;
+		return size;
+	}
+
+	inline void SetOverflow(EOverflow policy) { mOverflow = policy; }
+	inline EOverflow GetOverflow() const { return mOverflow; }
+
+	// Messages lost to overflow since the counters were last reset.
+	inline int GetNDropped() const { return mNDropped; }
+	// Most messages queued at once since the counters were last reset.
+	inline int GetMaxToDo() const { return mMaxToDo; }
+	inline void ResetCounters() { mNDropped = 0; mMaxToDo = ToDo(); }
+
+protected:
+	struct Entry
+	{
+		IMidiMsg mMsg;
+		WDL_INT64 mTime;		// Absolute sample time.
+		unsigned int mSeq;		// Order added, breaks ties between equal times.
+	};
+
+	static inline bool Earlier(const Entry* a, const Entry* b)
+	{
+		if (a->mTime != b->mTime) return a->mTime < b->mTime;
+		return (int)(a->mSeq - b->mSeq) < 0;
+	}
+
+	inline Entry* RingBack() const
+	{
+		int back = mRingFront + mRingCount - 1;
+		if (back >= mSize) back -= mSize;
+		return mRing + back;
+	}
+
+	inline bool FrontIsHeap() const
+	{
+		if (!mHeapCount) return false;
+		return !mRingCount || Earlier(mHeap, mRing + mRingFront);
+	}
+
+	void HeapPush(const Entry* e)
+	{
+		int i = mHeapCount++;
+		while (i > 0)
+		{
+			int parent = (i - 1) / 2;
+			if (!Earlier(e, mHeap + parent)) break;
+			mHeap[i] = mHeap[parent];
+			i = parent;
+		}
+		mHeap[i] = *e;
+	}
+
+	void HeapPop()
+	{
+		Entry last = mHeap[--mHeapCount];
+		int i = 0;
+		for (;;)
+		{
+			int child = 2 * i + 1;
+			if (child >= mHeapCount) break;
+			if (child + 1 < mHeapCount && Earlier(mHeap + child + 1, mHeap + child)) ++child;
+			if (!Earlier(mHeap + child, &last)) break;
+			mHeap[i] = mHeap[child];
+			i = child;
+		}
+		mHeap[i] = last;
+	}
+
+	// Rounds the MIDI queue size up to the next 4 kB memory page size.
+	inline int Granulize(int size) const
+	{
+		int bytes = size * sizeof(Entry);
+		int rest = bytes % 4096;
+		if (rest) size = (bytes - rest + 4096) / sizeof(Entry);
+		return size;
+	}
+
+	Entry* mRing;
+	Entry* mHeap;
+
+	int mSize;
+	int mRingFront, mRingCount, mHeapCount;
+
+	WDL_INT64 mBlockStart;
+	unsigned int mSeq;
+
+	EOverflow mOverflow;
+	int mNDropped, mMaxToDo;
+} WDL_FIXALIGN;
+
+
+#endif // _IMIDIQUEUE_
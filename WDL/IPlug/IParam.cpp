@@ -5,7 +5,7 @@
 #define MAX_PARAM_DISPLAY_LEN 8
 
 IParam::IParam()
-:	mType(kTypeNone), mValue(0.0), mMin(0.0), mMax(1.0), mStep(1.0), 
+:	mType(kTypeNone), mValue(0.0), mDefault(0.0), mMin(0.0), mMax(1.0), mStep(1.0), 
     mDisplayPrecision(0), mNegateDisplay(false), mShape(1.0)
 {
     memset(mName, 0, MAX_PARAM_NAME_LEN * sizeof(char));
@@ -50,7 +50,7 @@ void IParam::InitDouble(const char* name, double defaultVal, double minVal, doub
 	}
 	strcpy(mName, name);
 	strcpy(mLabel, label);
-	mValue = defaultVal;
+	mValue = mDefault = defaultVal;
 	mMin = minVal;
 	mMax = MAX(maxVal, minVal + step);
 	mStep = step;
@@ -85,11 +85,28 @@ double IParam::DBToAmp()
 
 void IParam::SetNormalized(double normalizedValue)
 {
-  mValue = FromNormalizedParam(normalizedValue, mMin, mMax, mShape);
+  mValue = GetNonNormalized(normalizedValue);
+}
+
+int IParam::GetStepIndex(double value) const
+{
+  if (mStep <= 0.0 || value < mMin) {
+    return -1;
+  }
+  double idx = floor(0.5 + (value - mMin) / mStep);
+  if (idx > 2147483647.0 || FromStepIndex(int(idx)) != value) {
+    return -1;
+  }
+  return int(idx);
+}
+
+double IParam::GetNonNormalized(double normalizedValue)
+{
+  double value = FromNormalizedParam(normalizedValue, mMin, mMax, mShape);
 	if (mType != kTypeDouble) {
-		mValue = floor(0.5 + mValue / mStep) * mStep;
+		value = floor(0.5 + value / mStep) * mStep;
 	}
-	mValue = MIN(mValue, mMax);
+	return MIN(value, mMax);
 }
 
 double IParam::GetNormalized()
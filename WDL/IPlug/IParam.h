@@ -45,6 +45,7 @@ public:
 	// Accessors / converters.
 	// These all return the readable value, not the VST (0,1).
 	double Value() const { return mValue; }
+	double GetDefault() const { return mDefault; }
 	bool Bool() const { return (mValue >= 0.5); }
 	int Int() const { return int(mValue); }
 	double DBToAmp();
@@ -52,6 +53,7 @@ public:
 	void SetNormalized(double normalizedValue);
 	double GetNormalized();
 	double GetNormalized(double nonNormalizedValue);
+	double GetNonNormalized(double normalizedValue);
   void GetDisplayForHost(char* rDisplay) { GetDisplayForHost(mValue, false, rDisplay); }
   void GetDisplayForHost(double value, bool normalized, char* rDisplay);
 	const char* GetNameForHost();
@@ -62,12 +64,17 @@ public:
 	bool MapDisplayText(char* str, int* pValue);	// Reverse map back to value.
   void GetBounds(double* pMin, double* pMax);
 
+  // Value as a whole number of steps up from the minimum, for storing it compactly.
+  // -1 if the value isn't exactly on a step, FromStepIndex wouldn't give it back.
+  int GetStepIndex(double value) const;
+  double FromStepIndex(int idx) const { return mMin + idx * mStep; }
+
 private:
 
 	// All we store is the readable values.
 	// SetFromHost() and GetForHost() handle conversion from/to (0,1).
   EParamType mType;
-	double mValue, mMin, mMax, mStep, mShape;	
+	double mValue, mDefault, mMin, mMax, mStep, mShape;	
 	int mDisplayPrecision;
 	char mName[MAX_PARAM_NAME_LEN], mLabel[MAX_PARAM_NAME_LEN];
 	bool mNegateDisplay;
@@ -0,0 +1,126 @@
+#ifndef _IPARAMQUEUE_
+#define _IPARAMQUEUE_
+
+// Keeps the parameter changes for a block sorted by sample offset, the same
+// way IMidiQueue does for MIDI, so a plugin can walk both side by side:
+//
+// void MyPlug::ProcessParamChange(IParamChange* pChange)
+// {
+//   mParamQueue.Add(pChange);
+// }
+//
+// void MyPlug::ProcessDoubleReplacing(double** inputs, double** outputs, int nFrames)
+// {
+//   for (int offset = 0; offset < nFrames; ++offset) {
+//     while (!mParamQueue.Empty() && mParamQueue.Peek()->mOffset <= offset) {
+//       // To-do: apply the change.
+//       mParamQueue.Remove();
+//     }
+//     // To-do: process audio.
+//   }
+//   mParamQueue.Flush(nFrames);
+// }
+
+#include "IPlugStructs.h"
+
+class IParamQueue
+{
+public:
+
+  IParamQueue(int size = 256)
+  : mFront(0), mBack(0), mNDropped(0)
+  {
+    mBuf.Resize(size);
+  }
+
+  ~IParamQueue() {}
+
+  // Changes at the same offset stay in the order they were added.
+  // Storage is fixed, only the constructor and Resize() allocate.  When full, the
+  // latest change queued for the same parameter gives way to this one (the parameter
+  // skips a step but ends up right); if there isn't one this change is dropped and
+  // counted, and Add returns false.
+  bool Add(const IParamChange* pChange)
+  {
+    if (mBack >= mBuf.GetSize() && mFront > 0) {
+      Compact();
+    }
+    if (mBack >= mBuf.GetSize() && !Coalesce(pChange->mIdx)) {
+      ++mNDropped;
+      return false;
+    }
+    IParamChange* pBuf = mBuf.Get();
+    int i = mBack;
+    while (i > mFront && pChange->mOffset < pBuf[i - 1].mOffset) {
+      --i;
+    }
+    if (i < mBack) {
+      memmove(pBuf + i + 1, pBuf + i, (mBack - i) * sizeof(IParamChange));
+    }
+    pBuf[i] = *pChange;
+    ++mBack;
+    return true;
+  }
+
+  // Doesn't free up the space until the next Flush.
+  void Remove() { ++mFront; }
+
+  bool Empty() const { return mFront == mBack; }
+  int ToDo() const { return mBack - mFront; }
+  IParamChange* Peek() { return mBuf.Get() + mFront; }
+
+  // Call at the end of the block, anything left over moves to the start of the next one.
+  void Flush(int nFrames)
+  {
+    if (mFront > 0) {
+      Compact();
+    }
+    IParamChange* pBuf = mBuf.Get();
+    for (int i = 0; i < mBack; ++i) {
+      pBuf[i].mOffset -= nFrames;
+    }
+  }
+
+  void Clear() { mFront = mBack = 0; }
+
+  // Changes lost because the queue was full, since construction.
+  int GetNDropped() const { return mNDropped; }
+
+  void Resize(int size)
+  {
+    if (mFront > 0) {
+      Compact();
+    }
+    mBuf.Resize(MAX(size, mBack));
+  }
+
+private:
+
+  void Compact()
+  {
+    mBack -= mFront;
+    if (mBack > 0) {
+      memmove(mBuf.Get(), mBuf.Get() + mFront, mBack * sizeof(IParamChange));
+    }
+    mFront = 0;
+  }
+
+  // Removes the last queued change to paramIdx, returns false if there's none.
+  bool Coalesce(int paramIdx)
+  {
+    IParamChange* pBuf = mBuf.Get();
+    for (int i = mBack - 1; i >= mFront; --i) {
+      if (pBuf[i].mIdx == paramIdx) {
+        memmove(pBuf + i, pBuf + i + 1, (mBack - i - 1) * sizeof(IParamChange));
+        --mBack;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  WDL_TypedBuf<IParamChange> mBuf;
+  int mFront, mBack, mNDropped;
+};
+
+#endif
@@ -2,6 +2,10 @@
 #include "IGraphicsMac.h"
 #include "Log.h"
 #include "Hosts.h"
+#include <stddef.h>
+
+const int MIDI_OUT_BUF_SIZE = 8192;   // Bytes of packet list per render call before an early flush.
+const int MIDI_OUT_QUEUE_SIZE = 256;  // Messages from other threads held for the next render call.
 
 //#include "/Developer/Examples/CoreAudio/PublicUtility/CAStreamBasicDescription.h"
 
@@ -80,6 +84,57 @@ ComponentResult IPlugAU::IPlugAUEntry(ComponentParameters *params, void* pPlug)
     return noErr;
   }
 
+  // The audio, parameter and MIDI calls don't lock, they can come from the render thread.
+  switch (select) {
+    case kAudioUnitGetParameterSelect: {
+      AudioUnitParameterID paramID = GET_COMP_PARAM(AudioUnitParameterID, 3, 4);
+      AudioUnitScope scope = GET_COMP_PARAM(AudioUnitScope, 2, 4);
+      AudioUnitElement element = GET_COMP_PARAM(AudioUnitElement, 1, 4);
+      AudioUnitParameterValue* pValue = GET_COMP_PARAM(AudioUnitParameterValue*, 0, 4);
+      return GetParamProc(pPlug, paramID, scope, element, pValue);
+    }
+    case kAudioUnitSetParameterSelect: {
+      AudioUnitParameterID paramID = GET_COMP_PARAM(AudioUnitParameterID, 4, 5);
+      AudioUnitScope scope = GET_COMP_PARAM(AudioUnitScope, 3, 5);
+      AudioUnitElement element = GET_COMP_PARAM(AudioUnitElement, 2, 5);
+      AudioUnitParameterValue value = GET_COMP_PARAM(AudioUnitParameterValue, 1, 5);
+      UInt32 offset = GET_COMP_PARAM(UInt32, 0, 5);
+      return SetParamProc(pPlug, paramID, scope, element, value, offset);
+    }
+    case kAudioUnitScheduleParametersSelect: {
+      AudioUnitParameterEvent* pEvent = GET_COMP_PARAM(AudioUnitParameterEvent*, 1, 2);
+      UInt32 nEvents = GET_COMP_PARAM(UInt32, 0, 2);
+      for (int i = 0; i < nEvents; ++i, ++pEvent) {
+        if (pEvent->eventType == kParameterEvent_Immediate) {
+          ComponentResult r = SetParamProc(pPlug, pEvent->parameter, pEvent->scope, pEvent->element,
+            pEvent->eventValues.immediate.value, pEvent->eventValues.immediate.bufferOffset);
+          if (r != noErr) {
+            return r;
+          }
+        }
+      }
+      return noErr;
+    }
+    case kAudioUnitRenderSelect: {
+      AudioUnitRenderActionFlags* pFlags = GET_COMP_PARAM(AudioUnitRenderActionFlags*, 4, 5);
+      const AudioTimeStamp* pTimestamp = GET_COMP_PARAM(AudioTimeStamp*, 3, 5);
+      UInt32 outputBusIdx = GET_COMP_PARAM(UInt32, 2, 5);
+      UInt32 nFrames = GET_COMP_PARAM(UInt32, 1, 5);
+      AudioBufferList* pBufferList = GET_COMP_PARAM(AudioBufferList*, 0, 5);
+      return RenderProc(_this, pFlags, pTimestamp, outputBusIdx, nFrames, pBufferList);
+    }
+    case kMusicDeviceMIDIEventSelect: {   // Ignore kMusicDeviceSysExSelect for now.
+      IMidiMsg msg;
+      msg.mStatus = GET_COMP_PARAM(UInt32, 3, 4);
+      msg.mData1 = GET_COMP_PARAM(UInt32, 2, 4);
+      msg.mData2 = GET_COMP_PARAM(UInt32, 1, 4);
+      msg.mOffset = GET_COMP_PARAM(UInt32, 0, 4);
+      IPLUG_AUDIT_SCOPE;
+      _this->ProcessMidiMsg(&msg);
+      return noErr;
+    }
+  }
+
   IPlugBase::IMutexLock lock(_this);
 
   switch (select) {
@@ -93,10 +148,12 @@ ComponentResult IPlugAU::IPlugAUEntry(ComponentParameters *params, void* pPlug)
       _this->mActive = true;
       _this->OnParamReset();
       _this->OnActivate(true);
+      _this->SetProcessing(true);
       return noErr;
     }
     case kAudioUnitUninitializeSelect: {
       _this->mActive = false;
+      _this->SetProcessing(false);
       _this->OnActivate(false);
       return noErr;
     }
@@ -206,56 +263,10 @@ ComponentResult IPlugAU::IPlugAUEntry(ComponentParameters *params, void* pPlug)
       }
       return noErr;
     }
-    case kAudioUnitGetParameterSelect: {
-      AudioUnitParameterID paramID = GET_COMP_PARAM(AudioUnitParameterID, 3, 4);
-      AudioUnitScope scope = GET_COMP_PARAM(AudioUnitScope, 2, 4);
-      AudioUnitElement element = GET_COMP_PARAM(AudioUnitElement, 1, 4);
-      AudioUnitParameterValue* pValue = GET_COMP_PARAM(AudioUnitParameterValue*, 0, 4);
-      return GetParamProc(pPlug, paramID, scope, element, pValue);
-    }
-    case kAudioUnitSetParameterSelect: {
-      AudioUnitParameterID paramID = GET_COMP_PARAM(AudioUnitParameterID, 4, 5);
-      AudioUnitScope scope = GET_COMP_PARAM(AudioUnitScope, 3, 5);
-      AudioUnitElement element = GET_COMP_PARAM(AudioUnitElement, 2, 5);
-      AudioUnitParameterValue value = GET_COMP_PARAM(AudioUnitParameterValue, 1, 5);
-      UInt32 offset = GET_COMP_PARAM(UInt32, 0, 5);
-      return SetParamProc(pPlug, paramID, scope, element, value, offset);
-    }
-    case kAudioUnitScheduleParametersSelect: {
-      AudioUnitParameterEvent* pEvent = GET_COMP_PARAM(AudioUnitParameterEvent*, 1, 2);
-      UInt32 nEvents = GET_COMP_PARAM(UInt32, 0, 2);
-      for (int i = 0; i < nEvents; ++i, ++pEvent) {
-        if (pEvent->eventType == kParameterEvent_Immediate) {
-          ComponentResult r = SetParamProc(pPlug, pEvent->parameter, pEvent->scope, pEvent->element,
-            pEvent->eventValues.immediate.value, pEvent->eventValues.immediate.bufferOffset);
-          if (r != noErr) {
-            return r;
-          }
-        }
-      }
-      return noErr;
-    }
-    case kAudioUnitRenderSelect: {
-      AudioUnitRenderActionFlags* pFlags = GET_COMP_PARAM(AudioUnitRenderActionFlags*, 4, 5);
-      const AudioTimeStamp* pTimestamp = GET_COMP_PARAM(AudioTimeStamp*, 3, 5);
-      UInt32 outputBusIdx = GET_COMP_PARAM(UInt32, 2, 5);
-      UInt32 nFrames = GET_COMP_PARAM(UInt32, 1, 5);
-      AudioBufferList* pBufferList = GET_COMP_PARAM(AudioBufferList*, 0, 5);
-      return RenderProc(_this, pFlags, pTimestamp, outputBusIdx, nFrames, pBufferList);
-    }
     case kAudioUnitResetSelect: {
       _this->Reset();
       return noErr;
     }
-    case kMusicDeviceMIDIEventSelect: {   // Ignore kMusicDeviceSysExSelect for now.
-      IMidiMsg msg;
-      msg.mStatus = GET_COMP_PARAM(UInt32, 3, 4);
-      msg.mData1 = GET_COMP_PARAM(UInt32, 2, 4);
-      msg.mData2 = GET_COMP_PARAM(UInt32, 1, 4);
-      msg.mOffset = GET_COMP_PARAM(UInt32, 0, 4);
-      _this->ProcessMidiMsg(&msg);
-      return noErr;
-    }
     NO_OP(kMusicDeviceSysExSelect);
     case kMusicDevicePrepareInstrumentSelect: {
       return noErr;
@@ -723,8 +734,27 @@ ComponentResult IPlugAU::GetProperty(AudioUnitPropertyID propID, AudioUnitScope
 
     #if MAC_OS_X_VERSION_MAX_ALLOWED > MAC_OS_X_VERSION_10_4
       NO_OP(kAudioUnitProperty_AUHostIdentifier);           // 46,
-      NO_OP(kAudioUnitProperty_MIDIOutputCallbackInfo);     // 47,
-      NO_OP(kAudioUnitProperty_MIDIOutputCallback);         // 48,
+      case kAudioUnitProperty_MIDIOutputCallbackInfo: {     // 47,
+        ASSERT_SCOPE(kAudioUnitScope_Global);
+        if (!mDoesMidi) {
+          return kAudioUnitErr_InvalidProperty;
+        }
+        *pDataSize = sizeof(CFArrayRef);
+        if (pData) {
+          CFStringRef outName = CFSTR("midiOut");
+          *((CFArrayRef*) pData) = CFArrayCreate(0, (const void**) &outName, 1, 0);
+        }
+        return noErr;
+      }
+      case kAudioUnitProperty_MIDIOutputCallback: {         // 48,
+        ASSERT_SCOPE(kAudioUnitScope_Global);
+        if (!mDoesMidi) {
+          return kAudioUnitErr_InvalidProperty;
+        }
+        *pDataSize = sizeof(AUMIDIOutputCallbackStruct);
+        *pWriteable = true;
+        return noErr;
+      }
       NO_OP(kAudioUnitProperty_InputSamplesInOutput);       // 49,
       NO_OP(kAudioUnitProperty_ClassInfoFromDocument);      // 50
     #endif
@@ -895,7 +925,14 @@ ComponentResult IPlugAU::SetProperty(AudioUnitPropertyID propID, AudioUnitScope
         return noErr;
       }
       NO_OP(kAudioUnitProperty_MIDIOutputCallbackInfo);   // 47,
-      NO_OP(kAudioUnitProperty_MIDIOutputCallback);       // 48,
+      case kAudioUnitProperty_MIDIOutputCallback: {       // 48,
+        ASSERT_SCOPE(kAudioUnitScope_Global);
+        if (!mDoesMidi) {
+          return kAudioUnitErr_InvalidProperty;
+        }
+        memcpy(&mMidiCallback, pData, sizeof(AUMIDIOutputCallbackStruct));
+        return noErr;
+      }
       NO_OP(kAudioUnitProperty_InputSamplesInOutput);       // 49,
       NO_OP(kAudioUnitProperty_ClassInfoFromDocument)       // 50
     #endif
@@ -1056,14 +1093,13 @@ inline bool GetStrFromDict(CFDictionaryRef pDict, const char* key, char* value)
   return false;
 }
 
-inline bool GetDataFromDict(CFDictionaryRef pDict, const char* key, ByteChunk* pChunk)
+// The view points into the dictionary, it's good for as long as that is.
+inline bool GetDataFromDict(CFDictionaryRef pDict, const char* key, ByteChunkView* pChunk)
 {
   CFStrLocal cfKey(key);
   CFDataRef pData = (CFDataRef) CFDictionaryGetValue(pDict, cfKey.mCFStr);
   if (pData) {
-    int n = CFDataGetLength(pData);
-    pChunk->Resize(n);
-    memcpy(pChunk->GetBytes(), CFDataGetBytePtr(pData), n);
+    *pChunk = ByteChunkView(CFDataGetBytePtr(pData), CFDataGetLength(pData));
     return true;
   }
   return false;
@@ -1087,6 +1123,7 @@ ComponentResult IPlugAU::GetState(CFPropertyListRef* ppPropList)
 
   ByteChunk chunk;
   if (DoesStateChunks()) {
+    chunk.Reserve(SerializedStateSize());
     if (SerializeState(&chunk)) {
       PutDataInDict(pDict, kAUPresetDataKey, &chunk);
     }
@@ -1125,7 +1162,7 @@ ComponentResult IPlugAU::SetState(CFPropertyListRef pPropList)
   }
   RestorePreset(presetName);
 
-  ByteChunk chunk;
+  ByteChunkView chunk;
   if (!GetDataFromDict(pDict, kAUPresetDataKey, &chunk)) {
     return kAudioUnitErr_InvalidPropertyValue;
   }
@@ -1185,7 +1222,6 @@ ComponentResult IPlugAU::GetParamProc(void* pPlug, AudioUnitParameterID paramID,
 
   ASSERT_SCOPE(kAudioUnitScope_Global);
   IPlugAU* _this = (IPlugAU*) pPlug;
-  IMutexLock lock(_this);
   *pValue = _this->GetParam(paramID)->Value();
   return noErr;
 }
@@ -1199,13 +1235,12 @@ ComponentResult IPlugAU::SetParamProc(void* pPlug, AudioUnitParameterID paramID,
   // In the SDK, offset frames is only looked at in group scope.
   ASSERT_SCOPE(kAudioUnitScope_Global);
   IPlugAU* _this = (IPlugAU*) pPlug;
-  IMutexLock lock(_this);
   IParam* pParam = _this->GetParam(paramID);
   pParam->Set(value);
   if (_this->GetGUI()) {
     _this->GetGUI()->SetParameterFromPlug(paramID, value, false);
   }
-  _this->OnParamChange(paramID);
+  _this->QueueParamChange(paramID, pParam->GetNormalized(), true, offsetFrames);
   return noErr;
 }
 
@@ -1320,7 +1355,12 @@ ComponentResult IPlugAU::RenderProc(void* pPlug, AudioUnitRenderActionFlags* pFl
     _this->AttachOutputBuffers(chIdx, 1, (AudioSampleType**) &(pOutBufList->mBuffers[i].mData));
   }
 
+  _this->CacheTimeInfo();
+  _this->mMidiOutTimeStamp = *pTimestamp;
+  _this->TakeQueuedMidiOut();
   _this->ProcessBuffers((AudioSampleType) 0, nFrames);
+  _this->FlushMidiOut();
+  _this->mHasTimeInfo = false;
 
   if (nRenderNotify) {
     for (int i = 0; i < nRenderNotify; ++i) {
@@ -1377,12 +1417,19 @@ IPlugAU::IPlugAU(IPlugInstanceInfo instanceInfo,
 : IPlugBase(nParams, channelIOStr, nPresets,
   effectName, productName, mfrName, vendorVersion, uniqueID, mfrID, latency,
   plugDoesMidi, plugDoesChunks, plugIsInst),
-  mCI(0), mBypassed(false), mIsOffline(false), mRenderTimestamp(-1.0), mTempo(DEFAULT_TEMPO), mActive(false)
+  mCI(0), mBypassed(false), mIsOffline(false), mRenderTimestamp(-1.0), mTempo(DEFAULT_TEMPO), mActive(false),
+  mHasTimeInfo(false), mSamplePos(0), mTimeSigNum(0), mTimeSigDenom(0), mTimeTempo(DEFAULT_TEMPO), mDoesMidi(plugDoesMidi),
+  mMidiOutQueue(MIDI_OUT_QUEUE_SIZE)
 {
   Trace(TRACELOC, "%s", effectName);
 
   memset(&mHostCallbacks, 0, sizeof(HostCallbackInfo));
   memset(&mMidiCallback, 0, sizeof(AUMIDIOutputCallbackStruct));
+  memset(&mMidiOutTimeStamp, 0, sizeof(AudioTimeStamp));
+  if (plugDoesMidi) {
+    mMidiOutBuf.Resize(MIDI_OUT_BUF_SIZE);
+  }
+  ClearMidiOut();
 
   mOSXBundleID.Set(instanceInfo.mOSXBundleID.Get());
   mCocoaViewFactoryClassName.Set(instanceInfo.mCocoaViewFactoryClassName.Get());
@@ -1464,9 +1511,27 @@ bool IPlugAU::IsRenderingOffline()
   return mIsOffline;
 }
 
+void IPlugAU::CacheTimeInfo()
+{
+  mHasTimeInfo = false;   // So the getters ask the host.
+  int samplePos = GetSamplePos();
+  double tempo = GetTempo();
+  int num = 0, denom = 0;
+  GetTimeSig(&num, &denom);
+  mSamplePos = samplePos;
+  mTimeTempo = tempo;
+  mTimeSigNum = num;
+  mTimeSigDenom = denom;
+  mTimeInfoThread = CurrentThreadID();
+  mHasTimeInfo = true;
+}
+
 // Samples since start of project.
 int IPlugAU::GetSamplePos()
 {
+  if (InRenderCall()) {
+    return mSamplePos;
+  }
   if (mHostCallbacks.transportStateProc) {
     double samplePos = 0.0, loopStartBeat, loopEndBeat;
     Boolean playing, changed, looping;
@@ -1479,6 +1544,9 @@ int IPlugAU::GetSamplePos()
 
 double IPlugAU::GetTempo()
 {
+  if (InRenderCall()) {
+    return mTimeTempo;
+  }
   if (mHostCallbacks.beatAndTempoProc) {
     double currentBeat = 0.0, tempo = 0.0;
     mHostCallbacks.beatAndTempoProc(mHostCallbacks.hostUserData, &currentBeat, &tempo);
@@ -1494,7 +1562,11 @@ void IPlugAU::GetTimeSig(int* pNum, int* pDenom)
   UInt32 sampleOffsetToNextBeat = 0, tsDenom = 0;
   float tsNum = 0.0f;
   double currentMeasureDownBeat = 0.0;
-  if (mHostCallbacks.musicalTimeLocationProc) {
+  if (InRenderCall()) {
+    *pNum = mTimeSigNum;
+    *pDenom = mTimeSigDenom;
+  }
+  else if (mHostCallbacks.musicalTimeLocationProc) {
     mHostCallbacks.musicalTimeLocationProc(mHostCallbacks.hostUserData, &sampleOffsetToNextBeat,
       &tsNum, &tsDenom, &currentMeasureDownBeat);
     *pNum = (int) tsNum;
@@ -1565,15 +1637,82 @@ void IPlugAU::SetLatency(int samples)
   IPlugBase::SetLatency(samples);
 }
 
+void IPlugAU::ClearMidiOut()
+{
+  MIDIPacketList* pList = (MIDIPacketList*) mMidiOutBuf.Get();
+  if (pList) {
+    pList->numPackets = 0;
+    mMidiOutPacket = pList->packet;
+  }
+  else {
+    mMidiOutPacket = 0;
+  }
+}
+
+void IPlugAU::FlushMidiOut()
+{
+  MIDIPacketList* pList = (MIDIPacketList*) mMidiOutBuf.Get();
+  if (pList && pList->numPackets) {
+    if (mMidiCallback.midiOutputCallback) {
+      mMidiCallback.midiOutputCallback(mMidiCallback.userData, &mMidiOutTimeStamp, 0, pList);
+    }
+    ClearMidiOut();
+  }
+}
+
+// Messages the host sends in are passed through by the host itself, this is for
+// messages the plugin makes. They go out at the end of a render call, time stamped
+// as offsets into it: the current one if there is one, otherwise the next one.
+// Returns false if there's no MIDI output or no room left before that render call.
 bool IPlugAU::SendMidiMsg(IMidiMsg* pMsg)
 {
-  // I believe AU passes midi messages through automatically.
-  // For the case where we're generating midi messages, we'll use AUMIDIOutputCallback.
-  // See AudioUnitProperties.h.
-  if (mMidiCallback.midiOutputCallback) {
-      // Todo.
+  if (!mMidiCallback.midiOutputCallback || !mMidiOutPacket) {
+    return false;
   }
-  return false;
+  // Between render calls the rendering thread still owns the packet list.
+  if (InRenderCall() || OnAudioThread()) {
+    return AddMidiOut(pMsg);
+  }
+  WDL_MutexLock lock(&mMidiOutQueueMutex);
+  return mMidiOutQueue.Push(pMsg);
+}
+
+// Messages sent from other threads go out with this render call.
+void IPlugAU::TakeQueuedMidiOut()
+{
+  IMidiMsg msg;
+  while (mMidiOutQueue.Pop(&msg, 1)) {
+    AddMidiOut(&msg);
+  }
+}
+
+// Rendering thread only.  A full list is flushed early inside a render call, outside
+// one there's no time stamp to send it with so the message is turned down.
+bool IPlugAU::AddMidiOut(IMidiMsg* pMsg)
+{
+  // Room for the packet header, 3 data bytes and alignment padding.
+  const int packetBytes = offsetof(MIDIPacket, data) + 3 + 4;
+  if ((char*) mMidiOutPacket - (char*) mMidiOutBuf.Get() + packetBytes > mMidiOutBuf.GetSize()) {
+    if (!InRenderCall()) {
+      return false;
+    }
+    FlushMidiOut();
+  }
+
+  // Program change and channel pressure only have one data byte.
+  int status = pMsg->StatusMsg();
+  bool oneByte = (status == IMidiMsg::kProgramChange || status == IMidiMsg::kChannelAftertouch);
+
+  MIDIPacket* pPacket = mMidiOutPacket;
+  pPacket->timeStamp = pMsg->mOffset;
+  pPacket->length = (oneByte ? 2 : 3);
+  pPacket->data[0] = pMsg->mStatus;
+  pPacket->data[1] = pMsg->mData1;
+  pPacket->data[2] = pMsg->mData2;
+
+  ((MIDIPacketList*) mMidiOutBuf.Get())->numPackets++;
+  mMidiOutPacket = MIDIPacketNext(pPacket);
+  return true;
 }
 
 bool IPlugAU::SendMidiMsgs(WDL_TypedBuf<IMidiMsg>* pMsgs)
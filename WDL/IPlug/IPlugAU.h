@@ -8,6 +8,7 @@
 #include <AudioUnit/AudioUnitProperties.h>
 #include <AudioToolbox/AudioUnitUtilities.h>
 #include <AudioUnit/AudioUnitCarbonView.h>
+#include <CoreMIDI/MIDIServices.h>
 
 // Argh!
 #if MAC_OS_X_VERSION_MAX_ALLOWED <= MAC_OS_X_VERSION_10_4
@@ -81,11 +82,36 @@ private:
   double mRenderTimestamp, mTempo;
   HostCallbackInfo mHostCallbacks;
 
+  // Transport from the host, read once per render call. While mHasTimeInfo is set
+  // the time getters return these instead of calling back into the host, on the
+  // rendering thread only.  It's cleared when the render call returns.
+  bool mHasTimeInfo;
+  IThreadID mTimeInfoThread;
+  int mSamplePos, mTimeSigNum, mTimeSigDenom;
+  double mTimeTempo;
+  void CacheTimeInfo();
+  // True on the rendering thread during a render call, which owns the cache and the MIDI out list.
+  bool InRenderCall() { return mHasTimeInfo && SameThread(mTimeInfoThread, CurrentThreadID()); }
+
  // InScratchBuf is only needed if the upstream connection is a callback.
  // OutScratchBuf is only needed if the downstream connection fails to give us a buffer.  
   WDL_TypedBuf<AudioSampleType> mInScratchBuf, mOutScratchBuf; 
   WDL_PtrList<AURenderCallbackStruct> mRenderNotify;
   AUMIDIOutputCallbackStruct mMidiCallback;
+
+  // MIDI out is collected into a packet list over a render call, then handed to
+  // mMidiCallback in one go. Packet time stamps are sample offsets into the render.
+  // Only the rendering thread touches the list, other threads queue for the next render.
+  bool mDoesMidi;
+  WDL_HeapBuf mMidiOutBuf;
+  MIDIPacket* mMidiOutPacket;   // Where the next packet goes.
+  AudioTimeStamp mMidiOutTimeStamp;
+  IPlugQueue<IMidiMsg> mMidiOutQueue;
+  WDL_Mutex mMidiOutQueueMutex;   // Taken to push, there can be more than one other thread.
+  void ClearMidiOut();
+  void FlushMidiOut();
+  bool AddMidiOut(IMidiMsg* pMsg);
+  void TakeQueuedMidiOut();
   
   // Every stereo pair of plugin input or output is a bus.
   // Buses can have zero host channels if the host hasn't connected the bus at all,
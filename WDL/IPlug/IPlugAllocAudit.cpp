@@ -0,0 +1,194 @@
+#include "IPlugAllocAudit.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined IPLUG_AUDIT_ALLOC && defined __GLIBC__
+  #define ALLOC_AUDIT_GLIBC
+  #include <execinfo.h>
+  #define ALLOC_AUDIT_THREAD __thread
+#elif defined IPLUG_AUDIT_ALLOC && defined _MSC_VER && defined _DEBUG
+  #define ALLOC_AUDIT_CRT
+  #include <windows.h>
+  #include <crtdbg.h>
+  #define ALLOC_AUDIT_THREAD __declspec(thread)
+#endif
+
+#if defined ALLOC_AUDIT_GLIBC || defined ALLOC_AUDIT_CRT
+
+#define ALLOC_AUDIT_MAX_SITES 32
+#define ALLOC_AUDIT_MAX_FRAMES 16
+#define ALLOC_AUDIT_SKIP_FRAMES 2   // Record and the hook that called it.
+
+struct AllocAuditSite
+{
+  const char* mKind;
+  void* mFrames[ALLOC_AUDIT_MAX_FRAMES];
+  int mNFrames, mCount;
+};
+
+// Written only by audited threads, which there should only be one of at a time.
+static AllocAuditSite sSites[ALLOC_AUDIT_MAX_SITES];
+static int sNSites = 0, sCount = 0;
+
+static ALLOC_AUDIT_THREAD int sScopeDepth = 0;
+static ALLOC_AUDIT_THREAD int sInRecord = 0;   // Capturing the stack may allocate itself.
+
+static int CaptureStack(void** pFrames, int maxFrames)
+{
+#ifdef ALLOC_AUDIT_GLIBC
+  return backtrace(pFrames, maxFrames);
+#else
+  return CaptureStackBackTrace(0, maxFrames, pFrames, 0);
+#endif
+}
+
+static void Record(const char* kind)
+{
+  if (sScopeDepth <= 0 || sInRecord) {
+    return;
+  }
+  sInRecord = 1;
+  ++sCount;
+
+  void* frames[ALLOC_AUDIT_MAX_FRAMES + ALLOC_AUDIT_SKIP_FRAMES];
+  int n = CaptureStack(frames, ALLOC_AUDIT_MAX_FRAMES + ALLOC_AUDIT_SKIP_FRAMES) - ALLOC_AUDIT_SKIP_FRAMES;
+  void** pFrames = frames + ALLOC_AUDIT_SKIP_FRAMES;
+  if (n < 0) {
+    n = 0;
+  }
+
+  int i;
+  for (i = 0; i < sNSites; ++i) {
+    AllocAuditSite* pSite = sSites + i;
+    if (pSite->mKind == kind && pSite->mNFrames == n && !memcmp(pSite->mFrames, pFrames, n * sizeof(void*))) {
+      ++pSite->mCount;
+      break;
+    }
+  }
+  if (i == sNSites && sNSites < ALLOC_AUDIT_MAX_SITES) {
+    AllocAuditSite* pSite = sSites + sNSites++;
+    pSite->mKind = kind;
+    memcpy(pSite->mFrames, pFrames, n * sizeof(void*));
+    pSite->mNFrames = n;
+    pSite->mCount = 1;
+  }
+  sInRecord = 0;
+}
+
+IAllocAuditScope::IAllocAuditScope()
+{
+  ++sScopeDepth;
+}
+
+IAllocAuditScope::~IAllocAuditScope()
+{
+  --sScopeDepth;
+}
+
+bool IAllocAuditAvailable()
+{
+  return true;
+}
+
+int IAllocAuditCount()
+{
+  return sCount;
+}
+
+void IAllocAuditClear()
+{
+  // The first stack capture can load libraries, get that over with out here.
+  void* frames[ALLOC_AUDIT_MAX_FRAMES];
+  CaptureStack(frames, ALLOC_AUDIT_MAX_FRAMES);
+  sNSites = sCount = 0;
+}
+
+int IAllocAuditReport(FILE* pFile)
+{
+  fprintf(pFile, "%d allocation%s on the audio thread\n", sCount, sCount == 1 ? "" : "s");
+  for (int i = 0; i < sNSites; ++i) {
+    AllocAuditSite* pSite = sSites + i;
+    fprintf(pFile, "\n%s x%d\n", pSite->mKind, pSite->mCount);
+#ifdef ALLOC_AUDIT_GLIBC
+    fflush(pFile);
+    backtrace_symbols_fd(pSite->mFrames, pSite->mNFrames, fileno(pFile));
+#else
+    for (int f = 0; f < pSite->mNFrames; ++f) {
+      fprintf(pFile, "  %p\n", pSite->mFrames[f]);
+    }
+#endif
+  }
+  if (sNSites == ALLOC_AUDIT_MAX_SITES) {
+    fprintf(pFile, "\n(only the first %d call stacks are kept)\n", ALLOC_AUDIT_MAX_SITES);
+  }
+  return sCount;
+}
+
+#ifdef ALLOC_AUDIT_GLIBC
+
+// Replaces the C library's allocator for the whole process, calls go straight
+// through to the real one after being recorded.
+extern "C" {
+  void* __libc_malloc(size_t size);
+  void* __libc_calloc(size_t n, size_t size);
+  void* __libc_realloc(void* p, size_t size);
+  void __libc_free(void* p);
+
+  void* malloc(size_t size) __THROW
+  {
+    Record("malloc");
+    return __libc_malloc(size);
+  }
+
+  void* calloc(size_t n, size_t size) __THROW
+  {
+    Record("calloc");
+    return __libc_calloc(n, size);
+  }
+
+  void* realloc(void* p, size_t size) __THROW
+  {
+    Record("realloc");
+    return __libc_realloc(p, size);
+  }
+
+  void free(void* p) __THROW
+  {
+    if (p) {
+      Record("free");
+    }
+    __libc_free(p);
+  }
+}
+
+#else
+
+static int __cdecl AllocAuditHook(int allocType, void* pUserData, size_t size, int blockType,
+  long requestNumber, const unsigned char* filename, int lineNumber)
+{
+  if (blockType != _CRT_BLOCK) {
+    Record(allocType == _HOOK_ALLOC ? "malloc" : (allocType == _HOOK_REALLOC ? "realloc" : "free"));
+  }
+  return TRUE;
+}
+
+static struct AllocAuditInstall
+{
+  AllocAuditInstall() { _CrtSetAllocHook(AllocAuditHook); }
+} sAllocAuditInstall;
+
+#endif
+
+#else   // Nothing to see allocations with.
+
+#ifdef IPLUG_AUDIT_ALLOC
+IAllocAuditScope::IAllocAuditScope() {}
+IAllocAuditScope::~IAllocAuditScope() {}
+#endif
+
+bool IAllocAuditAvailable() { return false; }
+int IAllocAuditCount() { return 0; }
+void IAllocAuditClear() {}
+int IAllocAuditReport(FILE* pFile) { return 0; }
+
+#endif
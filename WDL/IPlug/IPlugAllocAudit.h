@@ -0,0 +1,40 @@
+#ifndef _IPLUGALLOCAUDIT_
+#define _IPLUGALLOCAUDIT_
+
+// Debug check that the realtime path never touches the heap.
+//
+// Build IPlug with IPLUG_AUDIT_ALLOC defined (CONFIGURATION=Audit in
+// Makefile.linux) and every malloc, calloc, realloc and free made by a thread
+// while it's inside an IPLUG_AUDIT_SCOPE is counted, along with the call stack
+// it came from.  IPlugBase puts one around ProcessBuffers, the API classes
+// around incoming MIDI.  Only allocations on the audited thread count, the
+// GUI and the host can allocate all they like meanwhile.
+//
+// Without IPLUG_AUDIT_ALLOC the scopes compile to nothing and the functions
+// below report nothing.  Interception needs glibc or the MSVC debug CRT.
+
+#include <stdio.h>
+
+// True if this build can see allocations at all.
+bool IAllocAuditAvailable();
+
+// Allocations seen since the last IAllocAuditClear.
+int IAllocAuditCount();
+void IAllocAuditClear();
+
+// Prints the count and each distinct call stack, returns the count.
+// Call from outside any audited scope.
+int IAllocAuditReport(FILE* pFile);
+
+#ifdef IPLUG_AUDIT_ALLOC
+  struct IAllocAuditScope
+  {
+    IAllocAuditScope();
+    ~IAllocAuditScope();
+  };
+  #define IPLUG_AUDIT_SCOPE IAllocAuditScope allocAuditScope
+#else
+  #define IPLUG_AUDIT_SCOPE
+#endif
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef _IPLUGATOMIC_
+#define _IPLUGATOMIC_
+
+// The few atomic operations IPlug's lock-free pieces are built on.
+//
+// IPLUG_MEMORY_BARRIER is a full fence.  IPLUG_ATOMIC_OR sets bits in an
+// unsigned int from any thread, IPLUG_ATOMIC_TAKE clears it and returns what it
+// held, so no bit set meanwhile is lost.
+
+#if defined _WIN32
+  #include <windows.h>
+  #define IPLUG_MEMORY_BARRIER() MemoryBarrier()
+  #define IPLUG_ATOMIC_OR(p, bits) InterlockedOr((volatile LONG*) (p), (LONG) (bits))
+  #define IPLUG_ATOMIC_TAKE(p) ((unsigned int) InterlockedExchange((volatile LONG*) (p), 0))
+#elif defined __GNUC__
+  #define IPLUG_MEMORY_BARRIER() __sync_synchronize()
+  #define IPLUG_ATOMIC_OR(p, bits) __sync_fetch_and_or((p), (bits))
+  #define IPLUG_ATOMIC_TAKE(p) __sync_fetch_and_and((p), 0u)
+#else
+  #error "No atomics for this compiler!"
+#endif
+
+#endif
@@ -1,9 +1,14 @@
 #include "IPlugBase.h"
-#include "IGraphics.h"
-#include "IControl.h"
+#ifndef NO_IGRAPHICS
+  #include "IGraphics.h"
+  #include "IControl.h"
+#endif
 #include <math.h>
 #include <stdio.h>
 #include <time.h>
+#ifndef _WIN32
+  #include <dlfcn.h>
+#endif
 
 const double DEFAULT_SAMPLE_RATE = 44100.0;
 
@@ -51,7 +56,9 @@ IPlugBase::IPlugBase(int nParams, const char* channelIOStr, int nPresets,
   bool plugDoesMidi, bool plugDoesChunks, bool plugIsInst)
 : mUniqueID(uniqueID), mMfrID(mfrID), mVersion(vendorVersion),
   mSampleRate(DEFAULT_SAMPLE_RATE), mBlockSize(0), mLatency(latency), mHost(kHostUninit), mHostVersion(0),
-  mStateChunks(plugDoesChunks), mGraphics(0), mCurrentPresetIdx(0), mIsInst(plugIsInst)
+  mStateChunks(plugDoesChunks), mGraphics(0), mCurrentPresetIdx(0), mIsInst(plugIsInst), mSingleReplacing(false),
+  mUIParamChanges(PARAM_CHANGE_QUEUE_SIZE), mHostParamChanges(PARAM_CHANGE_QUEUE_SIZE), mAudioParamChanges(PARAM_CHANGE_QUEUE_SIZE),
+  mPresets(nPresets), mProcessing(false), mParamResetPending(false), mAudioThread(), mHasAudioThread(false)
 {
   Trace(TRACELOC, "%s:%s", effectName, CurrentTime());
   
@@ -59,10 +66,6 @@ IPlugBase::IPlugBase(int nParams, const char* channelIOStr, int nPresets,
     mParams.Add(new IParam);
   }
 
-  for (int i = 0; i < nPresets; ++i) {
-    mPresets.Add(new IPreset(i));
-  }
-
   strcpy(mEffectName, effectName);
   strcpy(mProductName, productName);
   strcpy(mMfrName, mfrName);
@@ -83,30 +86,39 @@ IPlugBase::IPlugBase(int nParams, const char* channelIOStr, int nPresets,
 
   mInData.Resize(nInputs);
   mOutData.Resize(nOutputs);
+  mInFData.Resize(nInputs);
+  mOutFData.Resize(nOutputs);
 
   double** ppInData = mInData.Get();
-  for (int i = 0; i < nInputs; ++i, ++ppInData) {
+  float** ppInFData = mInFData.Get();
+  for (int i = 0; i < nInputs; ++i, ++ppInData, ++ppInFData) {
     InChannel* pInChannel = new InChannel;
     pInChannel->mConnected = false;
     pInChannel->mSrc = ppInData;
+    pInChannel->mFSrc = ppInFData;
     mInChannels.Add(pInChannel);
   }
   double** ppOutData = mOutData.Get();
-  for (int i = 0; i < nOutputs; ++i, ++ppOutData) {
+  float** ppOutFData = mOutFData.Get();
+  for (int i = 0; i < nOutputs; ++i, ++ppOutData, ++ppOutFData) {
     OutChannel* pOutChannel = new OutChannel;
     pOutChannel->mConnected = false;
     pOutChannel->mDest = ppOutData;
+    pOutChannel->mFOut = ppOutFData;
     pOutChannel->mFDest = 0;
     mOutChannels.Add(pOutChannel);
   }
+
+  mParamChangeBuf.Resize(PARAM_CHANGE_QUEUE_SIZE);
 }
 
 IPlugBase::~IPlugBase()
 { 
   TRACE;
+#ifndef NO_IGRAPHICS
 	DELETE_NULL(mGraphics);
+#endif
   mParams.Empty(true);
-  mPresets.Empty(true);
   mInChannels.Empty(true);
   mOutChannels.Empty(true);
   mChannelIO.Empty(true);
@@ -161,6 +173,7 @@ void IPlugBase::SetHost(const char* host, int version)
 
 void IPlugBase::AttachGraphics(IGraphics* pGraphics)
 {
+#ifndef NO_IGRAPHICS
 	if (pGraphics) {
     WDL_MutexLock lock(&mMutex);
     int i, n = mParams.GetSize();
@@ -170,6 +183,7 @@ void IPlugBase::AttachGraphics(IGraphics* pGraphics)
     pGraphics->PrepDraw();
 		mGraphics = pGraphics;
 	}
+#endif
 }
 
 // Decimal = VVVVRRMM, otherwise 0xVVVVRRMM.
@@ -209,15 +223,28 @@ void IPlugBase::SetBlockSize(int blockSize)
 {
   if (blockSize != mBlockSize) {
     int i, nIn = NInChannels(), nOut = NOutChannels();
+    // The scratch buffers may move, so unconnected channels are repointed.
     for (i = 0; i < nIn; ++i) {
       InChannel* pInChannel = mInChannels.Get(i);
       pInChannel->mScratchBuf.Resize(blockSize);
       memset(pInChannel->mScratchBuf.Get(), 0, blockSize * sizeof(double));
+      pInChannel->mFScratchBuf.Resize(blockSize);
+      memset(pInChannel->mFScratchBuf.Get(), 0, blockSize * sizeof(float));
+      if (!(pInChannel->mConnected)) {
+        *(pInChannel->mSrc) = pInChannel->mScratchBuf.Get();
+        *(pInChannel->mFSrc) = pInChannel->mFScratchBuf.Get();
+      }
     }
     for (i = 0; i < nOut; ++i) {
       OutChannel* pOutChannel = mOutChannels.Get(i);
       pOutChannel->mScratchBuf.Resize(blockSize);
       memset(pOutChannel->mScratchBuf.Get(), 0, blockSize * sizeof(double));
+      pOutChannel->mFScratchBuf.Resize(blockSize);
+      memset(pOutChannel->mFScratchBuf.Get(), 0, blockSize * sizeof(float));
+      if (!(pOutChannel->mConnected)) {
+        *(pOutChannel->mDest) = pOutChannel->mScratchBuf.Get();
+        *(pOutChannel->mFOut) = pOutChannel->mFScratchBuf.Get();
+      }
     }
     mBlockSize = blockSize;
   }
@@ -231,6 +258,7 @@ void IPlugBase::SetInputChannelConnections(int idx, int n, bool connected)
     pInChannel->mConnected = connected;
     if (!connected) {
       *(pInChannel->mSrc) = pInChannel->mScratchBuf.Get();
+      *(pInChannel->mFSrc) = pInChannel->mFScratchBuf.Get();
     }
   }
 }
@@ -243,6 +271,7 @@ void IPlugBase::SetOutputChannelConnections(int idx, int n, bool connected)
     pOutChannel->mConnected = connected;
     if (!connected) {
       *(pOutChannel->mDest) = pOutChannel->mScratchBuf.Get();
+      *(pOutChannel->mFOut) = pOutChannel->mFScratchBuf.Get();
     } 
   }
 }
@@ -274,9 +303,14 @@ void IPlugBase::AttachInputBuffers(int idx, int n, float** ppData, int nFrames)
   for (int i = idx; i < iEnd; ++i) {
     InChannel* pInChannel = mInChannels.Get(i);
     if (pInChannel->mConnected) {
-      double* pScratch = pInChannel->mScratchBuf.Get();
-      CastCopy(pScratch, *(ppData++), nFrames);
-      *(pInChannel->mSrc) = pScratch;
+      if (mSingleReplacing) {
+        *(pInChannel->mFSrc) = *(ppData++);
+      }
+      else {
+        double* pScratch = pInChannel->mScratchBuf.Get();
+        CastCopy(pScratch, *(ppData++), nFrames);
+        *(pInChannel->mSrc) = pScratch;
+      }
     }
   }
 }
@@ -299,20 +333,60 @@ void IPlugBase::AttachOutputBuffers(int idx, int n, float** ppData)
     OutChannel* pOutChannel = mOutChannels.Get(i);
     if (pOutChannel->mConnected) {
       *(pOutChannel->mDest) = pOutChannel->mScratchBuf.Get();
-      pOutChannel->mFDest = *(ppData++);
+      *(pOutChannel->mFOut) = pOutChannel->mFDest = *(ppData++);
     }
   }
 }
 
-#pragma REMINDER("lock mutex before calling into any IPlugBase processing functions")
+// The processing functions don't lock the mutex, anything that needs to reach
+// the audio thread goes through QueueParamChange.
+
+void IPlugBase::ProcessParamChanges(int nFrames)
+{
+  if (!OnAudioThread()) {
+    mAudioThread = CurrentThreadID();
+    mHasAudioThread = true;
+  }
+
+  if (mParamResetPending) {
+    mParamResetPending = false;
+    mUIParamChanges.Clear();
+    mHostParamChanges.Clear();
+    mAudioParamChanges.Clear();
+    OnParamReset();
+    return;
+  }
+
+  IPlugQueue<IParamChange>* queues[3] = { &mUIParamChanges, &mHostParamChanges, &mAudioParamChanges };
+  IParamChange* pChanges = mParamChangeBuf.Get();
+  int lastOffset = MAX(nFrames - 1, 0);
+  for (int q = 0; q < 3; ++q) {
+    int n;
+    while ((n = queues[q]->Pop(pChanges, PARAM_CHANGE_QUEUE_SIZE))) {
+      for (int i = 0; i < n; ++i) {
+        // Anything aimed past this block lands on its last sample.
+        pChanges[i].mOffset = BOUNDED(pChanges[i].mOffset, 0, lastOffset);
+        ProcessParamChange(&(pChanges[i]));
+      }
+    }
+  }
+}
 
 void IPlugBase::ProcessBuffers(double sampleType, int nFrames) 
 {
+  IPLUG_AUDIT_SCOPE;
+  ProcessParamChanges(nFrames);
   ProcessDoubleReplacing(mInData.Get(), mOutData.Get(), nFrames);
 }
 
 void IPlugBase::ProcessBuffers(float sampleType, int nFrames)
 {
+  IPLUG_AUDIT_SCOPE;
+  ProcessParamChanges(nFrames);
+  if (mSingleReplacing) {
+    ProcessSingleReplacing(mInFData.Get(), mOutFData.Get(), nFrames);
+    return;
+  }
   ProcessDoubleReplacing(mInData.Get(), mOutData.Get(), nFrames);
   int i, n = NOutChannels();
   OutChannel** ppOutChannel = mOutChannels.GetList();
@@ -326,9 +400,32 @@ void IPlugBase::ProcessBuffers(float sampleType, int nFrames)
 
 void IPlugBase::ProcessBuffersAccumulating(float sampleType, int nFrames)
 {
-  ProcessDoubleReplacing(mInData.Get(), mOutData.Get(), nFrames);
+  IPLUG_AUDIT_SCOPE;
+  ProcessParamChanges(nFrames);
   int i, n = NOutChannels();
   OutChannel** ppOutChannel = mOutChannels.GetList();
+  if (mSingleReplacing) {
+    // Render into scratch, then accumulate into the host buffers.
+    for (i = 0; i < n; ++i) {
+      OutChannel* pOutChannel = ppOutChannel[i];
+      if (pOutChannel->mConnected) {
+        *(pOutChannel->mFOut) = pOutChannel->mFScratchBuf.Get();
+      }
+    }
+    ProcessSingleReplacing(mInFData.Get(), mOutFData.Get(), nFrames);
+    for (i = 0; i < n; ++i, ++ppOutChannel) {
+      OutChannel* pOutChannel = *ppOutChannel;
+      if (pOutChannel->mConnected) {
+        float* pDest = pOutChannel->mFDest;
+        float* pSrc = *(pOutChannel->mFOut);
+        for (int j = 0; j < nFrames; ++j, ++pDest, ++pSrc) {
+          *pDest += *pSrc;
+        }
+      }
+    }
+    return;
+  }
+  ProcessDoubleReplacing(mInData.Get(), mOutData.Get(), nFrames);
   for (i = 0; i < n; ++i, ++ppOutChannel) {
     OutChannel* pOutChannel = *ppOutChannel;  
     if (pOutChannel->mConnected) {
@@ -351,9 +448,77 @@ void IPlugBase::SetParameterFromGUI(int idx, double normalizedValue)
 {
   Trace(TRACELOC, "%d:%f", idx, normalizedValue);
   WDL_MutexLock lock(&mMutex);
-  GetParam(idx)->SetNormalized(normalizedValue);
   InformHostOfParamChange(idx, normalizedValue);
-	OnParamChange(idx);
+  QueueParamChange(idx, normalizedValue, false);
+}
+
+void IPlugBase::QueueParamChange(int idx, double normalizedValue, bool fromHost, int offset)
+{
+  GetParam(idx)->SetNormalized(normalizedValue);
+  IParamChange change = { offset, idx, normalizedValue };
+  if (mProcessing) {
+    PushParamChange(&change, fromHost);
+    return;
+  }
+  if (fromHost) {
+    WDL_MutexLock lock(&mMutex);
+    if (!mProcessing) {
+      OnParamChange(idx);
+    }
+    else {
+      PushParamChange(&change, true);
+    }
+  }
+  else {
+    OnParamChange(idx);
+  }
+}
+
+// Hosts automate from the audio thread and from their own UI or automation threads,
+// so host changes are split by thread to keep one producer per queue.
+void IPlugBase::PushParamChange(IParamChange* pChange, bool fromHost)
+{
+  bool pushed;
+  if (!fromHost) {
+    pushed = mUIParamChanges.Push(pChange);   // The caller holds mMutex.
+  }
+  else if (OnAudioThread()) {
+    pushed = mAudioParamChanges.Push(pChange);
+  }
+  else {
+    WDL_MutexLock lock(&mHostParamMutex);
+    pushed = mHostParamChanges.Push(pChange);
+  }
+  if (!pushed) {
+    // The audio thread is way behind, just have it refresh everything.
+    mParamResetPending = true;
+  }
+}
+
+void IPlugBase::QueueParamReset()
+{
+  if (mProcessing) {
+    mParamResetPending = true;
+  }
+  else {
+    OnParamReset();
+  }
+}
+
+// Call with the mutex locked.
+void IPlugBase::SetProcessing(bool processing)
+{
+  if (processing != mProcessing) {
+    // Nothing is processing right now, so it's safe to apply anything still queued from here.
+    if (mParamResetPending || !mUIParamChanges.Empty() || !mHostParamChanges.Empty() || !mAudioParamChanges.Empty()) {
+      mParamResetPending = false;
+      mUIParamChanges.Clear();
+      mHostParamChanges.Clear();
+      mAudioParamChanges.Clear();
+      OnParamReset();
+    }
+    mProcessing = processing;
+  }
 }
 
 void IPlugBase::OnParamReset()
@@ -377,32 +542,58 @@ void IPlugBase::ProcessDoubleReplacing(double** inputs, double** outputs, int nF
   }
 }
 
+// Plugins that enable single replacing without implementing this still work,
+// they just pay for the conversion like before.
+void IPlugBase::ProcessSingleReplacing(float** inputs, float** outputs, int nFrames)
+{
+  int i, nIn = NInChannels(), nOut = NOutChannels();
+  for (i = 0; i < nIn; ++i) {
+    InChannel* pInChannel = mInChannels.Get(i);
+    CastCopy(pInChannel->mScratchBuf.Get(), inputs[i], nFrames);
+    *(pInChannel->mSrc) = pInChannel->mScratchBuf.Get();
+  }
+  for (i = 0; i < nOut; ++i) {
+    OutChannel* pOutChannel = mOutChannels.Get(i);
+    *(pOutChannel->mDest) = pOutChannel->mScratchBuf.Get();
+  }
+  ProcessDoubleReplacing(mInData.Get(), mOutData.Get(), nFrames);
+  for (i = 0; i < nOut; ++i) {
+    CastCopy(outputs[i], mOutData.Get()[i], nFrames);
+  }
+}
+
 // Default passthrough.
 void IPlugBase::ProcessMidiMsg(IMidiMsg* pMsg)
 {
 	SendMidiMsg(pMsg);
 }
 
-IPreset* GetNextUninitializedPreset(WDL_PtrList<IPreset>* pPresets)
+void IPlugBase::ProcessMidiMsgs(const IMidiMsg* pMsgs, int n)
 {
-  int n = pPresets->GetSize();
   for (int i = 0; i < n; ++i) {
-    IPreset* pPreset = pPresets->Get(i);
-    if (!(pPreset->mInitialized)) {
-      return pPreset;
+    IMidiMsg msg = pMsgs[i];
+    ProcessMidiMsg(&msg);
+  }
+}
+
+void IPlugBase::PollPublishedValues()
+{
+  double value;
+  for (int i = 0; i < IPlugPublish::kMaxSlots; ++i) {
+    if (mPublished.Poll(i, &value)) {
+      OnPublishedValue(i, value);
     }
   }
-  return 0;
 }
 
-void IPlugBase::MakeDefaultPreset(char* name, int nPresets)
+void IPlugBase::MakeDefaultPreset(const char* name, int nPresets)
 {
   for (int i = 0; i < nPresets; ++i) {
-    IPreset* pPreset = GetNextUninitializedPreset(&mPresets);
-    if (pPreset) {
-      pPreset->mInitialized = true;
-      strcpy(pPreset->mName, (name ? name : "Default"));
-      SerializeParams(&(pPreset->mChunk)); 
+    int idx = mPresets.NextUninitialized();
+    if (idx >= 0) {
+      mPresetChunk.Clear();
+      SerializeParams(&mPresetChunk);
+      mPresets.Set(idx, (name ? name : "Default"), &mPresetChunk);
     }
   }
 }
@@ -427,19 +618,21 @@ void IPlugBase::MakeDefaultPreset(char* name, int nPresets)
 
 void IPlugBase::MakePreset(char* name, ...)
 {
-  IPreset* pPreset = GetNextUninitializedPreset(&mPresets);
-  if (pPreset) {
-    pPreset->mInitialized = true;
-    strcpy(pPreset->mName, name);
+  int idx = mPresets.NextUninitialized();
+  if (idx >= 0) {
     int i, n = mParams.GetSize();
       
-    double v = 0.0;
+    WDL_TypedBuf<double> vals;
+    vals.Resize(n);
     va_list vp;
     va_start(vp, name);
     for (i = 0; i < n; ++i) {
-      GET_PARAM_FROM_VARARG(GetParam(i)->Type(), vp, v);
-      pPreset->mChunk.Put(&v);
+      GET_PARAM_FROM_VARARG(GetParam(i)->Type(), vp, *(vals.Get() + i));
     }
+    va_end(vp);
+    mPresetChunk.Clear();
+    PutCompactParams(&mPresetChunk, vals.Get());
+    mPresets.Set(idx, name, &mPresetChunk);
   }
 }
 
@@ -447,11 +640,8 @@ void IPlugBase::MakePreset(char* name, ...)
 
 void IPlugBase::MakePresetFromNamedParams(char* name, int nParamsNamed, ...)
 {
-  IPreset* pPreset = GetNextUninitializedPreset(&mPresets);
-  if (pPreset) {
-    pPreset->mInitialized = true;
-    strcpy(pPreset->mName, name);
-
+  int idx = mPresets.NextUninitialized();
+  if (idx >= 0) {
     int i = 0, n = mParams.GetSize();
 
     WDL_TypedBuf<double> vals;
@@ -477,57 +667,80 @@ void IPlugBase::MakePresetFromNamedParams(char* name, int nParamsNamed, ...)
       if (*pV == PARAM_UNINIT) {      // Any that weren't explicitly set, use the defaults.
         *pV = GetParam(i)->Value();
       }
-      pPreset->mChunk.Put(pV);
     }
+    mPresetChunk.Clear();
+    PutCompactParams(&mPresetChunk, vals.Get());
+    mPresets.Set(idx, name, &mPresetChunk);
   }
 }
 
-void IPlugBase::MakePresetFromChunk(char* name, ByteChunk* pChunk)
+void IPlugBase::MakePresetFromChunk(char* name, ByteChunkView* pChunk)
 {
-  IPreset* pPreset = GetNextUninitializedPreset(&mPresets);
-  if (pPreset) {
-    pPreset->mInitialized = true;
-    strcpy(pPreset->mName, name);
-
-    pPreset->mChunk.PutChunk(pChunk);
+  int idx = mPresets.NextUninitialized();
+  if (idx >= 0) {
+    mPresets.Set(idx, name, pChunk);
   }
 }
 
-#define DEFAULT_USER_PRESET_NAME "user preset"
+// Relative to the directory of the binary this is linked into, the plugin's.
+static void GetPathNextToPlugin(const char* filename, WDL_String* pPath)
+{
+  char modulePath[1024] = "";
+  if (filename[0] != '/' && filename[0] != '\\' && !(filename[0] && filename[1] == ':')) {
+#ifdef _WIN32
+    HMODULE hModule = 0;
+    if (GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+        (LPCSTR) &GetPathNextToPlugin, &hModule)) {
+      GetModuleFileNameA(hModule, modulePath, sizeof(modulePath));
+    }
+#else
+    Dl_info info;
+    if (dladdr((void*) &GetPathNextToPlugin, &info) && info.dli_fname) {
+      strncpy(modulePath, info.dli_fname, sizeof(modulePath) - 1);
+      modulePath[sizeof(modulePath) - 1] = '\0';
+    }
+#endif
+  }
+  char* pSlash = MAX(strrchr(modulePath, '/'), strrchr(modulePath, '\\'));
+  *(pSlash ? pSlash + 1 : modulePath) = '\0';
+  pPath->Set(modulePath);
+  pPath->Append(filename);
+}
 
-void MakeDefaultUserPresetName(WDL_PtrList<IPreset>* pPresets, char* str)
+bool IPlugBase::MakePresetsFromLibrary(const char* filename)
 {
-  int nDefaultNames = 0;
-  int n = pPresets->GetSize();
+  WDL_String path;
+  GetPathNextToPlugin(filename, &path);
+  IPresetLibrary* pLibrary = IPresetLibrary::Get(path.Get(), mUniqueID);
+  if (!pLibrary) {
+    return false;
+  }
+  int n = pLibrary->GetSize();
   for (int i = 0; i < n; ++i) {
-    IPreset* pPreset = pPresets->Get(i);
-    if (strstr(pPreset->mName, DEFAULT_USER_PRESET_NAME)) {
-      ++nDefaultNames;
+    int idx = mPresets.NextUninitialized();
+    if (idx >= 0) {
+      mPresets.SetShared(idx, pLibrary->GetName(i), pLibrary->GetBlob(i));
     }
   }
-  sprintf(str, "%s %d", DEFAULT_USER_PRESET_NAME, nDefaultNames + 1);
+  return true;
+}
+
+bool IPlugBase::DumpPresetLibrary(const char* filename)
+{
+  return IPresetLibrary::Write(filename, mUniqueID, &mPresets);
 }
 
 void IPlugBase::EnsureDefaultPreset()
 {
   if (!(mPresets.GetSize())) {
-    mPresets.Add(new IPreset(0));
+    mPresets.Add();
     MakeDefaultPreset();
   }
 }
 
 void IPlugBase::PruneUninitializedPresets()
 {
-  int i = 0;
-  while (i < mPresets.GetSize()) {
-    IPreset* pPreset = mPresets.Get(i);
-    if (pPreset->mInitialized) {
-      ++i;
-    }
-    else {
-      mPresets.Delete(i, true);
-    }
-  }
+  mPresets.PruneUninitialized();
 }
 
 bool IPlugBase::RestorePreset(int idx)
@@ -537,12 +750,16 @@ bool IPlugBase::RestorePreset(int idx)
     IPreset* pPreset = mPresets.Get(idx);
 
     if (!(pPreset->mInitialized)) {
-      pPreset->mInitialized = true;
-      MakeDefaultUserPresetName(&mPresets, pPreset->mName);
-      restoredOK = SerializeParams(&(pPreset->mChunk)); 
+      char name[MAX_PRESET_NAME_LEN];
+      sprintf(name, "%s %d", DEFAULT_USER_PRESET_NAME, mPresets.NDefaultUserNames() + 1);
+      mPresetChunk.Clear();
+      restoredOK = SerializeParams(&mPresetChunk);
+      mPresets.Set(idx, name, &mPresetChunk);
     }
     else {
-      restoredOK = (UnserializeParams(&(pPreset->mChunk), 0) > 0);
+      // Presets are only unpacked when they're actually restored.
+      ByteChunkView chunk = pPreset->mBlob->GetChunk();
+      restoredOK = (UnserializeParams(&chunk, 0) > 0);
     }
 
     if (restoredOK) {
@@ -556,12 +773,9 @@ bool IPlugBase::RestorePreset(int idx)
 bool IPlugBase::RestorePreset(const char* name)
 {
   if (CSTR_NOT_EMPTY(name)) {
-    int n = mPresets.GetSize();
-    for (int i = 0; i < n; ++i) {
-      IPreset* pPreset = mPresets.Get(i);
-      if (!strcmp(pPreset->mName, name)) {
-        return RestorePreset(i);
-      }
+    int idx = mPresets.Find(name);
+    if (idx >= 0) {
+      return RestorePreset(idx);
     }
   }
   return false;
@@ -578,89 +792,261 @@ const char* IPlugBase::GetPresetName(int idx)
 void IPlugBase::ModifyCurrentPreset(const char* name)
 {
   if (mCurrentPresetIdx >= 0 && mCurrentPresetIdx < mPresets.GetSize()) {
-    IPreset* pPreset = mPresets.Get(mCurrentPresetIdx);
-    pPreset->mChunk.Clear();
-
-
-    SerializeParams(&(pPreset->mChunk));
+    mPresetChunk.Clear();
+    SerializeParams(&mPresetChunk);
+    mPresets.Set(mCurrentPresetIdx, (CSTR_NOT_EMPTY(name) ? name : 0), &mPresetChunk);
+  }
+}
 
-    if (CSTR_NOT_EMPTY(name)) 
-    {
-      strcpy(pPreset->mName, name);
+int IPlugBase::SerializedPresetsSize()
+{
+  int size = 0, n = mPresets.GetSize();
+  for (int i = 0; i < n; ++i) {
+    IPreset* pPreset = mPresets.Get(i);
+    size += sizeof(int) + strlen(pPreset->mName) + 1;
+    if (pPreset->mInitialized) {
+      size += pPreset->mBlob->Size();
     }
   }
+  return size;
 }
 
 bool IPlugBase::SerializePresets(ByteChunk* pChunk)
 {
   bool savedOK = true;
   int n = mPresets.GetSize();
+  pChunk->Reserve(pChunk->Size() + SerializedPresetsSize());
   for (int i = 0; i < n && savedOK; ++i) {
     IPreset* pPreset = mPresets.Get(i);
     pChunk->PutStr(pPreset->mName);
     pChunk->PutBool(pPreset->mInitialized);
     if (pPreset->mInitialized) {
-      savedOK &= (pChunk->PutChunk(&(pPreset->mChunk)) > 0);
+      ByteChunkView chunk = pPreset->mBlob->GetChunk();
+      savedOK &= (pChunk->PutChunk(&chunk) > 0);
     }
   }
   return savedOK;
 }
 
-int IPlugBase::UnserializePresets(ByteChunk* pChunk, int startPos)
+int IPlugBase::UnserializePresets(ByteChunkView* pChunk, int startPos)
 {
   WDL_String name;
   int n = mPresets.GetSize(), pos = startPos;
   for (int i = 0; i < n && pos >= 0; ++i) {
-    IPreset* pPreset = mPresets.Get(i);
+    bool initialized = false;
     pos = pChunk->GetStr(&name, pos);
-    strcpy(pPreset->mName, name.Get());
-    pos = pChunk->GetBool(&(pPreset->mInitialized), pos);
-    if (pPreset->mInitialized) {
+    pos = pChunk->GetBool(&initialized, pos);
+    if (initialized) {
       pos = UnserializeParams(pChunk, pos);
       if (pos > 0) {
-        pPreset->mChunk.Clear();
-        SerializeParams(&(pPreset->mChunk));
+        mPresetChunk.Clear();
+        SerializeParams(&mPresetChunk);
+        mPresets.Set(i, name.Get(), &mPresetChunk);
+      }
+      else {
+        mPresets.SetName(i, name.Get());
       }
     }
+    else {
+      mPresets.Set(i, name.Get(), 0);
+    }
   }
   RestorePreset(mCurrentPresetIdx);
   return pos;
 }
 
-bool IPlugBase::SerializeParams(ByteChunk* pChunk)
+// Params are stored compactly: a tag, the number of params, a bit for each one
+// that's off its default, 2 bits for each of those saying how it's stored, then
+// their values.  A value that's a whole number of steps up from the minimum
+// (always, for bool, int and enum params) is stored as that number in 1, 2 or
+// 4 bytes, anything else as a double.  Older state is just every value as a
+// double, the tag reads as a NaN there so one can't be mistaken for the other.
+
+#define COMPACT_PARAMS_TAG 'cpr1'
+#define COMPACT_PARAMS_TAG_NAN 0x7ff84950
+
+enum ECompactParamWidth { kCompactDouble = 0, kCompact8, kCompact16, kCompact32 };
+
+static int GetCompactParamWidth(IParam* pParam, double v, int* pIdx)
 {
-  TRACE;
-  
-  WDL_MutexLock lock(&mMutex);
+  int idx = pParam->GetStepIndex(v);
+  *pIdx = idx;
+  if (idx < 0) {
+    return kCompactDouble;
+  }
+  return (idx <= 0xff ? kCompact8 : (idx <= 0xffff ? kCompact16 : kCompact32));
+}
+
+// pValues is one per param, or 0 for the current values.
+bool IPlugBase::PutCompactParams(ByteChunk* pChunk, const double* pValues)
+{
+  int i, n = mParams.GetSize(), nChanged = 0;
+  for (i = 0; i < n; ++i) {
+    IParam* pParam = mParams.Get(i);
+    nChanged += ((pValues ? pValues[i] : pParam->Value()) != pParam->GetDefault());
+  }
+
+  pChunk->Reserve(pChunk->Size() + SerializedParamsSize());
+  unsigned int tag = COMPACT_PARAMS_TAG, nan = COMPACT_PARAMS_TAG_NAN;
+  pChunk->Put(&tag);
+  pChunk->Put(&nan);
+  pChunk->Put(&n);
+
+  // The bitmap and the widths, filled in below.
+  int bitmapPos = pChunk->Size(), nBitmapBytes = (n + 7) / 8;
+  pChunk->Resize(bitmapPos + nBitmapBytes + (nChanged + 3) / 4);
+  BYTE* pBitmap = pChunk->GetBytes() + bitmapPos;
+  BYTE* pWidths = pBitmap + nBitmapBytes;
+  int c = 0, idx;
+  for (i = 0; i < n; ++i) {
+    IParam* pParam = mParams.Get(i);
+    double v = (pValues ? pValues[i] : pParam->Value());
+    if (v != pParam->GetDefault()) {
+      pBitmap[i >> 3] |= (1 << (i & 7));
+      pWidths[c >> 2] |= (GetCompactParamWidth(pParam, v, &idx) << ((c & 3) * 2));
+      ++c;
+    }
+  }
+
   bool savedOK = true;
-  int i, n = mParams.GetSize();
   for (i = 0; i < n && savedOK; ++i) {
     IParam* pParam = mParams.Get(i);
-    double v = pParam->Value();
-    savedOK &= (pChunk->Put(&v) > 0);
+    double v = (pValues ? pValues[i] : pParam->Value());
+    if (v != pParam->GetDefault()) {
+      switch (GetCompactParamWidth(pParam, v, &idx)) {
+        case kCompact8: {
+          unsigned char i8 = (unsigned char) idx;
+          savedOK = (pChunk->Put(&i8) > 0);
+          break;
+        }
+        case kCompact16: {
+          unsigned short i16 = (unsigned short) idx;
+          savedOK = (pChunk->Put(&i16) > 0);
+          break;
+        }
+        case kCompact32: {
+          unsigned int i32 = (unsigned int) idx;
+          savedOK = (pChunk->Put(&i32) > 0);
+          break;
+        }
+        default: {
+          savedOK = (pChunk->Put(&v) > 0);
+          break;
+        }
+      }
+    }
   }
   return savedOK;
 }
 
-int IPlugBase::UnserializeParams(ByteChunk* pChunk, int startPos)
+// startPos is just past the tag.  Params the state doesn't mention (it's from
+// a version of the plugin that had fewer) go back to their defaults.
+int IPlugBase::GetCompactParams(ByteChunkView* pChunk, int startPos)
+{
+  int n = 0, pos = pChunk->Get(&n, startPos);
+  if (pos < 0 || n < 0) {
+    return -1;
+  }
+  int i, nBitmapBytes = (n + 7) / 8, nChanged = 0;
+  if (pos + nBitmapBytes > pChunk->Size()) {
+    return -1;
+  }
+  const BYTE* pBitmap = pChunk->GetBytes() + pos;
+  for (i = 0; i < n; ++i) {
+    nChanged += ((pBitmap[i >> 3] >> (i & 7)) & 1);
+  }
+  const BYTE* pWidths = pBitmap + nBitmapBytes;
+  pos += nBitmapBytes + (nChanged + 3) / 4;
+  if (pos > pChunk->Size()) {
+    return -1;
+  }
+
+  int nParams = mParams.GetSize(), c = 0;
+  for (i = 0; i < n && pos >= 0; ++i) {
+    IParam* pParam = (i < nParams ? mParams.Get(i) : 0);
+    double v = (pParam ? pParam->GetDefault() : 0.0);
+    if ((pBitmap[i >> 3] >> (i & 7)) & 1) {
+      int idx = -1;
+      switch ((pWidths[c >> 2] >> ((c & 3) * 2)) & 3) {
+        case kCompact8: {
+          unsigned char i8 = 0;
+          pos = pChunk->Get(&i8, pos);
+          idx = i8;
+          break;
+        }
+        case kCompact16: {
+          unsigned short i16 = 0;
+          pos = pChunk->Get(&i16, pos);
+          idx = i16;
+          break;
+        }
+        case kCompact32: {
+          unsigned int i32 = 0;
+          pos = pChunk->Get(&i32, pos);
+          idx = (int) MIN(i32, 0x7fffffffU);
+          break;
+        }
+        default: {
+          pos = pChunk->Get(&v, pos);
+          break;
+        }
+      }
+      if (pos < 0) {
+        break;
+      }
+      if (pParam && idx >= 0) {
+        v = pParam->FromStepIndex(idx);
+      }
+      ++c;
+    }
+    if (pParam) {
+      Trace(TRACELOC, "%d %s", i, pParam->GetNameForHost());
+      pParam->Set(v);
+    }
+  }
+  for (i = n; i < nParams; ++i) {
+    IParam* pParam = mParams.Get(i);
+    pParam->Set(pParam->GetDefault());
+  }
+  return pos;
+}
+
+bool IPlugBase::SerializeParams(ByteChunk* pChunk)
 {
   TRACE;
   
   WDL_MutexLock lock(&mMutex);
-  int i, n = mParams.GetSize(), pos = startPos;
-  for (i = 0; i < n && pos >= 0; ++i) {
-    IParam* pParam = mParams.Get(i);
-    double v = 0.0;
-    Trace(TRACELOC, "%d %s", i, pParam->GetNameForHost());
-    pos = pChunk->Get(&v, pos);
-    pParam->Set(v);
+  return PutCompactParams(pChunk, 0);
+}
+
+int IPlugBase::UnserializeParams(ByteChunkView* pChunk, int startPos)
+{
+  TRACE;
+  
+  WDL_MutexLock lock(&mMutex);
+  unsigned int tag = 0, nan = 0;
+  int pos = pChunk->Get(&nan, pChunk->Get(&tag, startPos));
+  if (pos >= 0 && tag == COMPACT_PARAMS_TAG && nan == COMPACT_PARAMS_TAG_NAN) {
+    pos = GetCompactParams(pChunk, pos);
+  }
+  else {
+    int i, n = mParams.GetSize();
+    pos = startPos;
+    for (i = 0; i < n && pos >= 0; ++i) {
+      IParam* pParam = mParams.Get(i);
+      double v = 0.0;
+      Trace(TRACELOC, "%d %s", i, pParam->GetNameForHost());
+      pos = pChunk->Get(&v, pos);
+      pParam->Set(v);
+    }
   }
-  OnParamReset();
+  QueueParamReset();
   return pos;
 }
 
 void IPlugBase::RedrawParamControls()
 {
+#ifndef NO_IGRAPHICS
   if (mGraphics) {
     int i, n = mParams.GetSize();
     for (i = 0; i < n; ++i) {
@@ -668,6 +1054,7 @@ void IPlugBase::RedrawParamControls()
       mGraphics->SetParameterFromPlug(i, v, false);
     }
   }
+#endif
 }
 
 void IPlugBase::DumpPresetSrcCode(const char* filename, const char* paramEnumNames[])
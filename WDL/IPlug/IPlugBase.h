@@ -1,11 +1,15 @@
 #ifndef _IPLUGBASE_
 #define _IPLUGBASE_
 
-#define IPLUG_VERSION 0x010000
+// 0x010100: params are stored compactly, see IPlugBase::SerializeParams.
+#define IPLUG_VERSION 0x010100
 
 #include "Containers.h"
 #include "IPlugStructs.h"
 #include "IParam.h"
+#include "IPlugQueue.h"
+#include "IPlugPublish.h"
+#include "IPlugAllocAudit.h"
 #include "Hosts.h"
 #include "Log.h"
 
@@ -14,6 +18,21 @@
 
 #define MAX_EFFECT_NAME_LEN 128
 #define DEFAULT_BLOCK_SIZE 1024
+#define PARAM_CHANGE_QUEUE_SIZE 1024
+// Each of the three parameter queues can be full, so about this many changes can arrive in one block.
+#define PARAM_CHANGES_PER_BLOCK (3 * PARAM_CHANGE_QUEUE_SIZE)
+
+// Which thread is calling, for state that only the thread that set it may read.
+#ifdef _WIN32
+  typedef DWORD IThreadID;
+  inline IThreadID CurrentThreadID() { return GetCurrentThreadId(); }
+  inline bool SameThread(IThreadID a, IThreadID b) { return a == b; }
+#else
+  #include <pthread.h>
+  typedef pthread_t IThreadID;
+  inline IThreadID CurrentThreadID() { return pthread_self(); }
+  inline bool SameThread(IThreadID a, IThreadID b) { return pthread_equal(a, b) != 0; }
+#endif
 
 // All version ints are stored as 0xVVVVRRMM: V = version, R = revision, M = minor revision.
 
@@ -37,12 +56,21 @@ public:
 
   // Implementations should set a mutex lock like in the no-op!
 	virtual void Reset() { TRACE; IMutexLock lock(this); }
-	virtual void OnParamChange(int paramIdx) { IMutexLock lock(this); }
+  // Called on the audio thread before a block while the plugin is processing, otherwise on
+  // whichever thread changed the parameter, with the mutex held.  It never locks the mutex itself:
+  // changes reach the audio thread through the queue, so audio state must be updated from
+  // ProcessParamChange (the default just calls this), not under the lock.
+	virtual void OnParamChange(int paramIdx) {}
 	
 	// Default passthrough.  Inputs and outputs are [nChannel][nSample].
-  // Mutex is already locked.
+  // The mutex is NOT locked, parameter changes arrive via OnParamChange before the block.
 	virtual void ProcessDoubleReplacing(double** inputs, double** outputs, int nFrames);
 
+  // Optional native float path, only called if the plugin calls SetDoesSingleReplacing(true).
+  // Float hosts then hand their buffers straight through instead of converting to and from double.
+  // The default converts and calls ProcessDoubleReplacing.
+  virtual void ProcessSingleReplacing(float** inputs, float** outputs, int nFrames);
+
 	// In case the audio processing thread needs to do anything when the GUI opens
 	// (like for example, set some state dependent initial values for controls).
 	virtual void OnGUIOpen() { TRACE; }
@@ -59,12 +87,35 @@ public:
   virtual void OnActivate(bool active) { TRACE;  IMutexLock lock(this); }
     
 	virtual void ProcessMidiMsg(IMidiMsg* pMsg);
+  // A run of messages from the host's event list for the next block, in order.
+  // The default hands each one to ProcessMidiMsg, override to filter the run in one pass.
+  virtual void ProcessMidiMsgs(const IMidiMsg* pMsgs, int n);
 	virtual bool MidiNoteName(int noteNumber, char* rName) { *rName = '\0'; return false; }
 
+  // Audio thread to GUI.  Publish meter/LED values into plugin defined slots (0 to
+  // IPlugPublish::kMaxSlots - 1) instead of touching controls; the GUI's redraw timer
+  // calls OnPublishedValue, on the GUI thread, for each slot whose value changed.
+  void PublishValue(int slot, double value) { mPublished.Write(slot, value); }
+  virtual void OnPublishedValue(int slot, double value) {}
+  double GetPublishedValue(int slot) { return mPublished.Shown(slot); }   // GUI thread.
+  double ReadPublishedValue(int slot) { return mPublished.Read(slot); }   // Any thread, the newest value.
+  // GUI thread, after showing something else in place of a slot: pass on the next value even if it's the same.
+  void ForgetPublishedValue(int slot) { mPublished.Forget(slot); }
+  void PollPublishedValues();   // Called by IGraphics on its redraw timer.
+
+  // Called from the audio thread before each block, once for every queued parameter change.
+  // The param itself already holds the newest value, pChange has the value as of pChange->mOffset.
+  // The default applies everything at the start of the block.  To apply changes sample accurately,
+  // keep them (IParamQueue sorts by offset) and handle them while rendering, like MIDI.
+  virtual void ProcessParamChange(IParamChange* pChange) { OnParamChange(pChange->mIdx); }
+
   // Implementations should set a mutex lock.
 	virtual bool SerializeState(ByteChunk* pChunk) { return SerializeParams(pChunk); }
   // Return the new chunk position (endPos).
-	virtual int UnserializeState(ByteChunk* pChunk, int startPos) { return UnserializeParams(pChunk, startPos); }
+	virtual int UnserializeState(ByteChunkView* pChunk, int startPos) { return UnserializeParams(pChunk, startPos); }
+  // About how many bytes SerializeState will write, so the chunk can be sized once up front.
+  // Doesn't have to be exact, override along with SerializeState.
+  virtual int SerializedStateSize() { return SerializedParamsSize(); }
 
   // ----------------------------------------
   // Your plugin class, or a control class, can call these functions.
@@ -83,6 +134,12 @@ public:
   int GetMfrID() { return mMfrID; }
 
 	void SetParameterFromGUI(int idx, double normalizedValue);
+  // Sets the parameter now and gets OnParamChange called on the audio thread (or right away
+  // if the plugin isn't processing).  fromHost is for host automation, which doesn't hold the mutex,
+  // everyone else must hold it.  Each queue has a single producer: mutex holders, the audio thread,
+  // and host threads other than the audio thread, which take turns on a lock of their own.
+  // offset is where in the next block the change should land, if the host says.
+  void QueueParamChange(int idx, double normalizedValue, bool fromHost, int offset = 0);
   // If a parameter change comes from the GUI, midi, or external input,
   // the host needs to be informed in case the changes are being automated.
   virtual void BeginInformHostOfParamChange(int idx) = 0;
@@ -124,6 +181,8 @@ public:
   virtual void UserResizedWindow(IRECT* pR) {}
     
   void EnsureDefaultPreset();
+  // Writes the initialized presets out as a preset library, for MakePresetsFromLibrary.
+  bool DumpPresetLibrary(const char* filename);
   
 protected:
 
@@ -152,25 +211,39 @@ protected:
   virtual bool SendMidiMsgs(WDL_TypedBuf<IMidiMsg>* pMsgs) = 0;
   bool IsInst() { return mIsInst; }
     
-  void MakeDefaultPreset(char* name = 0, int nPresets = 1);
+  void MakeDefaultPreset(const char* name = 0, int nPresets = 1);
   // MakePreset(name, param1, param2, ..., paramN)
   void MakePreset(char* name, ...);
   // MakePresetFromNamedParams(name, nParamsNamed, paramEnum1, paramVal1, paramEnum2, paramVal2, ..., paramEnumN, paramVal2)
   // nParamsNamed may be less than the total number of params.
   void MakePresetFromNamedParams(char* name, int nParamsNamed, ...);
-  void MakePresetFromChunk(char* name, ByteChunk* pChunk);
+  void MakePresetFromChunk(char* name, ByteChunkView* pChunk);
+  // Fills the uninitialized presets from a library written by DumpPresetLibrary, shared
+  // with every other instance (see IPresetLibrary).  A relative filename is next to the
+  // plugin binary.  False if there's no library there for this plugin, make the presets in code then.
+  bool MakePresetsFromLibrary(const char* filename);
 
   bool DoesStateChunks() { return mStateChunks; }
+  // Call from the plugin constructor if ProcessSingleReplacing is implemented.
+  void SetDoesSingleReplacing(bool singleReplacing) { mSingleReplacing = singleReplacing; }
+  bool DoesSingleReplacing() { return mSingleReplacing; }
   // Will append if the chunk is already started.
   virtual bool SerializeParams(ByteChunk* pChunk);
   // Returns the new chunk position (endPos).
-  virtual int UnserializeParams(ByteChunk* pChunk, int startPos);
+  virtual int UnserializeParams(ByteChunkView* pChunk, int startPos);
+  int SerializedParamsSize() { int n = NParams(); return 12 + (n + 7) / 8 + (n + 3) / 4 + n * sizeof(double); }  // At most.
   void RedrawParamControls();  // Called after restoring state.
 
   // ----------------------------------------
   // Internal IPlug stuff (but API classes need to get at it).
   
   void OnParamReset();	// Calls OnParamChange(each param) + Reset().
+  void QueueParamReset();   // OnParamReset, deferred to the audio thread if processing.
+
+  // The API class brackets the time the host may be calling the process functions.
+  // Queued changes are applied at both transitions.
+  void SetProcessing(bool processing);
+  bool IsProcessing() { return mProcessing; }
 
   int NPresets() { return mPresets.GetSize(); }
   int GetCurrentPresetIdx() { return mCurrentPresetIdx; }
@@ -181,7 +254,8 @@ protected:
   void ModifyCurrentPreset(const char* name = 0);     // Sets the currently active preset to whatever current params are.
   virtual bool SerializePresets(ByteChunk* pChunk);
   // Returns the new chunk position (endPos).
-  virtual int UnserializePresets(ByteChunk* pChunk, int startPos);
+  virtual int UnserializePresets(ByteChunkView* pChunk, int startPos);
+  int SerializedPresetsSize();
 
   // Dump the current state as source code for a call to MakePresetFromNamedParams.
   void DumpPresetSrcCode(const char* filename, const char* paramEnumNames[]);
@@ -199,10 +273,16 @@ protected:
   void ProcessBuffers(float sampleType, int nFrames);
   void ProcessBuffers(double sampleType, int nFrames);
   void ProcessBuffersAccumulating(float sampleType, int nFrames); 
+  void ProcessParamChanges(int nFrames);   // Audio thread, before each block.
+
+  // True on the thread the plugin last processed a block on.  Host calls made there (automation,
+  // MIDI in) come between blocks, so they can hand things to the next one without locking.
+  bool OnAudioThread() { return mHasAudioThread && SameThread(mAudioThread, CurrentThreadID()); }
 
  	WDL_PtrList<IParam> mParams;
 
-  WDL_PtrList<IPreset> mPresets;
+  IPresetBank mPresets;
+  ByteChunk mPresetChunk;   // Scratch for building presets, the bank keeps its own copy.
   int mCurrentPresetIdx;
 
 public:
@@ -225,26 +305,43 @@ private:
   EHost mHost;
   int mHostVersion;   //  Version stored as 0xVVVVRRMM: V = version, R = revision, M = minor revision.
 
-  bool mStateChunks, mIsInst;
+  bool mStateChunks, mIsInst, mSingleReplacing;
   double mSampleRate;
   int mBlockSize, mLatency;
 
 	IGraphics* mGraphics;
 
   WDL_TypedBuf<double*> mInData, mOutData;
+  WDL_TypedBuf<float*> mInFData, mOutFData;   // Only used if mSingleReplacing.
   struct InChannel {
     bool mConnected;
     double** mSrc;   // Points into mInData.
+    float** mFSrc;   // Points into mInFData.
     WDL_TypedBuf<double> mScratchBuf;
+    WDL_TypedBuf<float> mFScratchBuf;
   };
   struct OutChannel {
     bool mConnected;
     double** mDest;  // Points into mOutData.
+    float** mFOut;   // Points into mOutFData.
     float* mFDest;
     WDL_TypedBuf<double> mScratchBuf;
+    WDL_TypedBuf<float> mFScratchBuf;
   };
   WDL_PtrList<InChannel> mInChannels;
   WDL_PtrList<OutChannel> mOutChannels;
+
+  IPlugQueue<IParamChange> mUIParamChanges, mHostParamChanges, mAudioParamChanges;
+  WDL_Mutex mHostParamMutex;   // Taken to push to mHostParamChanges.
+  void PushParamChange(IParamChange* pChange, bool fromHost);
+  WDL_TypedBuf<IParamChange> mParamChangeBuf;   // Drained into here, audio thread only.
+  volatile bool mProcessing, mParamResetPending;
+  IThreadID mAudioThread;
+  volatile bool mHasAudioThread;
+  IPlugPublish mPublished;
+
+  bool PutCompactParams(ByteChunk* pChunk, const double* pValues);
+  int GetCompactParams(ByteChunkView* pChunk, int startPos);
 };
 
 #endif
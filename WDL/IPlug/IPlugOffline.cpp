@@ -0,0 +1,92 @@
+#include "IPlugOffline.h"
+
+IPlugOffline::IPlugOffline(IPlugInstanceInfo instanceInfo, int nParams, const char* channelIOStr, int nPresets,
+  const char* effectName, const char* productName, const char* mfrName,
+  int vendorVersion, int uniqueID, int mfrID, int latency,
+  bool plugDoesMidi, bool plugDoesChunks, bool plugIsInst)
+: IPlugBase(nParams, channelIOStr, nPresets, effectName, productName, mfrName,
+    vendorVersion, uniqueID, mfrID, latency,
+    plugDoesMidi, plugDoesChunks, plugIsInst),
+  mActive(false), mSamplePos(0), mTempo(120.0), mTimeSigNum(4), mTimeSigDenom(4)
+{
+  Trace(TRACELOC, "%s", effectName);
+
+  SetInputChannelConnections(0, NInChannels(), true);
+  SetOutputChannelConnections(0, NOutChannels(), true);
+
+  SetBlockSize(DEFAULT_BLOCK_SIZE);
+  SetHost("offline", 0);
+}
+
+bool IPlugOffline::Activate(double sampleRate, int blockSize, int nIn, int nOut)
+{
+  TRACE;
+  if (!LegalIO(nIn, nOut)) {
+    return false;
+  }
+  IMutexLock lock(this);
+  if (mActive) {
+    Deactivate();
+  }
+
+  SetSampleRate(sampleRate);
+  SetBlockSize(blockSize);
+  SetInputChannelConnections(0, nIn, true);
+  SetInputChannelConnections(nIn, NInChannels() - nIn, false);
+  SetOutputChannelConnections(0, nOut, true);
+  SetOutputChannelConnections(nOut, NOutChannels() - nOut, false);
+  mSamplePos = 0;
+
+  Reset();
+  OnActivate(true);
+  SetProcessing(true);
+  mActive = true;
+  return true;
+}
+
+void IPlugOffline::Deactivate()
+{
+  TRACE;
+  IMutexLock lock(this);
+  if (mActive) {
+    mActive = false;
+    SetProcessing(false);
+    OnActivate(false);
+  }
+}
+
+void IPlugOffline::SetParameter(int idx, double normalizedValue, int offset)
+{
+  if (idx >= 0 && idx < NParams()) {
+    QueueParamChange(idx, normalizedValue, true, offset);
+  }
+}
+
+void IPlugOffline::Process(double** inputs, double** outputs, int nFrames)
+{
+  AttachInputBuffers(0, NInChannels(), inputs, nFrames);
+  AttachOutputBuffers(0, NOutChannels(), outputs);
+  ProcessBuffers((double) 0.0, nFrames);
+  mSamplePos += nFrames;
+}
+
+void IPlugOffline::Process(float** inputs, float** outputs, int nFrames)
+{
+  AttachInputBuffers(0, NInChannels(), inputs, nFrames);
+  AttachOutputBuffers(0, NOutChannels(), outputs);
+  ProcessBuffers((float) 0.0f, nFrames);
+  mSamplePos += nFrames;
+}
+
+void IPlugOffline::SetTempo(double tempo, int num, int denom)
+{
+  mTempo = tempo;
+  mTimeSigNum = num;
+  mTimeSigDenom = denom;
+}
+
+void IPlugOffline::GetTimeSig(int* pNum, int* pDenom)
+{
+  *pNum = mTimeSigNum;
+  *pDenom = mTimeSigDenom;
+}
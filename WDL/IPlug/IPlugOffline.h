@@ -0,0 +1,79 @@
+#ifndef _IPLUGAPI_
+#define _IPLUGAPI_
+// Only load one API class!
+
+#include "IPlugBase.h"
+
+struct IPlugInstanceInfo
+{
+  // Nothing to pass in, whoever calls MakePlug is the host.
+};
+
+// Runs a plugin in process with no DAW around it (batch rendering, tests, benchmarks).
+// The caller plays the host: Activate, then for each block queue MIDI and parameter
+// changes and call Process, then Deactivate.  Like any host it must not call Process
+// from more than one thread at a time; use one instance per thread.
+class IPlugOffline : public IPlugBase
+{
+public:
+
+  // Use IPLUG_CTOR instead of calling directly (defined in IPlug_include_in_plug_src.h).
+  IPlugOffline(IPlugInstanceInfo instanceInfo, int nParams, const char* channelIOStr, int nPresets,
+    const char* effectName, const char* productName, const char* mfrName,
+    int vendorVersion, int uniqueID, int mfrID, int latency = 0,
+    bool plugDoesMidi = false, bool plugDoesChunks = false,
+    bool plugIsInst = false);
+
+  // ----------------------------------------
+  // Host side.
+
+  // Connects the first nIn inputs and nOut outputs, returns false if the plugin doesn't support that.
+  // blockSize is the most frames any Process call will be given.
+  bool Activate(double sampleRate, int blockSize, int nIn, int nOut);
+  void Deactivate();
+
+  // Both take effect in the next Process call, offset is relative to its start.
+  void SendMidi(IMidiMsg* pMsg) { IPLUG_AUDIT_SCOPE; ProcessMidiMsg(pMsg); }
+  void SendMidi(const IMidiMsg* pMsgs, int n) { IPLUG_AUDIT_SCOPE; ProcessMidiMsgs(pMsgs, n); }
+  void SetParameter(int idx, double normalizedValue, int offset = 0);
+
+  // One buffer per connected channel.  Advances the sample position by nFrames.
+  void Process(double** inputs, double** outputs, int nFrames);
+  void Process(float** inputs, float** outputs, int nFrames);
+
+  void SetSamplePos(int samplePos) { mSamplePos = samplePos; }
+  void SetTempo(double tempo, int num = 4, int denom = 4);
+
+  // ----------------------------------------
+  // See IPlugBase for the full list of methods that your plugin class can implement.
+
+  void BeginInformHostOfParamChange(int idx) {}
+  void InformHostOfParamChange(int idx, double normalizedValue) {}
+  void EndInformHostOfParamChange(int idx) {}
+
+  void InformHostOfProgramChange() {}
+
+  int GetSamplePos() { return mSamplePos; }   // Samples since Activate (or SetSamplePos).
+  double GetTempo() { return mTempo; }
+  void GetTimeSig(int* pNum, int* pDenom);
+
+  void ResizeGraphics(int w, int h) {}
+
+protected:
+
+  void HostSpecificInit() {}
+  // There's nowhere for MIDI output to go, it's dropped.
+  bool SendMidiMsg(IMidiMsg* pMsg) { return false; }
+  bool SendMidiMsgs(WDL_TypedBuf<IMidiMsg>* pMsgs) { return false; }
+
+private:
+
+  bool mActive;
+  int mSamplePos;
+  double mTempo;
+  int mTimeSigNum, mTimeSigDenom;
+};
+
+IPlugOffline* MakePlug();
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef _IPLUGPUBLISH_
+#define _IPLUGPUBLISH_
+
+// Newest-value slots for showing audio thread state in the GUI (meters, LEDs,
+// what a control is listening to).  The audio thread writes, the GUI thread
+// polls on its redraw timer.  Neither side ever blocks or allocates, and the
+// writer never touches a control.
+//
+// Unlike IPlugQueue nothing is kept but the latest value: the GUI only draws
+// at its frame rate, so anything published between two polls would never have
+// been seen anyway.  Each slot is a seqlock, so a double (or anything else that
+// isn't written atomically) is never read half updated.
+//
+// One thread writes at a time, one thread polls, any thread may Read.
+
+#include "IPlugAtomic.h"
+
+class IPlugPublish
+{
+public:
+
+  enum { kMaxSlots = 16 };
+
+  IPlugPublish()
+  {
+    for (int i = 0; i < kMaxSlots; ++i) {
+      Slot* pSlot = mSlots + i;
+      pSlot->mSeq = pSlot->mSeen = 0;
+      pSlot->mValue = pSlot->mShown = 0.0;
+      pSlot->mHasShown = false;
+    }
+  }
+
+  // Writer side.  The count is odd while the value is being written.
+  void Write(int slot, double value)
+  {
+    Slot* pSlot = mSlots + slot;
+    unsigned seq = pSlot->mSeq | 1;
+    pSlot->mSeq = seq;
+    IPLUG_MEMORY_BARRIER();   // Readers have to see the odd count before any of the new value.
+    pSlot->mValue = value;
+    IPLUG_MEMORY_BARRIER();
+    pSlot->mSeq = seq + 1;
+  }
+
+  // Reader side.  True if the slot holds a value other than the one last
+  // returned, which is copied to *pValue.  A slot caught mid write is left
+  // for the next poll rather than spun on.
+  bool Poll(int slot, double* pValue)
+  {
+    Slot* pSlot = mSlots + slot;
+    unsigned seq = pSlot->mSeq;
+    if (seq == pSlot->mSeen || (seq & 1)) {
+      return false;
+    }
+    IPLUG_MEMORY_BARRIER();
+    double value = pSlot->mValue;
+    IPLUG_MEMORY_BARRIER();
+    if (pSlot->mSeq != seq) {
+      return false;
+    }
+    pSlot->mSeen = seq;
+    if (pSlot->mHasShown && value == pSlot->mShown) {
+      return false;
+    }
+    pSlot->mShown = *pValue = value;
+    pSlot->mHasShown = true;
+    return true;
+  }
+
+  // Any thread.  The newest value, without touching what Poll has shown.  Waits
+  // out a write in progress, which is only ever a few instructions long.
+  double Read(int slot) const
+  {
+    const Slot* pSlot = mSlots + slot;
+    for (;;) {
+      unsigned seq = pSlot->mSeq;
+      if (!(seq & 1)) {
+        IPLUG_MEMORY_BARRIER();
+        double value = pSlot->mValue;
+        IPLUG_MEMORY_BARRIER();
+        if (pSlot->mSeq == seq) {
+          return value;
+        }
+      }
+    }
+  }
+
+  // Reader side.  The value Poll last returned.
+  double Shown(int slot) const { return mSlots[slot].mShown; }
+
+  // Reader side.  The next value written is returned by Poll even if it's the
+  // one already shown, for when the reader has drawn something else over it.
+  void Forget(int slot) { mSlots[slot].mHasShown = false; }
+
+private:
+
+  struct Slot
+  {
+    // Writer.
+    volatile unsigned mSeq;
+    volatile double mValue;
+    // Reader only.
+    unsigned mSeen;
+    double mShown;
+    bool mHasShown;
+  };
+
+  Slot mSlots[kMaxSlots];
+};
+
+#endif
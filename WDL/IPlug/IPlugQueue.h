@@ -0,0 +1,78 @@
+#ifndef _IPLUGQUEUE_
+#define _IPLUGQUEUE_
+
+// Lock-free, fixed capacity FIFO for handing small structs from exactly one
+// producer thread to exactly one consumer thread, for example parameter
+// changes from the GUI to the audio thread.  Neither side ever blocks or
+// allocates; Push fails if the queue is full and the caller decides what to do.
+//
+// If more than one thread needs to push, they must serialize among themselves
+// (or use a queue each).  The consumer never needs a lock.
+
+#include "Containers.h"
+#include "IPlugAtomic.h"
+
+template <class T> class IPlugQueue
+{
+public:
+
+  // Capacity is rounded up to a power of 2.
+  IPlugQueue(int capacity)
+  : mRead(0), mWrite(0)
+  {
+    int size = 1;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    mBuf.Resize(size);
+    mMask = size - 1;
+  }
+
+  ~IPlugQueue() {}
+
+  // Producer side.
+  bool Push(const T* pItem)
+  {
+    int w = mWrite;
+    if (w - mRead > mMask) {
+      return false;
+    }
+    mBuf.Get()[w & mMask] = *pItem;
+    IPLUG_MEMORY_BARRIER();   // The item has to be visible before the new write index is.
+    mWrite = w + 1;
+    return true;
+  }
+
+  // Consumer side.  Copies out up to maxItems, returns how many.
+  int Pop(T* pItems, int maxItems)
+  {
+    int r = mRead, n = MIN(mWrite - r, maxItems);
+    IPLUG_MEMORY_BARRIER();   // Don't read items before the write index that published them.
+    const T* pBuf = mBuf.Get();
+    for (int i = 0; i < n; ++i, ++r) {
+      pItems[i] = pBuf[r & mMask];
+    }
+    IPLUG_MEMORY_BARRIER();   // Finish reading the slots before handing them back to the producer.
+    mRead = r;
+    return n;
+  }
+
+  // Consumer side.  Throws away everything currently queued.
+  void Clear()
+  {
+    mRead = mWrite;
+  }
+
+  // Either side, only a hint since the other side may be moving.
+  bool Empty() const { return mRead == mWrite; }
+  int Capacity() const { return mMask + 1; }
+
+private:
+
+  WDL_TypedBuf<T> mBuf;
+  int mMask;
+  // Free running counters, only the producer writes mWrite and only the consumer writes mRead.
+  volatile int mRead, mWrite;
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include "IPlugStructs.h"
 #include "Log.h"
+#include "../fileread.h"
 
 //bool IText::operator==(const IText& rhs) const
 //{
@@ -144,4 +145,408 @@ void IMidiMsg::LogMsg()
 #ifdef TRACER_BUILD
   Trace(TRACELOC, "midi:(%s:%d:%d)", StatusMsgStr(StatusMsg()), NoteNumber(), Velocity());
 #endif
-}
\ No newline at end of file
+}
+
+// FNV-1a.
+static unsigned int HashBytes(const BYTE* pData, int size)
+{
+  unsigned int h = 2166136261U;
+  for (int i = 0; i < size; ++i) {
+    h = (h ^ pData[i]) * 16777619U;
+  }
+  return h;
+}
+
+static WDL_PtrList<IPresetBlob> sPresetBlobs;   // Sorted by IPresetBlob::Compare.
+static WDL_Mutex sPresetBlobsMutex;             // Instances can be made on any thread.
+
+IPresetBlob::IPresetBlob(ByteChunkView* pChunk, unsigned int hash, bool copy)
+: mSize(pChunk->Size()), mRefs(1), mHash(hash), mOwned(copy)
+{
+  if (copy) {
+    mData = (BYTE*) malloc(MAX(mSize, 1));
+    memcpy(mData, pChunk->GetBytes(), mSize);
+  }
+  else {
+    mData = (BYTE*) pChunk->GetBytes();
+  }
+}
+
+IPresetBlob::~IPresetBlob()
+{
+  if (mOwned) {
+    free(mData);
+  }
+}
+
+int IPresetBlob::Compare(const IPresetBlob** ppA, const IPresetBlob** ppB)
+{
+  const IPresetBlob* pA = *ppA;
+  const IPresetBlob* pB = *ppB;
+  if (pA->mHash != pB->mHash) {
+    return (pA->mHash < pB->mHash ? -1 : 1);
+  }
+  if (pA->mSize != pB->mSize) {
+    return (pA->mSize < pB->mSize ? -1 : 1);
+  }
+  return memcmp(pA->mData, pB->mData, pA->mSize);
+}
+
+IPresetBlob* IPresetBlob::Get(ByteChunkView* pChunk)
+{
+  return Find(pChunk, true);
+}
+
+IPresetBlob* IPresetBlob::GetMapped(ByteChunkView* pChunk)
+{
+  return Find(pChunk, false);
+}
+
+IPresetBlob* IPresetBlob::AddRef(IPresetBlob* pBlob)
+{
+  if (pBlob) {
+    WDL_MutexLock lock(&sPresetBlobsMutex);
+    ++(pBlob->mRefs);
+  }
+  return pBlob;
+}
+
+IPresetBlob* IPresetBlob::Find(ByteChunkView* pChunk, bool copy)
+{
+  // A stand-in to search with, it borrows the chunk's bytes.
+  IPresetBlob key;
+  key.mData = (BYTE*) pChunk->GetBytes();
+  key.mSize = pChunk->Size();
+  key.mHash = HashBytes(key.mData, key.mSize);
+
+  WDL_MutexLock lock(&sPresetBlobsMutex);
+  IPresetBlob* pBlob = sPresetBlobs.Get(sPresetBlobs.FindSorted(&key, Compare));
+  if (pBlob) {
+    ++(pBlob->mRefs);
+  }
+  else {
+    pBlob = new IPresetBlob(pChunk, key.mHash, copy);
+    sPresetBlobs.InsertSorted(pBlob, Compare);
+  }
+  return pBlob;
+}
+
+void IPresetBlob::Release(IPresetBlob* pBlob)
+{
+  if (pBlob) {
+    WDL_MutexLock lock(&sPresetBlobsMutex);
+    if (!--(pBlob->mRefs)) {
+      sPresetBlobs.Delete(sPresetBlobs.FindSorted(pBlob, Compare));
+      delete pBlob;
+    }
+  }
+}
+
+IPresetBank::IPresetBank(int nPresets)
+: mFirstUninitialized(0), mNDefaultUserNames(0)
+{
+  for (int i = 0; i < nPresets; ++i) {
+    mPresets.Add(new IPreset(i));
+  }
+  Reindex();
+}
+
+IPresetBank::~IPresetBank()
+{
+  int n = mPresets.GetSize();
+  for (int i = 0; i < n; ++i) {
+    IPresetBlob::Release(mPresets.Get(i)->mBlob);
+  }
+  mPresets.Empty(true);
+}
+
+int IPresetBank::Find(const char* name)
+{
+  if (!name) {
+    return -1;
+  }
+  unsigned int hash = HashBytes((const BYTE*) name, strlen(name));
+  int* pIndex = mIndex.Get();
+  int found = -1, mask = mIndex.GetSize() - 1;
+  for (int i = hash & mask; pIndex[i] >= 0; i = (i + 1) & mask) {
+    IPreset* pPreset = mPresets.Get(pIndex[i]);
+    if (pPreset->mNameHash == hash && !strcmp(pPreset->mName, name) && (found < 0 || pIndex[i] < found)) {
+      found = pIndex[i];
+    }
+  }
+  return found;
+}
+
+int IPresetBank::NextUninitialized()
+{
+  int n = mPresets.GetSize();
+  while (mFirstUninitialized < n && mPresets.Get(mFirstUninitialized)->mInitialized) {
+    ++mFirstUninitialized;
+  }
+  return (mFirstUninitialized < n ? mFirstUninitialized : -1);
+}
+
+void IPresetBank::Set(int idx, const char* name, ByteChunkView* pChunk)
+{
+  if (mPresets.Get(idx)) {
+    SetBlob(idx, name, (pChunk ? IPresetBlob::Get(pChunk) : 0));
+  }
+}
+
+void IPresetBank::SetShared(int idx, const char* name, IPresetBlob* pBlob)
+{
+  if (mPresets.Get(idx)) {
+    SetBlob(idx, name, IPresetBlob::AddRef(pBlob));
+  }
+}
+
+void IPresetBank::SetBlob(int idx, const char* name, IPresetBlob* pBlob)
+{
+  IPreset* pPreset = mPresets.Get(idx);
+  if (pPreset) {
+    SetName(idx, name);
+    IPresetBlob::Release(pPreset->mBlob);
+    pPreset->mBlob = pBlob;
+    pPreset->mInitialized = (pBlob != 0);
+    if (!pBlob) {
+      mFirstUninitialized = MIN(mFirstUninitialized, idx);
+    }
+  }
+}
+
+void IPresetBank::SetName(int idx, const char* name)
+{
+  IPreset* pPreset = mPresets.Get(idx);
+  if (pPreset && name && strcmp(pPreset->mName, name)) {
+    IndexRemove(idx);
+    strncpy(pPreset->mName, name, MAX_PRESET_NAME_LEN - 1);
+    pPreset->mName[MAX_PRESET_NAME_LEN - 1] = '\0';
+    IndexAdd(idx);
+  }
+}
+
+void IPresetBank::Add()
+{
+  mPresets.Add(new IPreset(mPresets.GetSize()));
+  if (mPresets.GetSize() * 2 > mIndex.GetSize()) {
+    Reindex();
+  }
+  else {
+    IndexAdd(mPresets.GetSize() - 1);
+  }
+}
+
+void IPresetBank::PruneUninitialized()
+{
+  int i = 0;
+  while (i < mPresets.GetSize()) {
+    if (mPresets.Get(i)->mInitialized) {
+      ++i;
+    }
+    else {
+      mPresets.Delete(i, true);
+    }
+  }
+  Reindex();
+}
+
+void IPresetBank::IndexAdd(int idx)
+{
+  IPreset* pPreset = mPresets.Get(idx);
+  pPreset->mNameHash = HashBytes((const BYTE*) pPreset->mName, strlen(pPreset->mName));
+  mNDefaultUserNames += (strstr(pPreset->mName, DEFAULT_USER_PRESET_NAME) != 0);
+  int* pIndex = mIndex.Get();
+  int i, mask = mIndex.GetSize() - 1;
+  for (i = pPreset->mNameHash & mask; pIndex[i] >= 0; i = (i + 1) & mask) {
+    ;
+  }
+  pIndex[i] = idx;
+}
+
+void IPresetBank::IndexRemove(int idx)
+{
+  IPreset* pPreset = mPresets.Get(idx);
+  mNDefaultUserNames -= (strstr(pPreset->mName, DEFAULT_USER_PRESET_NAME) != 0);
+  int* pIndex = mIndex.Get();
+  int i, mask = mIndex.GetSize() - 1;
+  for (i = pPreset->mNameHash & mask; pIndex[i] != idx; i = (i + 1) & mask) {
+    if (pIndex[i] < 0) {
+      return;
+    }
+  }
+  // Shift later entries back into the hole, so lookups never have to step over deleted ones.
+  for (int j = (i + 1) & mask; pIndex[j] >= 0; j = (j + 1) & mask) {
+    int home = mPresets.Get(pIndex[j])->mNameHash & mask;
+    bool stays = (i <= j ? (i < home && home <= j) : (i < home || home <= j));
+    if (!stays) {
+      pIndex[i] = pIndex[j];
+      i = j;
+    }
+  }
+  pIndex[i] = -1;
+}
+
+void IPresetBank::Reindex()
+{
+  int i, n = mPresets.GetSize(), size = 16;
+  while (size < n * 2) {
+    size *= 2;
+  }
+  mIndex.Resize(size);
+  for (i = 0; i < size; ++i) {
+    mIndex.Get()[i] = -1;
+  }
+  mNDefaultUserNames = 0;
+  mFirstUninitialized = 0;
+  for (i = 0; i < n; ++i) {
+    IndexAdd(i);
+  }
+}
+
+#define PRESET_LIBRARY_TAG 'ipl1'
+
+static WDL_PtrList<IPresetLibrary> sPresetLibraries;
+static WDL_Mutex sPresetLibrariesMutex;
+static bool sPresetLibrariesEnabled = true;
+
+// Unmaps the libraries when the plugin is unloaded.  Blobs are shared by
+// content, so one library's can point into another's mapping: let go of all of
+// them before unmapping any.
+static struct IPresetLibraries
+{
+  ~IPresetLibraries()
+  {
+    int i, n = sPresetLibraries.GetSize();
+    for (i = 0; i < n; ++i) {
+      sPresetLibraries.Get(i)->ReleasePresets();
+    }
+    sPresetLibraries.Empty(true);
+  }
+} sPresetLibrariesCleanup;
+
+IPresetLibrary::IPresetLibrary(const char* filename, int uniqueID)
+: mFilename(filename), mUniqueID(uniqueID), mFile(0) {}
+
+IPresetLibrary::~IPresetLibrary()
+{
+  ReleasePresets();
+  delete mFile;
+}
+
+void IPresetLibrary::ReleasePresets()
+{
+  int n = mPresets.GetSize();
+  for (int i = 0; i < n; ++i) {
+    IPresetBlob::Release(mPresets.Get()[i].mBlob);
+  }
+  mPresets.Resize(0);
+}
+
+IPresetLibrary* IPresetLibrary::Get(const char* filename, int uniqueID)
+{
+  WDL_MutexLock lock(&sPresetLibrariesMutex);
+  if (!sPresetLibrariesEnabled) {
+    return 0;
+  }
+  IPresetLibrary* pLibrary = 0;
+  int n = sPresetLibraries.GetSize();
+  for (int i = 0; i < n && !pLibrary; ++i) {
+    IPresetLibrary* pCached = sPresetLibraries.Get(i);
+    if (pCached->mUniqueID == uniqueID && !strcmp(pCached->mFilename.Get(), filename)) {
+      pLibrary = pCached;
+    }
+  }
+  if (!pLibrary) {
+    pLibrary = new IPresetLibrary(filename, uniqueID);
+    pLibrary->Load();
+    sPresetLibraries.Add(pLibrary);
+  }
+  return (pLibrary->mFile ? pLibrary : 0);
+}
+
+void IPresetLibrary::SetEnabled(bool enabled)
+{
+  WDL_MutexLock lock(&sPresetLibrariesMutex);
+  sPresetLibrariesEnabled = enabled;
+}
+
+bool IPresetLibrary::Load()
+{
+  // Mapped whatever the size, where it can't be WDL_FileRead reads it all into memory.
+  mFile = new WDL_FileRead(mFilename.Get(), 0, 0, 0, 0, 0x7fffffff);
+  int size = (mFile->IsOpen() ? (int) mFile->GetSize() : 0);
+  const BYTE* pData = (size > 0 ? (const BYTE*) mFile->GetMappedView(0, &size) : 0);
+  ByteChunkView chunk(pData, size);
+
+  int tag = 0, uniqueID = 0, n = 0;
+  int pos = chunk.Get(&tag, 0);
+  pos = chunk.Get(&uniqueID, pos);
+  pos = chunk.Get(&n, pos);
+  bool loadedOK = (pos >= 0 && tag == PRESET_LIBRARY_TAG && uniqueID == mUniqueID);
+
+  for (int i = 0; i < n && loadedOK; ++i) {
+    int nameLen = 0, paramsSize = 0;
+    pos = chunk.Get(&nameLen, pos);
+    const char* name = (const char*) pData + pos;
+    loadedOK = (pos >= 0 && nameLen > 0 && nameLen <= size - pos && !name[nameLen - 1]);
+    if (loadedOK) {
+      pos = chunk.Get(&paramsSize, pos + nameLen);
+      loadedOK = (pos >= 0 && paramsSize >= 0 && paramsSize <= size - pos);
+    }
+    if (loadedOK) {
+      ByteChunkView params(pData + pos, paramsSize);
+      Entry entry = { name, IPresetBlob::GetMapped(&params) };
+      mPresets.Add(entry);
+      pos += paramsSize;
+    }
+  }
+
+  if (!loadedOK) {
+    ReleasePresets();
+    DELETE_NULL(mFile);
+  }
+  return loadedOK;
+}
+
+bool IPresetLibrary::Write(const char* filename, int uniqueID, IPresetBank* pBank)
+{
+  ByteChunk chunk;
+  int tag = PRESET_LIBRARY_TAG, i, n = pBank->GetSize(), nInitialized = 0;
+  for (i = 0; i < n; ++i) {
+    nInitialized += (pBank->Get(i)->mInitialized ? 1 : 0);
+  }
+  chunk.Put(&tag);
+  chunk.Put(&uniqueID);
+  chunk.Put(&nInitialized);
+  for (i = 0; i < n; ++i) {
+    IPreset* pPreset = pBank->Get(i);
+    if (pPreset->mInitialized) {
+      int nameLen = strlen(pPreset->mName) + 1;
+      ByteChunkView params = pPreset->mBlob->GetChunk();
+      int paramsSize = params.Size();
+      chunk.Put(&nameLen);
+      chunk.PutBytes(pPreset->mName, nameLen);
+      chunk.Put(&paramsSize);
+      chunk.PutChunk(&params);
+    }
+  }
+
+  // Written alongside and renamed over, the old file may be mapped by this very process.
+  WDL_String tmpFilename(filename);
+  tmpFilename.Append(".tmp");
+  FILE* fp = fopen(tmpFilename.Get(), "wb");
+  bool savedOK = (fp && fwrite(chunk.GetBytes(), 1, chunk.Size(), fp) == (size_t) chunk.Size());
+  if (fp) {
+    savedOK &= !fclose(fp);
+  }
+#ifdef _WIN32
+  if (savedOK) {
+    remove(filename);
+  }
+#endif
+  savedOK = (savedOK && !rename(tmpFilename.Get(), filename));
+  if (!savedOK) {
+    remove(tmpFilename.Get());
+  }
+  return savedOK;
+}
@@ -3,9 +3,15 @@
 
 #include "Containers.h"
 
-// The order is important here, so 1st include swell.h, then lice_text.h.
-#include "../swell/swell.h"
-#include "../lice/lice_text.h"
+class WDL_FileRead;
+
+#ifdef NO_IGRAPHICS
+  class LICE_IFont;   // Only ever cached by IGraphics.
+#else
+  // The order is important here, so 1st include swell.h, then lice_text.h.
+  #include "../swell/swell.h"
+  #include "../lice/lice_text.h"
+#endif
 
 // Abstracting the graphics made it easy to go ahead and abstract the OS ... 
 // the cost is this crap redefining some basic stuff.
@@ -274,22 +280,108 @@ struct IMidiMsg
   void LogMsg();
 };
 
+// A parameter change on its way from the GUI or host to the audio thread.
+struct IParamChange
+{
+  int mOffset;      // Sample offset into the block it takes effect in.
+  int mIdx;
+  double mValue;    // Normalized.
+};
+
 const int MAX_PRESET_NAME_LEN = 256;
 #define UNUSED_PRESET_NAME "empty"
+#define DEFAULT_USER_PRESET_NAME "user preset"
+
+// A preset's params as SerializeParams wrote them, never changed once made.
+// Blobs are shared by content across every plugin instance in the process, so a
+// factory bank is only stored once however many instances make it.
+class IPresetBlob
+{
+public:
+
+  // The blob holding a copy of pChunk, with a reference for the caller.
+  static IPresetBlob* Get(ByteChunkView* pChunk);
+  // The same, except a new blob points at pChunk's bytes instead of copying
+  // them, so they must outlive it (IPresetLibrary's mapped file does).
+  static IPresetBlob* GetMapped(ByteChunkView* pChunk);
+  // Another reference to pBlob.
+  static IPresetBlob* AddRef(IPresetBlob* pBlob);
+  static void Release(IPresetBlob* pBlob);
+
+  ByteChunkView GetChunk() const { return ByteChunkView(mData, mSize); }
+  int Size() const { return mSize; }
+
+private:
+
+  IPresetBlob() : mData(0), mSize(0), mRefs(0), mHash(0), mOwned(false) {}
+  IPresetBlob(ByteChunkView* pChunk, unsigned int hash, bool copy);
+  ~IPresetBlob();
+  friend class WDL_PtrList<IPresetBlob>;
+  static IPresetBlob* Find(ByteChunkView* pChunk, bool copy);
+  static int Compare(const IPresetBlob** ppA, const IPresetBlob** ppB);
+
+  BYTE* mData;
+  int mSize, mRefs;
+  unsigned int mHash;
+  bool mOwned;
+};
 
 struct IPreset
 {
   bool mInitialized;
   char mName[MAX_PRESET_NAME_LEN];
-  ByteChunk mChunk;
+  IPresetBlob* mBlob;   // 0 until initialized, restoring unserializes from it.
+  unsigned int mNameHash;
 
   IPreset(int idx)
-  : mInitialized(false)
+  : mInitialized(false), mBlob(0)
   {
     sprintf(mName, "- %d -", idx+1);
   }
 };
 
+// The plugin's presets, indexed so that finding one by name, finding the next
+// uninitialized one and naming a new user preset don't scan the whole bank.
+// Change presets only through here so the index stays right.
+class IPresetBank
+{
+public:
+
+  IPresetBank(int nPresets);
+  ~IPresetBank();
+
+  int GetSize() { return mPresets.GetSize(); }
+  IPreset* Get(int idx) { return mPresets.Get(idx); }
+
+  // The first preset with this name, or -1.
+  int Find(const char* name);
+  // The first uninitialized preset, or -1.
+  int NextUninitialized();
+  // How many presets have DEFAULT_USER_PRESET_NAME in their name.
+  int NDefaultUserNames() { return mNDefaultUserNames; }
+
+  // Initializes the preset with a copy of pChunk, or uninitializes it if pChunk is 0.
+  // name 0 keeps the current name.
+  void Set(int idx, const char* name, ByteChunkView* pChunk);
+  // The same, with another reference to a blob that's already made.
+  void SetShared(int idx, const char* name, IPresetBlob* pBlob);
+  void SetName(int idx, const char* name);
+  void Add();   // Uninitialized, at the end.
+  void PruneUninitialized();
+
+private:
+
+  WDL_PtrList<IPreset> mPresets;
+  WDL_TypedBuf<int> mIndex;   // Open addressing by name hash, preset indexes or -1 for empty.
+  int mFirstUninitialized;    // None before this one.
+  int mNDefaultUserNames;
+
+  void SetBlob(int idx, const char* name, IPresetBlob* pBlob);   // Takes the caller's reference.
+  void IndexAdd(int idx);
+  void IndexRemove(int idx);
+  void Reindex();
+};
+
 enum 
 {
   KEY_SPACE,
@@ -303,4 +395,49 @@ enum
   KEY_ALPHA_Z=KEY_ALPHA_A+25
 };
 
+// A factory bank written out by IPlugBase::DumpPresetLibrary, for plugins to
+// load instead of making the same presets in code in every instance.  The file
+// is mapped read-only, once per process, and its presets are blobs pointing
+// straight into the mapping, so an instance loading them only takes references.
+//
+// The file is a tag, the plugin's unique ID, the number of presets, then for
+// each one its name's length (with the terminator), the name, the size of its
+// params and the params, as SerializeParams writes them.
+class IPresetLibrary
+{
+public:
+
+  // The library in filename, or 0 if it can't be read or isn't for uniqueID.
+  // Libraries (and failures) are kept until the process exits.
+  static IPresetLibrary* Get(const char* filename, int uniqueID);
+  // The initialized presets in pBank.
+  static bool Write(const char* filename, int uniqueID, IPresetBank* pBank);
+  // While off Get finds nothing, for tools writing a library from the presets made in code.
+  static void SetEnabled(bool enabled);
+
+  int GetSize() { return mPresets.GetSize(); }
+  const char* GetName(int idx) { return mPresets.Get()[idx].mName; }
+  IPresetBlob* GetBlob(int idx) { return mPresets.Get()[idx].mBlob; }
+
+private:
+
+  IPresetLibrary(const char* filename, int uniqueID);
+  ~IPresetLibrary();
+  friend struct IPresetLibraries;
+  friend class WDL_PtrList<IPresetLibrary>;
+  bool Load();
+  void ReleasePresets();
+
+  struct Entry
+  {
+    const char* mName;    // In the mapping.
+    IPresetBlob* mBlob;   // Holding a reference.
+  };
+
+  WDL_String mFilename;
+  int mUniqueID;
+  WDL_FileRead* mFile;    // 0 if it couldn't be loaded.
+  WDL_TypedBuf<Entry> mPresets;
+};
+
 #endif
\ No newline at end of file
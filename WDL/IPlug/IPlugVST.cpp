@@ -3,6 +3,9 @@
 #include <stdio.h>
 
 const int VST_VERSION = 2400;
+const int MIDI_OUT_POOL_SIZE = 512;   // Events per process call before an early flush.
+const int MIDI_IN_BATCH_SIZE = 128;   // Messages handed to ProcessMidiMsgs at a time.
+const int PASS_THRU_SIZE = 64;        // Sysex events passed through per audioMasterProcessEvents call.
 
 
 int VSTSpkrArrType(int nchan)
@@ -10,6 +13,8 @@ int VSTSpkrArrType(int nchan)
   if (!nchan) return kSpeakerArrEmpty;
   if (nchan == 1) return kSpeakerArrMono;
   if (nchan == 2) return kSpeakerArrStereo;
+  if (nchan == 6) return kSpeakerArr51;
+  if (nchan == 8) return kSpeakerArr71Cine;
   return kSpeakerArrUserDefined;
 }
 
@@ -21,10 +26,16 @@ IPlugVST::IPlugVST(IPlugInstanceInfo instanceInfo, int nParams, const char* chan
 : IPlugBase(nParams, channelIOStr, nPresets, effectName, productName, mfrName,
     vendorVersion, uniqueID, mfrID, latency,
     plugDoesMidi, plugDoesChunks, plugIsInst),
-    mDoesMidi(plugDoesMidi), mHostCallback(instanceInfo.mVSTHostCallback), mHostSpecificInitDone(false)
+    mDoesMidi(plugDoesMidi), mHostCallback(instanceInfo.mVSTHostCallback), mInProcessCall(false), mHasTimeInfo(false), mNMidiOut(0), mHostSpecificInitDone(false)
 {
   Trace(TRACELOC, "%s", effectName);
 
+  if (plugDoesMidi) {
+    mMidiOutPool.Resize(MIDI_OUT_POOL_SIZE);
+    mMidiOutEvents.Resize(sizeof(VstEvents) + (MIDI_OUT_POOL_SIZE - 2) * sizeof(VstEvent*));
+  }
+  mPassThruEvents.Resize(sizeof(VstEvents) + (PASS_THRU_SIZE - 2) * sizeof(VstEvent*));
+
   mHasVSTExtensions = VSTEXT_NONE;
 
   int nInputs = NInChannels(), nOutputs = NOutChannels();
@@ -104,9 +115,34 @@ inline VstTimeInfo* GetTimeInfo(audioMasterCallback hostCallback, AEffect* pAEff
 	return 0;
 }
 
+void IPlugVST::CacheTimeInfo()
+{
+  VstTimeInfo* pTI = 0;
+  if (mHostCallback) {
+    // Ask for everything the getters use, and keep whatever comes back.
+#pragma warning(disable:4312)
+    pTI = (VstTimeInfo*) mHostCallback(&mAEffect, audioMasterGetTime, 0, kVstTempoValid | kVstTimeSigValid, 0, 0);
+#pragma warning(default:4312)
+  }
+  if (pTI) {
+    mTimeInfo = *pTI;
+  }
+  mHasTimeInfo = (pTI != 0);
+}
+
+// The copy from this process call, or straight from the host from any other thread
+// or outside of processing.
+VstTimeInfo* IPlugVST::GetCachedTimeInfo(int filter)
+{
+  if (mHasTimeInfo && InProcessCall()) {
+    return (!filter || (mTimeInfo.flags & filter)) ? &mTimeInfo : 0;
+  }
+  return mHostCallback ? GetTimeInfo(mHostCallback, &mAEffect, filter) : 0;
+}
+
 int IPlugVST::GetSamplePos()
 { 
-	VstTimeInfo* pTI = GetTimeInfo(mHostCallback, &mAEffect);
+	VstTimeInfo* pTI = GetCachedTimeInfo(0);
 	if (pTI && pTI->samplePos >= 0.0) {
 		return int(pTI->samplePos + 0.5);
 	}
@@ -116,7 +152,7 @@ int IPlugVST::GetSamplePos()
 double IPlugVST::GetTempo()
 {
   if (mHostCallback) {
-	  VstTimeInfo* pTI = GetTimeInfo(mHostCallback, &mAEffect, kVstTempoValid);
+	  VstTimeInfo* pTI = GetCachedTimeInfo(kVstTempoValid);
 	  if (pTI && pTI->tempo >= 0.0) {
   		return pTI->tempo;
   	}
@@ -127,7 +163,7 @@ double IPlugVST::GetTempo()
 void IPlugVST::GetTimeSig(int* pNum, int* pDenom)
 {
 	*pNum = *pDenom = 0;
-	VstTimeInfo* pTI = GetTimeInfo(mHostCallback, &mAEffect, kVstTimeSigValid);
+	VstTimeInfo* pTI = GetCachedTimeInfo(kVstTimeSigValid);
 	if (pTI && pTI->timeSigNumerator >= 0.0 && pTI->timeSigDenominator >= 0.0) {
 		*pNum = pTI->timeSigNumerator;
 		*pDenom = pTI->timeSigDenominator;
@@ -183,15 +219,19 @@ bool IPlugVST::IsRenderingOffline()
 
 void IPlugVST::SetLatency(int samples)
 {
+    bool changed = (mAEffect.initialDelay != samples);
     mAEffect.initialDelay = samples;
     IPlugBase::SetLatency(samples);
+    // initialDelay is only read at load time unless the host is told to look again.
+    if (changed && mHostCallback)
+    {
+      mHostCallback(&mAEffect, audioMasterIOChanged, 0, 0, 0, 0.0f);
+    }
 }
 
+// Sent straight away, the event belongs to the caller. MIDI goes through SendMidiMsg instead.
 bool IPlugVST::SendVSTEvent(VstEvent* pEvent)
 { 
-	// It would be more efficient to bundle these and send at the end of a processed block,
-	// but that would require writing OnBlockEnd and making sure it always gets called,
-	// and who cares anyway, midi events aren't that dense.
 	VstEvents events;
 	memset(&events, 0, sizeof(VstEvents));
   events.numEvents = 1;
@@ -199,24 +239,111 @@ bool IPlugVST::SendVSTEvent(VstEvent* pEvent)
 	return (mHostCallback(&mAEffect, audioMasterProcessEvents, 0, 0, &events, 0.0f) == 1);
 }
 
+static void MakeVSTMidiEvent(VstMidiEvent* pEvent, IMidiMsg* pMsg)
+{
+	memset(pEvent, 0, sizeof(VstMidiEvent));
+	pEvent->type = kVstMidiType;
+	pEvent->byteSize = sizeof(VstMidiEvent);  // Should this be smaller?
+	pEvent->deltaFrames = pMsg->mOffset;
+	pEvent->midiData[0] = pMsg->mStatus;
+	pEvent->midiData[1] = pMsg->mData1;
+	pEvent->midiData[2] = pMsg->mData2;
+}
+
+// On the audio thread, queued until the end of the process call, or of the next one for
+// messages sent between calls (passed through from effProcessEvents, say); returns false
+// if the host turned down the events that had to be flushed early to make room. From
+// anywhere else (the GUI) the message goes to the host straight away, the pool belongs
+// to the audio thread.
 bool IPlugVST::SendMidiMsg(IMidiMsg* pMsg)
 { 
-	VstMidiEvent midiEvent;
-	memset(&midiEvent, 0, sizeof(VstMidiEvent));
+  if (!InProcessCall() && !OnAudioThread()) {
+    VstMidiEvent event;
+    MakeVSTMidiEvent(&event, pMsg);
+    return SendVSTEvent((VstEvent*) &event);
+  }
+
+  bool rc = true;
+  if (mNMidiOut == mMidiOutPool.GetSize()) {
+    rc = FlushMidiOut();
+    if (!mMidiOutPool.GetSize()) {
+      return false;   // Not a MIDI plugin.
+    }
+  }
+
+	MakeVSTMidiEvent(mMidiOutPool.Get() + mNMidiOut++, pMsg);
+	return rc;
+}
+
+bool IPlugVST::FlushMidiOut()
+{
+  if (!mNMidiOut) {
+    return true;
+  }
 
-	midiEvent.type = kVstMidiType;
-	midiEvent.byteSize = sizeof(VstMidiEvent);  // Should this be smaller?
-	midiEvent.deltaFrames = pMsg->mOffset;
-	midiEvent.midiData[0] = pMsg->mStatus;
-	midiEvent.midiData[1] = pMsg->mData1;
-	midiEvent.midiData[2] = pMsg->mData2;
+  VstEvents* pEvents = (VstEvents*) mMidiOutEvents.Get();
+  pEvents->numEvents = mNMidiOut;
+  pEvents->reserved = 0;
+  for (int i = 0; i < mNMidiOut; ++i) {
+    pEvents->events[i] = (VstEvent*) (mMidiOutPool.Get() + i);
+  }
+  mNMidiOut = 0;
+	return (mHostCallback(&mAEffect, audioMasterProcessEvents, 0, 0, pEvents, 0.0f) == 1);
+}
+
+// MIDI goes to the plugin in runs through ProcessMidiMsgs, anything else (sysex)
+// is passed back to the host in as few audioMasterProcessEvents calls as possible.
+void IPlugVST::ProcessVSTEvents(VstEvents* pEvents)
+{
+  IPLUG_AUDIT_SCOPE;
+  IMidiMsg msgs[MIDI_IN_BATCH_SIZE];
+  VstEvents* pPassThru = (VstEvents*) mPassThruEvents.Get();
+  int nMsgs = 0, nPassThru = 0;
+
+  for (int i = 0; i < pEvents->numEvents; ++i) {
+    VstEvent* pEvent = pEvents->events[i];
+    if (!pEvent) {
+      continue;
+    }
+    if (pEvent->type == kVstMidiType) {
+      VstMidiEvent* pME = (VstMidiEvent*) pEvent;
+      IMidiMsg* pMsg = msgs + nMsgs++;
+      pMsg->mOffset = pME->deltaFrames;
+      pMsg->mStatus = pME->midiData[0];
+      pMsg->mData1 = pME->midiData[1];
+      pMsg->mData2 = pME->midiData[2];
+      if (nMsgs == MIDI_IN_BATCH_SIZE) {
+        ProcessMidiMsgs(msgs, nMsgs);
+        nMsgs = 0;
+      }
+    }
+    else {
+      pPassThru->events[nPassThru++] = pEvent;
+      if (nPassThru == PASS_THRU_SIZE) {
+        SendVSTEvents(pPassThru, nPassThru);
+        nPassThru = 0;
+      }
+    }
+  }
 
-	return SendVSTEvent((VstEvent*) &midiEvent);
+  if (nMsgs) {
+    ProcessMidiMsgs(msgs, nMsgs);
+  }
+  if (nPassThru) {
+    SendVSTEvents(pPassThru, nPassThru);
+  }
+}
+
+// pEvents->events already holds n events that belong to the caller.
+bool IPlugVST::SendVSTEvents(VstEvents* pEvents, int n)
+{
+  pEvents->numEvents = n;
+  pEvents->reserved = 0;
+	return (mHostCallback(&mAEffect, audioMasterProcessEvents, 0, 0, pEvents, 0.0f) == 1);
 }
 
 bool IPlugVST::SendMidiMsgs(WDL_TypedBuf<IMidiMsg>* pMsgs)
 {
-  // Todo: bundle and SendVSTEvents.
   bool rc = true;
   int n = pMsgs->GetSize();
   IMidiMsg* pMsg = pMsgs->Get();
@@ -263,7 +390,7 @@ void InitializeVSTChunk(ByteChunk* pChunk)
   pChunk->Put(&ver);
 }
 
-int GetIPlugVerFromChunk(ByteChunk* pChunk, int* pPos)
+int GetIPlugVerFromChunk(ByteChunkView* pChunk, int* pPos)
 {
   int magic = 0, ver = 0;
   int pos = pChunk->Get(&magic, *pPos);
@@ -280,6 +407,17 @@ VstIntPtr VSTCALLBACK IPlugVST::VSTDispatcher(AEffect *pEffect, VstInt32 opCode,
 	if (!_this) {
 		return 0;
 	}
+
+  // MIDI in comes every block, usually from the audio thread, so it doesn't lock.
+  if (opCode == effProcessEvents) {
+    VstEvents* pEvents = (VstEvents*) ptr;
+    if (pEvents && pEvents->events) {
+      _this->ProcessVSTEvents(pEvents);
+      return 1;
+    }
+    return 0;
+  }
+
   IPlugBase::IMutexLock lock(_this);
 
   // Handle a couple of opcodes here to make debugging easier.
@@ -349,7 +487,7 @@ VstIntPtr VSTCALLBACK IPlugVST::VSTDispatcher(AEffect *pEffect, VstInt32 opCode,
           }
           if (_this->GetGUI()) _this->GetGUI()->SetParameterFromPlug(idx, v, false);
           pParam->Set(v);
-          _this->OnParamChange(idx);
+          _this->QueueParamChange(idx, pParam->GetNormalized(), false);
         }
         return 1;
       }
@@ -367,11 +505,13 @@ VstIntPtr VSTCALLBACK IPlugVST::VSTDispatcher(AEffect *pEffect, VstInt32 opCode,
     }
     case effMainsChanged: {
       if (!value) {
+        _this->SetProcessing(false);
         _this->OnActivate(false);
 		    _this->Reset();
 	    }
       else {
         _this->OnActivate(true);
+        _this->SetProcessing(true);
       }
 	    return 0;
     }
@@ -423,10 +563,12 @@ VstIntPtr VSTCALLBACK IPlugVST::VSTDispatcher(AEffect *pEffect, VstInt32 opCode,
         bool savedOK = true;
         if (isBank) {
           _this->ModifyCurrentPreset();
+          pChunk->Reserve(pChunk->Size() + _this->SerializedPresetsSize());
           savedOK = _this->SerializePresets(pChunk);
           //savedOK = _this->SerializeState(pChunk);
         }
         else {
+          pChunk->Reserve(pChunk->Size() + _this->SerializedStateSize());
           savedOK = _this->SerializeState(pChunk);
         }
         if (savedOK && pChunk->Size()) {
@@ -439,9 +581,9 @@ VstIntPtr VSTCALLBACK IPlugVST::VSTDispatcher(AEffect *pEffect, VstInt32 opCode,
     case effSetChunk: {
       if (ptr) {
         bool isBank = (!idx);
-        ByteChunk* pChunk = (isBank ? &(_this->mBankState) : &(_this->mState));
-        pChunk->Resize(value);
-        memcpy(pChunk->GetBytes(), ptr, value);
+        // The host's buffer stays valid for the call, read it in place.
+        ByteChunkView chunk(ptr, value);
+        ByteChunkView* pChunk = &chunk;
         int pos = 0;
         int iplugVer = GetIPlugVerFromChunk(pChunk, &pos);
         isBank &= (iplugVer >= 0x010000);
@@ -459,29 +601,6 @@ VstIntPtr VSTCALLBACK IPlugVST::VSTDispatcher(AEffect *pEffect, VstInt32 opCode,
 	      }
       }
 	    return 0;
-    }
-    case effProcessEvents: {
-	    VstEvents* pEvents = (VstEvents*) ptr;
-	    if (pEvents && pEvents->events) {
-		    for (int i = 0; i < pEvents->numEvents; ++i) {
-          VstEvent* pEvent = pEvents->events[i];
-			    if (pEvent) {
-				    if (pEvent->type == kVstMidiType) {
-					    VstMidiEvent* pME = (VstMidiEvent*) pEvent;
-              IMidiMsg msg(pME->deltaFrames, pME->midiData[0], pME->midiData[1], pME->midiData[2]);
-              _this->ProcessMidiMsg(&msg);
-              //#ifdef TRACER_BUILD
-              //  msg.LogMsg();
-              //#endif
-				    }
-				    else {
-					    _this->SendVSTEvent(pEvent);	// Pass sysex messages through.
-				    }
-			    }
-		    }
-		    return 1;
-	    }
-	    return 0;
     }
 	  case effCanBeAutomated: {
 	  	return 1;
@@ -524,14 +643,18 @@ VstIntPtr VSTCALLBACK IPlugVST::VSTDispatcher(AEffect *pEffect, VstInt32 opCode,
 	    VstSpeakerArrangement* pInputArr = (VstSpeakerArrangement*) value;
 	    VstSpeakerArrangement* pOutputArr = (VstSpeakerArrangement*) ptr;
 	    if (pInputArr) {
-        int n = pInputArr->numChannels;
+        int n = MIN(pInputArr->numChannels, _this->NInChannels());
         _this->SetInputChannelConnections(0, n, true);
         _this->SetInputChannelConnections(n, _this->NInChannels() - n, false);
+        _this->mInputSpkrArr.numChannels = n;
+        _this->mInputSpkrArr.type = VSTSpkrArrType(n);
       }
 	    if (pOutputArr) {
-        int n = pOutputArr->numChannels;
+        int n = MIN(pOutputArr->numChannels, _this->NOutChannels());
         _this->SetOutputChannelConnections(0, n, true);
         _this->SetOutputChannelConnections(n, _this->NOutChannels() - n, false);
+        _this->mOutputSpkrArr.numChannels = n;
+        _this->mOutputSpkrArr.type = VSTSpkrArrType(n);
 	    }
 	    return 1;
     }
@@ -665,43 +788,52 @@ void IPlugVST::VSTPrepProcess(SAMPLETYPE** inputs, SAMPLETYPE** outputs, VstInt3
   if (mDoesMidi) {
     mHostCallback(&mAEffect, __audioMasterWantMidiDeprecated, 0, 0, 0, 0.0f);
   }
+  mProcessThread = CurrentThreadID();
+  mInProcessCall = true;
+  CacheTimeInfo();
   AttachInputBuffers(0, NInChannels(), inputs, nFrames);
   AttachOutputBuffers(0, NOutChannels(), outputs);
 }
 
+// MIDI out goes to the host, and the cached time info is stale from here on.
+void IPlugVST::EndProcessCall()
+{
+  FlushMidiOut();
+  mHasTimeInfo = mInProcessCall = false;
+}
+
 // Deprecated.
 void VSTCALLBACK IPlugVST::VSTProcess(AEffect* pEffect, float** inputs, float** outputs, VstInt32 nFrames)
 { 
   TRACE;
 	IPlugVST* _this = (IPlugVST*) pEffect->object;
-  IMutexLock lock(_this);
   _this->VSTPrepProcess(inputs, outputs, nFrames);
   _this->ProcessBuffersAccumulating((float) 0.0f, nFrames);
+  _this->EndProcessCall();
 }
 
 void VSTCALLBACK IPlugVST::VSTProcessReplacing(AEffect* pEffect, float** inputs, float** outputs, VstInt32 nFrames)
 { 
   TRACE;
 	IPlugVST* _this = (IPlugVST*) pEffect->object;
-  IMutexLock lock(_this);
   _this->VSTPrepProcess(inputs, outputs, nFrames);
   _this->ProcessBuffers((float) 0.0f, nFrames);
+  _this->EndProcessCall();
 }
 
 void VSTCALLBACK IPlugVST::VSTProcessDoubleReplacing(AEffect* pEffect, double** inputs, double** outputs, VstInt32 nFrames)
 {  
   TRACE;
   IPlugVST* _this = (IPlugVST*) pEffect->object;
-  IMutexLock lock(_this);
   _this->VSTPrepProcess(inputs, outputs, nFrames);
   _this->ProcessBuffers((double) 0.0, nFrames);
+  _this->EndProcessCall();
 }  
 
 float VSTCALLBACK IPlugVST::VSTGetParameter(AEffect *pEffect, VstInt32 idx)
 { 
   Trace(TRACELOC, "%d", idx);
 	IPlugVST* _this = (IPlugVST*) pEffect->object;
-  IMutexLock lock(_this);
   if (idx >= 0 && idx < _this->NParams()) {
 	  return (float) _this->GetParam(idx)->GetNormalized();
   }
@@ -712,12 +844,10 @@ void VSTCALLBACK IPlugVST::VSTSetParameter(AEffect *pEffect, VstInt32 idx, float
 {  
   Trace(TRACELOC, "%d:%f", idx, value);
 	IPlugVST* _this = (IPlugVST*) pEffect->object;
-  IMutexLock lock(_this);
   if (idx >= 0 && idx < _this->NParams()) {
     if (_this->GetGUI()) {
       _this->GetGUI()->SetParameterFromPlug(idx, value, true);
   	}
-    _this->GetParam(idx)->SetNormalized(value);
-  	_this->OnParamChange(idx);
+    _this->QueueParamChange(idx, value, true);
   }
 }
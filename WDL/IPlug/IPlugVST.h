@@ -59,8 +59,33 @@ private:
   ERect mEditRect;
   audioMasterCallback mHostCallback;
 
+  // Set for the length of a process call, on the thread making it. The cached
+  // time info and the MIDI out pool belong to that call and only it touches them.
+  bool mInProcessCall;
+  IThreadID mProcessThread;
+  bool InProcessCall() { return mInProcessCall && SameThread(mProcessThread, CurrentThreadID()); }
+  void EndProcessCall();
+
+  // The host's time info, asked for once per process call. The time getters
+  // read this copy instead of calling back into the host every time.
+  VstTimeInfo mTimeInfo;
+  bool mHasTimeInfo;
+  void CacheTimeInfo();
+  VstTimeInfo* GetCachedTimeInfo(int filter);
+
   bool SendVSTEvent(VstEvent* pEvent);
-  bool SendVSTEvents(WDL_TypedBuf<VstEvent>* pEvents);
+  bool SendVSTEvents(VstEvents* pEvents, int n);
+
+  // Incoming events are split into MIDI for the plugin and sysex to pass through.
+  WDL_HeapBuf mPassThruEvents;  // VstEvents with room for PASS_THRU_SIZE pointers.
+  void ProcessVSTEvents(VstEvents* pEvents);
+
+  // MIDI out sent on the audio thread is collected in a fixed pool and handed to the
+  // host in one audioMasterProcessEvents call at the end of the (next) process call.
+  WDL_TypedBuf<VstMidiEvent> mMidiOutPool;
+  WDL_HeapBuf mMidiOutEvents;   // VstEvents with room for a pointer per pool entry.
+  int mNMidiOut;
+  bool FlushMidiOut();
 
   VstSpeakerArrangement mInputSpkrArr, mOutputSpkrArr;
 
@@ -2,7 +2,8 @@
 #define _IPLUG_INCLUDE_HDR_
 
 // Include this file in the main header for your plugin, 
-// after #defining either VST_API or AU_API.
+// after #defining either VST_API, AU_API or OFFLINE_API.
+// #define NO_IGRAPHICS too for a plugin without an editor (required on Linux).
 
 #include "resource.h" // This is your plugin's resource.h.
 
@@ -14,22 +15,36 @@
   #include "IPlugAU.h"
   typedef IPlugAU IPlug;
   #define API_EXT "audiounit"
+#elif defined OFFLINE_API
+  #include "IPlugOffline.h"
+  typedef IPlugOffline IPlug;
+  #define API_EXT "offline"
 #else
   #error "No API defined!"
 #endif
 
 #if defined _WIN32
-  #include "IGraphicsWin.h"
   #define EXPORT __declspec(dllexport)
 #elif defined __APPLE__
-  #include "IGraphicsMac.h"
   #define EXPORT __attribute__((visibility("default")))
   #ifndef BUNDLE_DOMAIN
     #define BUNDLE_DOMAIN "com." BUNDLE_MFR
   #endif
   #define BUNDLE_ID BUNDLE_DOMAIN "." API_EXT "." BUNDLE_NAME
+#elif defined __linux__
+  #define EXPORT __attribute__((visibility("default")))
 #else
   #error "No OS defined!"
 #endif
 
+#if defined NO_IGRAPHICS
+  // MakeGraphics returns 0, GetGUI() is always 0.
+#elif defined _WIN32
+  #include "IGraphicsWin.h"
+#elif defined __APPLE__
+  #include "IGraphicsMac.h"
+#else
+  #error "No graphics on this OS, define NO_IGRAPHICS!"
+#endif
+
 #endif
\ No newline at end of file
@@ -4,7 +4,12 @@
 // Include this file in the main source for your plugin, 
 // after #including the main header for your plugin.
 
-#if defined _WIN32
+#if defined NO_IGRAPHICS
+  IGraphics* MakeGraphics(IPlug* pPlug, int w, int h, int FPS = 0)
+  {
+    return 0;
+  }
+#elif defined _WIN32
   HINSTANCE gHInstance = 0;
 	#ifdef __MINGW32__
 	extern "C"
@@ -53,6 +58,12 @@
       return (int) VSTPluginMain(hostCallback);
     }
   };
+#elif defined OFFLINE_API
+  IPlug* MakePlug()
+  {
+    IPlugInstanceInfo instanceInfo;
+    return new PLUG_CLASS_NAME(instanceInfo);
+  }
 #elif defined AU_API
   IPlug* MakePlug()
   {
@@ -8,6 +8,9 @@
   #define SYS_THREAD_ID (int) GetCurrentThreadId()
 #elif defined __APPLE__
   #define SYS_THREAD_ID (int) pthread_self()
+#elif defined __linux__
+  #include <pthread.h>
+  #define SYS_THREAD_ID (int) pthread_self()
 #else 
   #error "No OS defined!"
 #endif
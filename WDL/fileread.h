@@ -52,6 +52,7 @@
    #include <sys/file.h>
    #include <sys/errno.h>
    #include <sys/mman.h>
+   #include <sys/stat.h>
    #ifdef __APPLE__
       #include <sys/param.h>
       #include <sys/mount.h>
@@ -266,11 +267,11 @@ public:
       m_fsize=lseek(m_filedes,0,SEEK_END);
       lseek(m_filedes,0,SEEK_SET);
 
-      if (m_fsize < mmap_maxsize)
+      if (m_fsize >= 0 && m_fsize < mmap_maxsize)
       {
         if (m_fsize >= mmap_minsize)
         {
-          m_mmap_view = mmap(NULL,m_fsize,PROT_READ,0,m_filedes,0);
+          m_mmap_view = mmap(NULL,m_fsize,PROT_READ,MAP_SHARED,m_filedes,0);
           if (m_mmap_view == MAP_FAILED) m_mmap_view = 0;
           else m_fsize_maychange=false;
         }